@@ -22,7 +22,7 @@ def linux():
     SRC_DIR = "src"
     INCLUDES = ["include","statics"]
     LIB_PATHS = []
-    LINKS = ["-lm","-lraylib"]
+    LINKS = ["-lm","-lraylib","-lpthread"]
     LDFLAGS = []
     MACROS = {
         "PROJECT_TITLE":f'\\"{project_title}\\"', 
@@ -60,9 +60,33 @@ def web():
     objs = compile(CC,CFLAGS,MACROS,INCLUDES,[f"{SRC_DIR}/{i}" for i in os.listdir(SRC_DIR)],out_dir=BUILD_DIR)
     link(CC,objs,LIB_PATHS,LINKS,LDFLAGS,BUILD_DIR,"index.js")
 
+def tests():
+    CC = "gcc"
+    CFLAGS =  ["-g -O2"]
+    BUILD_DIR = "build/tests"
+    TESTS_DIR = "tests"
+    INCLUDES = ["include"]
+    LINKS = ["-lm","-lpthread","-ljpeg"]
+
+    # every test includes the sources it checks, so they are always rebuilt
+    create_dirs([BUILD_DIR])
+    rm_all(BUILD_DIR)
+    failed = []
+    for t in sorted(os.listdir(TESTS_DIR)):
+        if not t.endswith(".c"): continue
+        name = t.replace(".c","")
+        objs = compile(CC,CFLAGS,{},INCLUDES,[f"{TESTS_DIR}/{t}"],out_dir=BUILD_DIR)
+        link(CC,objs,[],LINKS,[],BUILD_DIR,name)
+        if (os.system(os.path.join(BUILD_DIR,name)) != 0): failed.append(name)
+
+    if failed:
+        print(f"{COLORS.RED}FAILED: {COLORS.RESET} {' '.join(failed)}")
+        sys.exit(1)
+
 def clean():
     rm_all("build/linux")
     rm_all("build/web",["index.html", "fflate_min.js"])
+    if (os.path.exists("build/tests")): rm_all("build/tests")
     rm_all("statics")
     if (os.path.exists("sampleProject/sampleProject.zip")): os.remove("sampleProject/sampleProject.zip")
     if (os.path.exists("puppets/samplePuppets.zip")): os.remove("puppets/samplePuppets.zip")
@@ -70,6 +94,7 @@ def clean():
 if __name__ == "__main__":
     if   "clean" in sys.argv: clean(); exit(0)
     elif "clear" in sys.argv: clean(); exit(0)
+    elif "test" in sys.argv: tests(); exit(0)
     statics()
     if "web" in sys.argv: web(); exit(0)
     else: linux()
@@ -22,6 +22,9 @@
 #define TITLE_FONT_SIZE         VIEWPORT_TITLE_H
 #define MODKEY                  KEY_LEFT_SHIFT
 #define COMMAND_BAR_KEY         KEY_ENTER
+#define UNDO_MODKEY             KEY_LEFT_CONTROL
+#define UNDO_KEY                KEY_Z
+#define REDO_KEY                KEY_Y
 #define CMD_BUF_S               256
 #define HINTS_BUF_S             256
 #define ZOOM_SPEED              0.1f
@@ -30,6 +33,8 @@
 #define LOGS_SCREEN_TIME        4
 #define MIN_PANEL_SIZE          20
 #define ICONS_Q                 7
+#define MIN_RENDER_SCALE        0.25f
+#define RENDER_SCALE_STEP       0.125f
 
 #ifndef RESIZE_CURSOR
 #define RESIZE_CURSOR MOUSE_CURSOR_RESIZE_ALL
@@ -0,0 +1,39 @@
+#ifndef DISPLAYLIST_H
+#define DISPLAYLIST_H
+
+#include <stdint.h>
+#include "theater.h"
+
+#define DISPLAYLIST_CACHE_SIZE 8 // lists kept recorded, the least recently used one is recorded over
+
+// the quads of one puppet, drawn from its atlas and skipped as a whole when bounds are out of view
+typedef struct DisplayGroup{
+    Texture2D atlas;
+    Rectangle bounds;
+    int firstQuad;
+    int quadsQ;
+} DisplayGroup;
+
+// The skins of a frame in world space and drawing order. Recording evaluates
+// the frame once, replaying it only issues the quads, so the same list can be
+// drawn to the viewport, to an export framebuffer or to a thumbnail.
+// The lists of the last frames drawn are cached, one is recorded again when
+// the frame version moves or when it was recorded over by another frame.
+typedef struct DisplayList{
+    Frame *frame;      // the list is cached for, NULL for a free slot
+    unsigned int used; // when it was last asked for
+    int version;       // frame version it was recorded from
+    int quadsQ, quadsCap;
+    SkinQuad *quads;
+    int groupsQ, groupsCap;
+    DisplayGroup *groups;
+} DisplayList;
+
+void RecordDisplayList(Frame *f, DisplayList *out);
+DisplayList *GetFrameDisplayList(Frame *f);
+void ReleaseFrameDisplayList(Frame *f);
+void DrawDisplayList(DisplayList *dl, Vector2 offset, Vector2 *view);
+uint64_t HashFrameState(Frame *f);
+bool SameFrameState(Frame *a, Frame *b);
+
+#endif
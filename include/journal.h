@@ -0,0 +1,80 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include "theater.h"
+
+#define JOURNAL_MAX_ENTRIES     1024
+#define JOURNAL_DEFAULT_BUDGET  (8*1024*1024) //bytes
+#define JOURNAL_COALESCE_TIME   0.5           //seconds
+
+typedef enum JournalEntryType{
+    JOURNAL_SNAPSHOT,       // a puppet snapshot was created, edited or removed
+    JOURNAL_FRAME_INSERT,   // a range of frames was added to the timeline
+    JOURNAL_FRAME_REMOVE,   // a range of frames was taken out of the timeline
+    JOURNAL_FRAME_MOVE,     // a range of frames was moved
+    JOURNAL_FRAME_REVERSE,  // a range of frames was reversed
+    JOURNAL_FRAME_CONTENT,  // a frame content was replaced (paste)
+    JOURNAL_SKIN            // a bone skin was edited outside of the timeline (workshop)
+} JournalEntryType;
+
+// old and new values of a single bone, only changed bones are stored
+typedef struct BoneDelta{
+    Bone *bone;
+    Vector2 oldDirection, newDirection;
+    float oldLength, newLength;
+    int oldSkinIndex, newSkinIndex; // palette entries, for snapshots
+    Skin oldSkin, newSkin;          // for JOURNAL_SKIN
+} BoneDelta;
+
+typedef struct JournalEntry{
+    JournalEntryType type;
+    int batch; // entries of the same batch are undone and redone together, 0 for none
+    size_t size;
+    double time;
+    Frame *frame;
+    int frameIndex;
+
+    // JOURNAL_SNAPSHOT / JOURNAL_SKIN
+    Puppet *puppet;
+    Puppet *oldNext; // draw order, the puppet that was after the old snapshot
+    bool inPlace;    // the snapshot was edited where it is, the draw order didn't change
+    bool hadOld, hasNew;
+    Vector2 oldPosition, newPosition;
+    float oldScale, newScale;
+    int deltasQ;
+    BoneDelta *deltas;
+
+    // JOURNAL_FRAME_*, frame is the first one of the range
+    Frame *lastFrame;
+    int framesQ;
+    int toIndex; // where a moved range starts
+    Frame *prevFrame;   // the frame before the range at frameIndex
+    Frame *toPrevFrame; // the frame before a moved range at toIndex
+    Frame *stash; // frame content owned by the journal while it's out of the timeline
+} JournalEntry;
+
+void JournalRecordSnapshot(Frame *f, PuppetSnapshot *old, PuppetSnapshot *new);
+void JournalRecordSnapshotEdit(Frame *f, int index, PuppetSnapshot *before, PuppetSnapshot *s);
+void JournalBeginBatch();
+void JournalEndBatch();
+void JournalRecordFrameInsert(Frame *f, int index);
+void JournalRecordFrameRemove(Frame *f, Frame *prev, int index);
+void JournalRecordFramesInsert(Frame *first, Frame *last, int count, int index);
+void JournalRecordFramesRemove(Frame *first, Frame *last, Frame *prev, int count, int index);
+void JournalRecordFramesMove(Frame *first, Frame *last, Frame *prev, int count, int from, int to);
+void JournalRecordFramesReverse(Frame *first, Frame *last, int count, int index);
+void JournalRecordFramePaste(Frame *dst, int index);
+void JournalRecordSkin(Bone *b, Skin old);
+bool JournalUndo();
+bool JournalRedo();
+void JournalShortcuts();
+void JournalClear();
+void JournalDropPuppet(Puppet *p);
+void JournalRemovePuppet(Puppet *p);
+void JournalSetBudget(size_t bytes);
+size_t JournalGetBudget();
+size_t JournalGetUsage();
+int JournalGetDepth();
+
+#endif
@@ -14,6 +14,35 @@ typedef struct mjpegw_mem_interface
     void*   user;
 } mjpegw_mem_interface;
 
+//-----------------------------------------------------------------------------------------------------------------------------
+// Bump allocator over a caller buffer, see mjpegw_arena_interface
+typedef struct mjpegw_arena
+{
+    uint8_t* base;
+    size_t   size;
+    size_t   used;
+    size_t   last;      // offset of the last block, it can grow in place
+} mjpegw_arena;
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Chroma resolution. Subsampled modes average the chroma of 2 (4:2:2) or 4 (4:2:0) pixels,
+// 4:2:0 halves the number of blocks to encode
+typedef enum mjpegw_subsampling
+{
+    MJPEGW_444 = 0,     // full resolution chroma
+    MJPEGW_422,         // half horizontal resolution
+    MJPEGW_420          // half horizontal and vertical resolution
+} mjpegw_subsampling;
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Huffman tables of the frames. Optimized tables are stored in every frame (DHT), so any decoder reads them
+typedef enum mjpegw_huffman
+{
+    MJPEGW_HUFFMAN_STANDARD = 0,    // the example tables of the spec, no extra work
+    MJPEGW_HUFFMAN_PER_FRAME,       // optimal tables for each frame, every frame is encoded twice
+    MJPEGW_HUFFMAN_SAMPLED          // tables built from the first frames and kept for the rest
+} mjpegw_huffman;
+
 struct mjpegw_context;
 
 #ifdef __cplusplus
@@ -21,30 +50,132 @@ extern "C" {
 #endif
 
 //-----------------------------------------------------------------------------------------------------------------------------
-// Opens a new AVI file
+// Opens a new AVI file. Past 1GB the video goes on in OpenDML (AVI 2.0) RIFF-AVIX segments, indexed by
+// indx/ix00, AVI 1.0 readers still play the first segment
 //          [filename]          Name of the file, overwritten if it already exists
 //          [width, height]     Resolution of the video, all frame *must* have this resolution
 //          [fps]               Frame per second
+//          [subsampling]       Chroma resolution of every frame
 //          [mem]               Custom allocator, if NULL stdlib will be used (alloc/realloc/free)
 //
 //  Returns a context to be used in the following function calls
-struct mjpegw_context* mjpegw_open(const char *filename, uint32_t width, uint32_t height, uint32_t fps, mjpegw_mem_interface* mem);
+struct mjpegw_context* mjpegw_open(const char *filename, uint32_t width, uint32_t height, uint32_t fps,
+                                   mjpegw_subsampling subsampling, mjpegw_mem_interface* mem);
+
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Allocator handing out [buffer] in order, free does nothing. Every allocation of mjpegw happens in
+// mjpegw_open, mjpegw_reserve_frames, mjpegw_set_threads and the first mjpegw_add_frame, all on the
+// calling thread, so one arena of mjpegw_memory_bound bytes is enough for a whole video
+//          [arena]             State of the allocator, must outlive the context
+//          [buffer, size]      Memory handed out, its first bytes are skipped up to a 16 bytes boundary
+mjpegw_mem_interface mjpegw_arena_interface(mjpegw_arena* arena, void* buffer, size_t size);
+
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Bytes of memory a video can take at most, an arena of this size never runs out
+//          [width, height]     Resolution of the video
+//          [subsampling]       Chroma resolution
+//          [threads]           Workers given to mjpegw_set_threads, 0 if it's not called
+//          [frames]            Frames given to mjpegw_reserve_frames
+size_t mjpegw_memory_bound(uint32_t width, uint32_t height, mjpegw_subsampling subsampling, uint32_t threads,
+                           uint32_t frames);
+
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Makes room in the index for [frames] frames, adding them doesn't allocate afterwards
+//          [ctx]               Previous created context
+//
+//  Returns 1 on success, 0 if the memory couldn't be allocated
+int mjpegw_reserve_frames(struct mjpegw_context *ctx, uint32_t frames);
+
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Sets an exact frame duration, overriding the integer [fps] given to mjpegw_open
+//          [ctx]               Previous created context, no frame must have been added yet
+//          [microseconds]      Duration of every frame
+void mjpegw_set_frame_duration(struct mjpegw_context *ctx, uint32_t microseconds);
+
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Chooses the huffman tables, standard ones by default
+//          [ctx]               Previous created context, no frame must have been added yet
+//          [huffman]           See mjpegw_huffman
+//          [sample_frames]     Frames counted by MJPEGW_HUFFMAN_SAMPLED, they are counted on the calling thread
+void mjpegw_set_huffman(struct mjpegw_context *ctx, mjpegw_huffman huffman, uint32_t sample_frames);
+
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Lowers the quality of the frames to meet a target size, the size of the last encoded frame is the
+// feedback for the next ones. With workers it's the frame added 2 * threads frames before, the video
+// doesn't depend on how fast they are but differs from the one encoded on the calling thread.
+// Disabled by default
+//          [ctx]               Previous created context, no frame must have been added yet
+//          [bitrate]           Average bits per second of the video, 0 for no target
+//          [max_frame_size]    Bytes a frame should stay under, 0 for no limit. Frames can still go over
+//                              it when the content changes suddenly
+void mjpegw_set_rate_control(struct mjpegw_context *ctx, uint32_t bitrate, uint32_t max_frame_size);
+
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Encodes the following frames on a pool of worker threads, mjpegw_add_frame copies the pixels and
+// returns while older frames are still being encoded. Frames are written in the order they were added
+//          [ctx]               Previous created context, no frame must have been added yet
+//          [threads]           Number of workers, 0 uses one per core
+//
+//  Returns the number of workers started, 0 if frames are still encoded on the calling thread
+//  (builds without pthreads, MJPEGW_NO_THREADS or emscripten). Workers never call [mem]
+uint32_t mjpegw_set_threads(struct mjpegw_context *ctx, uint32_t threads);
+
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Workers mjpegw_set_threads starts when asked for one per core, to size mjpegw_memory_bound before
+// opening the video. 0 in builds without threads
+uint32_t mjpegw_count_threads(void);
 
 
 //-----------------------------------------------------------------------------------------------------------------------------
 // Adds a new frame to the video
 //          [ctx]               Previous created context
-//          [pixels]            Pointer to R8G8B8A8 data (32 bits per pixel)
-//          [quality]           JPEG Compresion setring 
-//                                  3: Highest. Compression varies wildly (between 1/3 and 1/20).
-//                                  2: Very good quality. About 1/2 the size of 3.
-//                                  1: Noticeable. About 1/6 the size of 3, or 1/3 the size of 2.
-void mjpegw_add_frame(struct mjpegw_context *ctx, const void* pixels, const int quality);
+//          [pixels]            Pointer to R8G8B8A8 data (32 bits per pixel), can be released once this returns
+//          [stride]            Bytes from a row to the next, 0 for width*4. Negative for bottom-up images
+//                              (OpenGL read backs), [pixels] then points to the top row, the last one in memory
+//          [quality]           JPEG Compresion setring, from 1 (lowest) to 100 (highest)
+//                                  100: All ones quantization. Compression varies wildly (between 1/3 and 1/20).
+//                                  90:  Very good quality, about 1/3 the size of 100.
+//                                  50:  Noticeable, the example tables of the spec.
+//                              With rate control it's the highest quality the frame can get
+void mjpegw_add_frame(struct mjpegw_context *ctx, const void* pixels, int stride, int quality);
 
 
 //-----------------------------------------------------------------------------------------------------------------------------
-// Finalizes and closes the AVI file
+// Adds a frame identical to an earlier one. Nothing is encoded, the index points to its data. When that
+// data is in an earlier OpenDML segment it's copied from the file instead
 //          [ctx]               Previous created context
+//          [frame]             Index of the earlier frame, counting every added and repeated frame from 0
+void mjpegw_repeat_frame(struct mjpegw_context *ctx, uint32_t frame);
+
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Writes a single JPEG image. The scan is split in restart intervals of whole MCU rows (DRI/RSTn
+// markers, still baseline) and the intervals are encoded in parallel
+//          [filename]          Name of the file, overwritten if it already exists
+//          [width, height]     Resolution of the image
+//          [pixels]            Pointer to R8G8B8A8 data (32 bits per pixel)
+//          [stride]            Same as mjpegw_add_frame
+//          [quality]           Same as mjpegw_add_frame
+//          [subsampling]       Chroma resolution
+//          [threads]           Number of threads, 0 uses one per core
+//          [mem]               Custom allocator, if NULL stdlib will be used. Only called from the calling thread
+//
+//  Returns 1 on success, 0 otherwise
+int mjpegw_write_jpeg(const char *filename, uint32_t width, uint32_t height, const void* pixels, int stride,
+                      const int quality, mjpegw_subsampling subsampling, uint32_t threads, mjpegw_mem_interface* mem);
+
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Finalizes and closes the AVI file, waiting for the frames still being encoded
+//          [ctx]               Previous created context, released
 void mjpegw_close(struct mjpegw_context *ctx);
 
 
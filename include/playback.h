@@ -0,0 +1,42 @@
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+#include <stddef.h>
+#include "theater.h"
+#include "pose.h"
+
+#define PLAYBACK_RING_SIZE        8  // poses evaluated ahead of the playhead
+#define PLAYBACK_EVALS_PER_UPDATE 2  // ahead evaluations done on every update
+#define PLAYBACK_CACHE_MAX_FRAMES 1024
+#define PLAYBACK_CACHE_DEFAULT_BUDGET (64*1024*1024) //bytes
+
+typedef enum PlaybackDropPolicy{
+    PLAYBACK_DROP_FRAMES, // late frames are skipped, the playhead always follows the clock
+    PLAYBACK_HOLD_FRAMES  // every frame is shown, the clock waits for late frames
+} PlaybackDropPolicy;
+
+// a frame rendered through the virtual camera, the camera and background
+// are kept to detect edits made directly on the frame
+typedef struct CachedFrame{
+    Frame *frame;
+    VirtualCameraSnapshot cameraPos;
+    float bgColor[3];
+    RenderTexture texture;
+} CachedFrame;
+
+void PlaybackStart(PlaybackDropPolicy policy);
+bool PlaybackUpdate(float frameDelay, bool loop);
+void PlaybackInvalidate();
+void PlaybackInvalidateFrame(Frame *f);
+void PlaybackStop();
+int PlaybackGetDroppedFrames();
+
+void PlaybackSetCacheEnabled(bool enabled);
+RenderTexture *PlaybackGetCachedFrame(Frame *f);
+void PlaybackClearCache();
+void PlaybackSetCacheBudget(size_t bytes);
+size_t PlaybackGetCacheBudget();
+size_t PlaybackGetCacheUsage();
+float PlaybackGetCacheHitRate();
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef POSE_H
+#define POSE_H
+
+#include <stddef.h>
+#include "theater.h"
+
+#define PACKED_LENGTH_SCALE 16.0f // 12.4 fixed point
+
+typedef struct PoseBone{
+    Bone *bone;
+    Vector2 direction;
+    float length;
+    Skin skin;
+    Vector2 start;    // world space, where the skin is hinged
+    Vector2 position; // world space end point
+} PoseBone;
+
+typedef struct PosePuppet{
+    Puppet *puppet;
+    Vector2 position;
+    float scale;
+    int firstBone;
+    int bonesQ;
+} PosePuppet;
+
+// World space transforms of a frame (or of some snapshots). Evaluating a pose
+// only reads puppets and snapshots, so any number of them can be in flight.
+// The buffers are owned by the caller and reused between evaluations.
+typedef struct Pose{
+    Frame *frame;
+    int frameIndex;
+    int puppetsQ, puppetsCap;
+    PosePuppet *puppets;
+    int bonesQ, bonesCap;
+    PoseBone *bones;
+} Pose;
+
+// Compact bones of a snapshot, one entry per descendant in descendants order.
+// Directions are 16 bit angles (error under 0.003 degrees) and lengths are
+// 12.4 fixed point (error under 1/32 px, up to 4095 px). Skins were already
+// indices, flips and z-index live in the puppet palette.
+// Packed bones are never edited, so copies of a snapshot share them.
+typedef struct PackedBones{
+    int refCount;
+    int bonesQ;
+    unsigned short data[]; // angles, then lengths, then skin indices
+} PackedBones;
+
+PackedBones *PackBones(Vector2 *directions, float *lengths, int *skins, int bonesQ);
+PackedBones *CopyPackedBones(PackedBones *pk);
+void ReleasePackedBones(PackedBones *pk);
+void UnpackBones(PackedBones *pk, Vector2 *directions, float *lengths, int *skins);
+size_t PackedBonesSize(PackedBones *pk);
+
+void ClearPose(Pose *pose);
+void FreePose(Pose *pose);
+void EvaluateSnapshotPose(PuppetSnapshot *s, Pose *out);
+void EvaluateFramePose(Frame *f, int index, Pose *out);
+void ApplyPose(Pose *pose);
+Rectangle GetPosePuppetBounds(Pose *pose, int puppet);
+int GetPoseDrawOrder(Pose *pose, int puppet, PoseBone **out);
+void DrawPosePuppet(Pose *pose, int puppet, Vector2 offset);
+
+#endif
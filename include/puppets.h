@@ -27,6 +27,16 @@ typedef struct Skin{
     bool yFlip;
 } Skin;
 
+// a skin placed in world space, the arguments DrawTexturePro takes
+typedef struct SkinQuad{
+    Rectangle src;
+    Rectangle dst;
+    Vector2 origin;
+    float rotation;
+} SkinQuad;
+
+struct PuppetSnapshot;
+
 typedef struct Bone{
     // Bone Variables
     int index;
@@ -34,13 +44,20 @@ typedef struct Bone{
     float range;
     float len;
     Skin skin;
+    int skinIndex; // palette entry that last matched skin, only a hint
     struct Bone *root;
     struct Bone *parent;
     int childsQ;
     struct Bone *childs[32];
 
     // Puppet Variables
-    char *name;
+    char *name; // interned once the puppet is in the theater
+    int id;
+    struct Bone *hashNext;
+    struct PuppetSnapshot *occurrences; // every snapshot of the puppet in the timeline
+    int occurrencesQ;
+    Skin *skins; // palette of every skin used by the snapshots, they store an index
+    int skinsQ, skinsCap;
     Vector2 position;
     float scale;
     Atlas *atlas;
@@ -60,6 +77,9 @@ Atlas *LoadAtlas(char *path);
 void LoadAtlasToPuppet(Puppet *p, char *path);
 void RemoveAtlas(Atlas *a);
 void SetSkinAngle(Skin *s);
+bool SkinEquals(Skin *a, Skin *b);
+int InternSkin(Puppet *p, Skin *s);
+int InternBoneSkin(Bone *b);
 void XFlipSkin(Skin *s);
 void YFlipSkin(Skin *s);
 
@@ -84,6 +104,8 @@ int SavePuppet(Puppet *p, char* path);
 Puppet *LoadPuppet(char* path);
 void DrawBones(Bone *b, Vector2 pos, float hingeRadius, bool drawLines);
 void DrawPuppetSkin(Puppet *p);
+SkinQuad GetSkinQuad(Skin *skin, Vector2 start, Vector2 direction, float scaledLength);
+void DrawSkin(Texture2D atlas, Skin *skin, Vector2 start, Vector2 direction, float scaledLength);
 void DrawPuppetSkinTo(Puppet *p, Vector2 pos);
 void DrawPuppetSkeleton(Puppet *p, float zoom, bool drawLines);
 
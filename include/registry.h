@@ -0,0 +1,28 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include "puppets.h"
+
+#define REGISTRY_MIN_BUCKETS 64
+
+// Hash index of a puppet list. Puppets are found by their interned name
+// (chained through Puppet->hashNext) or by their id.
+typedef struct PuppetRegistry{
+    int count;
+    int bucketsQ;
+    Puppet **buckets;
+    int idsQ;
+    Puppet **ids;
+    int nextId;
+} PuppetRegistry;
+
+char *InternName(const char *name);
+char *FindInternedName(const char *name);
+
+void RegistryAdd(PuppetRegistry *r, Puppet *p, int id);
+void RegistryRemove(PuppetRegistry *r, Puppet *p);
+Puppet *RegistryFindName(PuppetRegistry *r, const char *name);
+Puppet *RegistryFindId(PuppetRegistry *r, int id);
+void RegistryClear(PuppetRegistry *r);
+
+#endif
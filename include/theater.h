@@ -2,6 +2,7 @@
 #define THEATER_H
 
 #include "puppets.h"
+#include "registry.h"
 
 typedef struct VirtualCamera{
     float w, h;
@@ -15,13 +16,14 @@ typedef struct PuppetLinkedList{
     int puppetsQ;
     Puppet *head;
     Puppet *tail;
+    PuppetRegistry registry;
 } PuppetLinkedList;
 
 typedef struct BoneSnapshot{
     Bone *bone;
     Vector2 direction;
     float length;
-    Skin skin;
+    int skin; // index in the puppet skin palette
     struct BoneSnapshot *next;
     struct BoneSnapshot *prev;
 } BoneSnapshot;
@@ -38,9 +40,16 @@ typedef struct PuppetSnapshot{
     float scale;
     Rectangle boundaries;
     RenderTexture onionSkin;
+    bool onionSkinStale; // rendered again once it can be seen, see BatchEditFrames
     BoneSnapshotLinkedList bonesSnapshots;
+    struct PackedBones *packed; // compact bones, the list is empty while set
     struct PuppetSnapshot *next;
     struct PuppetSnapshot *prev;
+
+    // occurrences list of the puppet, frame is NULL while not indexed
+    struct PuppetSnapshotLinkedList *frame;
+    struct PuppetSnapshot *nextOccurrence;
+    struct PuppetSnapshot *prevOccurrence;
 } PuppetSnapshot;
 
 typedef struct PuppetSnapshotLinkedList{
@@ -49,6 +58,9 @@ typedef struct PuppetSnapshotLinkedList{
     int snapshotsQ;
     VirtualCameraSnapshot cameraPos;
     float bgColor[3];
+    int stamp; // see MarkPuppetFrames
+    int version; // moves on every edit of the snapshots, see InvalidateFrame
+    struct DisplayList *displayList; // its slot of the display list cache, NULL if it has none
     struct PuppetSnapshotLinkedList *next;
     struct PuppetSnapshotLinkedList *prev;
 } PuppetSnapshotLinkedList;
@@ -65,15 +77,64 @@ typedef struct FrameLinkedList{
 
 typedef FrameLinkedList Timeline;
 
+typedef enum BatchEditType{
+    BATCH_OFFSET,
+    BATCH_SCALE,
+    BATCH_ROTATE,
+    BATCH_SKIN
+} BatchEditType;
+
+// a single transform applied to a puppet on many frames
+typedef struct BatchEdit{
+    BatchEditType type;
+    Vector2 offset; // BATCH_OFFSET
+    float scale;    // BATCH_SCALE, multiplies the snapshot scale
+    Bone *bone;     // BATCH_ROTATE, BATCH_SKIN
+    float degrees;  // BATCH_ROTATE
+    bool propagate; // BATCH_ROTATE, the descendants of bone rotate with it
+    Skin skin;      // BATCH_SKIN
+} BatchEdit;
+
 bool PupppetIsOnList(Puppet *puppet, PuppetLinkedList *list);
 bool PuppetNameIsOnList(char *name, PuppetLinkedList *list);
-void CopyPuppetToList(Puppet *puppet, PuppetLinkedList *list, char* name);
+Puppet *GetPuppetByName(char *name, PuppetLinkedList *list);
+Puppet *CopyPuppetToList(Puppet *puppet, PuppetLinkedList *list, char* name, int id);
+PuppetSnapshot *PuppetIsOnFrame(Puppet *p, Frame *f);
+void IndexSnapshot(PuppetSnapshot *s, Frame *f);
+void UnindexSnapshot(PuppetSnapshot *s);
+void IndexFrame(Frame *f, bool index);
+int MarkPuppetFrames(Puppet *p);
 void NewPuppetSnapshot(Puppet *p, Frame *f);
+void DeletePuppetSnapshot(PuppetSnapshot *s, Frame *list);
+PuppetSnapshot *ClonePuppetSnapshot(PuppetSnapshot *src);
+void FreePuppetSnapshot(PuppetSnapshot *s);
+int BatchEditFrames(Puppet *p, Frame *first, int index, int count, BatchEdit *edit);
+void PackSnapshot(PuppetSnapshot *s);
+void UnpackSnapshot(PuppetSnapshot *s);
+void SetCompactFrames(bool compact);
+void GenerateOnionSkin(PuppetSnapshot *p);
 void SwitchFrame(int frame, Timeline *t);
+void SetCurrentFrame(Frame *f, int index, Timeline *t);
+void GoToFrame(Frame *f, int index, Timeline *t);
+void InvalidateFrame(Frame *f);
+void RenderFrameTo(Frame *f, RenderTexture target);
 void CopyFrame(Frame *src, Frame *dst);
+void CleanFrame(Frame *f);
+Frame *UnlinkFrame(Frame *f, int index, Timeline *t);
+void LinkFrame(Frame *f, Frame *prev, int index, Timeline *t);
+void DeleteFrame(Frame *f);
+Frame *UnlinkFrames(Frame *first, Frame *last, int index, int count, Timeline *t);
+void LinkFrames(Frame *first, Frame *last, Frame *prev, int index, int count, Timeline *t);
+void MoveFrames(Frame *first, Frame *last, int index, int count, int to, Timeline *t);
+void MoveFramesAfter(Frame *first, Frame *last, Frame *prev, int index, int count, int to, Timeline *t);
+void ReverseFrames(Frame *first, Frame *last, int index, int count, Timeline *t);
+Frame *DuplicateFrames(Frame *first, int index, int count, Timeline *t);
+void DeleteFrames(Frame *first, int count);
+void GenerateAllOnionSkins(Frame *f);
 
 extern PuppetLinkedList puppetsCache;
 extern Timeline timeline;
+extern VirtualCamera camera;
 extern Puppet *theatreTargetPuppet;
 extern Bone *theatreTargetBone;
 
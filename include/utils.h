@@ -24,9 +24,12 @@ void ChangeCursor(MouseCursor c);
 unsigned long djb2Hash(const unsigned char *data, size_t len);
 int MuNumberORNa(mu_Context *ctx, char *label, float *value, bool condition, bool space);
 void GetRectCorners(Rectangle rect, Vector2 center, float zoom, float rotation, Vector2 *c0, Vector2 *c1, Vector2 *c2, Vector2 *c3);
+void GetCamera2DQuad(Camera2D camera, float width, float height, Vector2 *quad);
+bool IsRectOnQuad(Rectangle r, Vector2 *quad);
 float AngleBetweenVectors(Vector2 a, Vector2 b);
 Vector2 Vector2Single(float v);
 RenderTexture2D LoadCustomRenderTexture(int width, int height);
+bool ReadRenderTexturePixels(RenderTexture2D target, unsigned char *pixels);
 int RemoveDir(char *path);
 Color InvertColor(Color color);
 
@@ -14,6 +14,8 @@ typedef struct Viewport{
     Vector2 pos;
     mu_Context ctx;
     RenderTexture renderTexture;
+    RenderTexture sceneTexture; // the Render pass while renderScale < 1
+    float renderScale;
     Camera2D camera;
     float minZoom;
     float maxZoom;
@@ -80,6 +82,7 @@ void InitViewport(
 void CleanUpViewportsPool();
 void RenderViewportToScreen(Viewport *v);
 void RenderViewport(Viewport *v);
+void SetViewportRenderScale(Viewport *v, float scale);
 void UpdateViewportUIInput(Viewport *v);
 void CleanViewportUIInput(Viewport *v);
 void ProcessViewportUI(Viewport *v);
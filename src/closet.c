@@ -8,6 +8,7 @@
 #include "modules.h"
 #include "puppets.h"
 #include "theater.h"
+#include "journal.h"
 
 typedef enum State {
     IDLE,
@@ -23,6 +24,7 @@ typedef enum ClosetSelectorOption {
 
 static State state;
 static Vector2 mousePosition;
+static Skin grabSkin;
 ClosetSelectorOptions closetSelectorOpts;
 Puppet **closetSelectedPuppet;
 Bone **closetSelectedBone;
@@ -36,6 +38,9 @@ extern void AddRegion(char *name, Rectangle rect, Vector2 A, Vector2 B);
 /* <== States =========================================> */
 
 static void IdleState(Viewport *v){    
+    // the skin as it was before the next edit, for the workshop history
+    grabSkin = (*closetSelectedBone)->skin;
+
     // SET POINT A
     if (IsPointOnCircle(mousePosition,(*closetSelectedBone)->skin.pointA,(HINGE_RADIUS+2)/v->camera.zoom)){
         ChangeCursor(MOUSE_CURSOR_POINTING_HAND);
@@ -72,6 +77,7 @@ static void SettingRectState(Viewport *v){
         if (closetSelectorOpts == THEATER_OPT){
             NewPuppetSnapshot(*closetSelectedPuppet, timeline.currentFrame);
         }
+        else JournalRecordSkin(b, grabSkin);
         state = IDLE;
     }
 }
@@ -83,6 +89,7 @@ static void SettingPointAState(Viewport *v){
     if (IsMouseButtonReleasedFocusSafe(MOUSE_LEFT_BUTTON)){
         if (closetSelectorOpts == THEATER_OPT)
             NewPuppetSnapshot(*closetSelectedPuppet, timeline.currentFrame);
+        else JournalRecordSkin(*closetSelectedBone, grabSkin);
         state = IDLE;
     }
 }
@@ -95,6 +102,7 @@ static void SettingPointBState(Viewport *v){
         SetSkinAngle(&(*closetSelectedBone)->skin);
         if (closetSelectorOpts == THEATER_OPT)
             NewPuppetSnapshot(*closetSelectedPuppet, timeline.currentFrame);
+        else JournalRecordSkin(*closetSelectedBone, grabSkin);
         state = IDLE;
     }
 }
@@ -112,6 +120,7 @@ void ClosetUpdate(Viewport *v){
     ViewportUpdateZoom(v);
     ViewportUpdatePan(v);
     mousePosition = GetMouseViewportPosition(v);
+    if (state == IDLE) JournalShortcuts();
     if ((*closetSelectedPuppet) == NULL || (*closetSelectedPuppet)->atlas == NULL || (*closetSelectedBone) == NULL) return;
     
     switch (state) {
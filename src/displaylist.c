@@ -0,0 +1,139 @@
+#include <raylib.h>
+#include <raymath.h>
+#include <stdlib.h>
+#include <string.h>
+#include "puppets.h"
+#include "theater.h"
+#include "pose.h"
+#include "utils.h"
+#include "displaylist.h"
+
+static Pose scratch;
+static DisplayList cache[DISPLAYLIST_CACHE_SIZE];
+static unsigned int lastUse = 0;
+
+static void ReserveQuads(DisplayList *dl, int quadsQ, int groupsQ){
+    if (quadsQ > dl->quadsCap){
+        dl->quadsCap = quadsQ*2;
+        dl->quads = realloc(dl->quads, sizeof(SkinQuad) * dl->quadsCap);
+    }
+
+    if (groupsQ > dl->groupsCap){
+        dl->groupsCap = groupsQ*2;
+        dl->groups = realloc(dl->groups, sizeof(DisplayGroup) * dl->groupsCap);
+    }
+}
+
+// evaluates f and stores its skins back to front, out keeps its buffer between recordings
+void RecordDisplayList(Frame *f, DisplayList *out){
+    out->version = f->version;
+    out->quadsQ = 0;
+    out->groupsQ = 0;
+
+    EvaluateFramePose(f, -1, &scratch);
+    ReserveQuads(out, scratch.bonesQ, scratch.puppetsQ);
+    for (int i=0; i<scratch.puppetsQ; i++){
+        PosePuppet *pp = &scratch.puppets[i];
+        Puppet *p = pp->puppet;
+        if (p->atlas == NULL) continue;
+
+        PoseBone *order[p->descendantsQ+1];
+        int n = GetPoseDrawOrder(&scratch, i, order);
+        out->groups[out->groupsQ++] = (DisplayGroup){
+            .atlas = p->atlas->texture,
+            .bounds = GetPosePuppetBounds(&scratch, i),
+            .firstQuad = out->quadsQ,
+            .quadsQ = n
+        };
+        for (int o=0; o<n; o++){
+            PoseBone *pb = order[o];
+            out->quads[out->quadsQ++] = GetSkinQuad(&pb->skin, pb->start, pb->direction, pb->length*pp->scale);
+        }
+    }
+}
+
+// the list of f for its current version, recorded only when f changed or its list was
+// recorded over. It stays valid until DISPLAYLIST_CACHE_SIZE other frames are asked for
+DisplayList *GetFrameDisplayList(Frame *f){
+    DisplayList *dl = f->displayList;
+    if (dl == NULL){
+        dl = &cache[0];
+        for (int i=1; i<DISPLAYLIST_CACHE_SIZE; i++)
+            if (cache[i].used < dl->used) dl = &cache[i];
+        if (dl->frame != NULL) dl->frame->displayList = NULL;
+        dl->frame = f;
+        f->displayList = dl;
+        RecordDisplayList(f, dl);
+    }
+    else if (dl->version != f->version)
+        RecordDisplayList(f, dl);
+    dl->used = ++lastUse;
+    return dl;
+}
+
+// frees the slot of f (e.g. before f is deleted), its buffers are kept for the next frame
+void ReleaseFrameDisplayList(Frame *f){
+    if (f->displayList == NULL) return;
+    f->displayList->frame = NULL;
+    f->displayList->used = 0;
+    f->displayList = NULL;
+}
+
+static uint64_t HashBytes(uint64_t h, const void *data, size_t size){
+    const unsigned char *bytes = data;
+    for (size_t i=0; i<size; i++){
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// FNV-1a of what f looks like: its quads in drawing order and their atlases,
+// camera and background. Frames with the same hash render the same image
+uint64_t HashFrameState(Frame *f){
+    DisplayList *dl = GetFrameDisplayList(f);
+    uint64_t h = 14695981039346656037ULL;
+    h = HashBytes(h, &dl->groupsQ, sizeof(dl->groupsQ));
+    for (int g=0; g<dl->groupsQ; g++){
+        h = HashBytes(h, &dl->groups[g].atlas.id, sizeof(dl->groups[g].atlas.id));
+        h = HashBytes(h, &dl->groups[g].quadsQ, sizeof(dl->groups[g].quadsQ));
+    }
+    h = HashBytes(h, dl->quads, sizeof(SkinQuad) * dl->quadsQ);
+    h = HashBytes(h, &f->cameraPos, sizeof(f->cameraPos));
+    h = HashBytes(h, f->bgColor, sizeof(f->bgColor));
+    return h;
+}
+
+// compares what HashFrameState hashes, for frames whose hashes matched
+bool SameFrameState(Frame *a, Frame *b){
+    if (memcmp(&a->cameraPos, &b->cameraPos, sizeof(a->cameraPos)) != 0) return false;
+    if (memcmp(a->bgColor, b->bgColor, sizeof(a->bgColor)) != 0) return false;
+
+    DisplayList *la = GetFrameDisplayList(a);
+    DisplayList *lb = GetFrameDisplayList(b);
+    if (la->groupsQ != lb->groupsQ || la->quadsQ != lb->quadsQ) return false;
+    for (int g=0; g<la->groupsQ; g++)
+        if (la->groups[g].atlas.id != lb->groups[g].atlas.id || la->groups[g].quadsQ != lb->groups[g].quadsQ)
+            return false;
+    return memcmp(la->quads, lb->quads, sizeof(SkinQuad) * la->quadsQ) == 0;
+}
+
+// issues the quads on whatever target and camera are active. Puppets out of
+// view (the world space quad the camera shows, see GetCamera2DQuad) are skipped
+void DrawDisplayList(DisplayList *dl, Vector2 offset, Vector2 *view){
+    for (int g=0; g<dl->groupsQ; g++){
+        DisplayGroup *group = &dl->groups[g];
+        Rectangle bounds = group->bounds;
+        bounds.x += offset.x;
+        bounds.y += offset.y;
+        if (view != NULL && !IsRectOnQuad(bounds, view)) continue;
+
+        for (int i=group->firstQuad; i<group->firstQuad+group->quadsQ; i++){
+            SkinQuad *q = &dl->quads[i];
+            Rectangle dst = q->dst;
+            dst.x += offset.x;
+            dst.y += offset.y;
+            DrawTexturePro(group->atlas, q->src, dst, q->origin, q->rotation, WHITE);
+        }
+    }
+}
@@ -0,0 +1,648 @@
+#include <raylib.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "puppets.h"
+#include "theater.h"
+#include "journal.h"
+#include "playback.h"
+#include "pose.h"
+#include "utils.h"
+
+// Undo/redo history. Entries live in a ring, [0,cursor) are done and
+// [cursor,count) were undone and can be redone. The oldest entries are
+// evicted when the ring is full or the byte budget is exceeded.
+static JournalEntry *ring[JOURNAL_MAX_ENTRIES];
+static int first = 0;
+static int count = 0;
+static int cursor = 0;
+static size_t usage = 0;
+static size_t budget = JOURNAL_DEFAULT_BUDGET;
+static int openBatch = 0;
+static int batchesCount = 0;
+static bool batchDropped = false; // the open batch outgrew the ring, the rest of it isn't recorded
+
+/* <== Utilities ======================================> */
+
+static JournalEntry *EntryAt(int i){
+    return ring[(first+i) % JOURNAL_MAX_ENTRIES];
+}
+
+static int FrameIndex(Frame *f){
+    if (f == timeline.currentFrame) return timeline.currentFrameIndex;
+    int i=0;
+    for (Frame *fi = timeline.head; fi != NULL; fi = fi->next, i++)
+        if (fi == f) return i;
+    return -1;
+}
+
+static size_t FrameBytes(Frame *f){
+    if (f == NULL) return 0;
+    size_t bytes = sizeof(Frame);
+    for (PuppetSnapshot *s = f->head; s != NULL; s = s->next)
+        bytes += sizeof(PuppetSnapshot) + s->bonesSnapshots.snapshotsQ * sizeof(BoneSnapshot) + PackedBonesSize(s->packed);
+    return bytes;
+}
+
+static size_t FramesBytes(Frame *first, int count){
+    size_t bytes = 0;
+    Frame *f = first;
+    for (int i=0; i<count && f != NULL; i++, f = f->next) bytes += FrameBytes(f);
+    return bytes;
+}
+
+static size_t EntryBytes(JournalEntry *e){
+    size_t bytes = sizeof(JournalEntry) + e->deltasQ * sizeof(BoneDelta);
+    switch (e->type){
+        case JOURNAL_FRAME_INSERT:
+        case JOURNAL_FRAME_REMOVE:  bytes += FramesBytes(e->frame, e->framesQ); break;
+        case JOURNAL_FRAME_CONTENT: bytes += FrameBytes(e->stash); break;
+        default: break;
+    }
+    return bytes;
+}
+
+// done tells if the entry is currently applied to the project
+static void DisposeEntry(JournalEntry *e, bool done){
+    usage -= e->size;
+
+    // frames out of the timeline belong to the journal
+    if (e->type == JOURNAL_FRAME_REMOVE && done) DeleteFrames(e->frame, e->framesQ);
+    if (e->type == JOURNAL_FRAME_INSERT && !done) DeleteFrames(e->frame, e->framesQ);
+    if (e->stash != NULL) DeleteFrame(e->stash);
+
+    free(e->deltas);
+    free(e);
+}
+
+// a batch goes away as a whole, half of it couldn't be undone
+static void EvictOldest(){
+    if (count <= 0) return;
+    int batch = EntryAt(0)->batch;
+    do {
+        DisposeEntry(EntryAt(0), cursor > 0);
+        first = (first+1) % JOURNAL_MAX_ENTRIES;
+        count--;
+        if (cursor > 0) cursor--;
+    } while (batch != 0 && count > 0 && EntryAt(0)->batch == batch);
+}
+
+// redo needs every entry before it, so the undone ones go newest first
+static void DropUndone(){
+    while (count > cursor){
+        count--;
+        DisposeEntry(EntryAt(count), false);
+    }
+}
+
+static void EnforceBudget(){
+    // the newest entry (or batch) is always kept, even if it's bigger than the budget
+    if (openBatch != 0) return;
+    if (usage > budget || count > JOURNAL_MAX_ENTRIES) DropUndone();
+    while (count > 1 && (usage > budget || count > JOURNAL_MAX_ENTRIES)){
+        int batch = EntryAt(0)->batch;
+        if (batch != 0 && batch == EntryAt(count-1)->batch) break;
+        EvictOldest();
+    }
+}
+
+static void PushEntry(JournalEntry *e){
+    // a new edit invalidates everything that was undone
+    DropUndone();
+
+    // the open batch fills the whole ring, evicting its head would leave half of it to undo
+    if (openBatch != 0 && count == JOURNAL_MAX_ENTRIES && EntryAt(0)->batch == openBatch){
+        JournalClear();
+        batchDropped = true;
+        PushLog("The edit is too big to be undone, the history was cleared");
+    }
+    if (batchDropped){
+        DisposeEntry(e, true);
+        return;
+    }
+
+    if (count == JOURNAL_MAX_ENTRIES) EvictOldest();
+
+    e->size = EntryBytes(e);
+    e->time = GetTime();
+    e->batch = openBatch;
+    usage += e->size;
+    ring[(first+count) % JOURNAL_MAX_ENTRIES] = e;
+    count++;
+    cursor = count;
+    EnforceBudget();
+}
+
+// returns the last done entry if it can still absorb new changes
+static JournalEntry *CoalescingTarget(JournalEntryType type){
+    if (count == 0 || cursor != count) return NULL;
+    JournalEntry *e = EntryAt(count-1);
+    if (e->type != type) return NULL;
+    if (openBatch != 0 || e->batch != 0) return NULL;
+    if (GetTime() - e->time > JOURNAL_COALESCE_TIME) return NULL;
+    return e;
+}
+
+static void ResizeEntry(JournalEntry *e){
+    usage -= e->size;
+    e->size = EntryBytes(e);
+    e->time = GetTime();
+    usage += e->size;
+    EnforceBudget();
+}
+
+static bool BoneSnapshotEquals(BoneSnapshot *a, BoneSnapshot *b){
+    return a->direction.x == b->direction.x &&
+           a->direction.y == b->direction.y &&
+           a->length == b->length &&
+           a->skin == b->skin;
+}
+
+static void UnlinkPuppetSnapshot(PuppetSnapshot *s, Frame *f){
+    if (s == f->head) f->head = s->next;
+    if (s == f->tail) f->tail = s->prev;
+    if (s->prev != NULL) s->prev->next = s->next;
+    if (s->next != NULL) s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+    f->snapshotsQ--;
+}
+
+// links s before next, or at the tail if next is NULL
+static void LinkPuppetSnapshot(PuppetSnapshot *s, PuppetSnapshot *next, Frame *f){
+    s->next = next;
+    s->prev = next != NULL ? next->prev : f->tail;
+    if (s->prev != NULL) s->prev->next = s;
+    else f->head = s;
+    if (s->next != NULL) s->next->prev = s;
+    else f->tail = s;
+    f->snapshotsQ++;
+}
+
+static void AppendBoneSnapshot(PuppetSnapshot *p, BoneSnapshot *s){
+    if (p->bonesSnapshots.tail != NULL){
+        p->bonesSnapshots.tail->next = s;
+        s->prev = p->bonesSnapshots.tail;
+        p->bonesSnapshots.tail = s;
+    }
+
+    if (p->bonesSnapshots.head == NULL){
+        p->bonesSnapshots.head = p->bonesSnapshots.tail = s;
+    }
+
+    p->bonesSnapshots.snapshotsQ++;
+}
+
+static void SwapFrameContent(Frame *a, Frame *b){
+    Frame tmp = *a;
+    a->head = b->head;
+    a->tail = b->tail;
+    a->snapshotsQ = b->snapshotsQ;
+    a->cameraPos = b->cameraPos;
+    memcpy(a->bgColor, b->bgColor, sizeof(a->bgColor));
+    b->head = tmp.head;
+    b->tail = tmp.tail;
+    b->snapshotsQ = tmp.snapshotsQ;
+    b->cameraPos = tmp.cameraPos;
+    memcpy(b->bgColor, tmp.bgColor, sizeof(b->bgColor));
+}
+
+/* <== Replay =========================================> */
+
+// batched entries leave the frame switch and the onion skins to the end of the batch
+static void ApplySnapshotEntry(JournalEntry *e, bool undo, bool batched){
+    bool present = undo ? e->hadOld : e->hasNew;
+    bool wasPresent = undo ? e->hasNew : e->hadOld;
+    PuppetSnapshot *s = PuppetIsOnFrame(e->puppet, e->frame);
+
+    if (!present){
+        DeletePuppetSnapshot(s, e->frame);
+        if (!batched) GoToFrame(e->frame, e->frameIndex, &timeline);
+        return;
+    }
+
+    if (s == NULL || !wasPresent){
+        // every bone is on the deltas when the snapshot didn't exist
+        DeletePuppetSnapshot(s, e->frame);
+        s = calloc(1, sizeof(PuppetSnapshot));
+        s->puppet = e->puppet;
+        IndexSnapshot(s, e->frame);
+        for (int i=0; i<e->deltasQ; i++){
+            BoneSnapshot *bs = calloc(1, sizeof(BoneSnapshot));
+            bs->bone = e->deltas[i].bone;
+            AppendBoneSnapshot(s, bs);
+        }
+    }
+    else {
+        UnpackSnapshot(s);
+        if (!e->inPlace) UnlinkPuppetSnapshot(s, e->frame);
+    }
+
+    s->position = undo ? e->oldPosition : e->newPosition;
+    s->scale = undo ? e->oldScale : e->newScale;
+
+    // deltas and bone snapshots share the descendants order, so this is a single pass
+    BoneSnapshot *bs = s->bonesSnapshots.head;
+    for (int i=0; i<e->deltasQ; i++){
+        BoneDelta *d = &e->deltas[i];
+        BoneSnapshot *start = bs;
+        while (bs != NULL && bs->bone != d->bone) bs = bs->next;
+        if (bs == NULL){
+            for (bs = s->bonesSnapshots.head; bs != start && bs->bone != d->bone; bs = bs->next);
+            if (bs == start){
+                bs = start;
+                continue;
+            }
+        }
+
+        bs->direction = undo ? d->oldDirection : d->newDirection;
+        bs->length = undo ? d->oldLength : d->newLength;
+        bs->skin = undo ? d->oldSkinIndex : d->newSkinIndex;
+    }
+    PackSnapshot(s);
+
+    // restore the draw order the puppet had before the edit
+    if (!e->inPlace || !wasPresent){
+        PuppetSnapshot *next = NULL;
+        if (undo && e->oldNext != NULL) next = PuppetIsOnFrame(e->oldNext, e->frame);
+        LinkPuppetSnapshot(s, next, e->frame);
+    }
+
+    if (batched){
+        s->onionSkinStale = true;
+        return;
+    }
+    GoToFrame(e->frame, e->frameIndex, &timeline);
+    GenerateOnionSkin(s);
+}
+
+static void ApplyEntry(JournalEntry *e, bool undo){
+    switch (e->type){
+        case JOURNAL_SNAPSHOT:
+            InvalidateFrame(e->frame);
+            ApplySnapshotEntry(e, undo, e->batch != 0);
+            break;
+
+        case JOURNAL_FRAME_INSERT:
+        case JOURNAL_FRAME_REMOVE:
+            if (undo == (e->type == JOURNAL_FRAME_REMOVE)){
+                LinkFrames(e->frame, e->lastFrame, e->prevFrame, e->frameIndex, e->framesQ, &timeline);
+                GoToFrame(e->frame, e->frameIndex, &timeline);
+            }
+            else UnlinkFrames(e->frame, e->lastFrame, e->frameIndex, e->framesQ, &timeline);
+            break;
+
+        case JOURNAL_FRAME_MOVE:
+            if (undo) MoveFramesAfter(e->frame, e->lastFrame, e->prevFrame, e->toIndex, e->framesQ, e->frameIndex, &timeline);
+            else MoveFramesAfter(e->frame, e->lastFrame, e->toPrevFrame, e->frameIndex, e->framesQ, e->toIndex, &timeline);
+            break;
+
+        case JOURNAL_FRAME_REVERSE:
+            if (undo) ReverseFrames(e->lastFrame, e->frame, e->frameIndex, e->framesQ, &timeline);
+            else ReverseFrames(e->frame, e->lastFrame, e->frameIndex, e->framesQ, &timeline);
+            break;
+
+        case JOURNAL_FRAME_CONTENT:
+            IndexFrame(e->frame, false);
+            SwapFrameContent(e->frame, e->stash);
+            IndexFrame(e->frame, true);
+            InvalidateFrame(e->frame);
+            GoToFrame(e->frame, e->frameIndex, &timeline);
+            break;
+
+        case JOURNAL_SKIN:
+            for (int i=0; i<e->deltasQ; i++)
+                e->deltas[i].bone->skin = undo ? e->deltas[i].oldSkin : e->deltas[i].newSkin;
+            break;
+    }
+}
+
+/* <== Recording ======================================> */
+
+// index is the position of f, or -1 if unknown
+static void RecordSnapshot(Frame *f, int index, PuppetSnapshot *old, PuppetSnapshot *new, bool inPlace){
+    if (f == NULL) return;
+    if (old == NULL && new == NULL) return;
+
+    // deltas are taken from the bone snapshots lists
+    if (old != NULL) UnpackSnapshot(old);
+    if (new != NULL) UnpackSnapshot(new);
+
+    Puppet *p = old != NULL ? old->puppet : new->puppet;
+    int bonesQ = p->descendantsQ;
+    BoneSnapshot **olds = calloc(bonesQ+1, sizeof(BoneSnapshot*));
+    BoneDelta *deltas = calloc(bonesQ+1, sizeof(BoneDelta));
+    int deltasQ = 0;
+
+    if (old != NULL){
+        for (BoneSnapshot *bs = old->bonesSnapshots.head; bs != NULL; bs = bs->next){
+            int i = bs->bone->index-1;
+            if (i >= 0 && i < bonesQ) olds[i] = bs;
+        }
+    }
+
+    // only changed bones, unless the snapshot is being created or removed
+    PuppetSnapshot *source = new != NULL ? new : old;
+    for (BoneSnapshot *bs = source->bonesSnapshots.head; bs != NULL && deltasQ < bonesQ; bs = bs->next){
+        int i = bs->bone->index-1;
+        BoneSnapshot *o = (new != NULL && i >= 0 && i < bonesQ) ? olds[i] : NULL;
+        if (new != NULL && old != NULL && o != NULL && BoneSnapshotEquals(o, bs)) continue;
+        if (o == NULL) o = bs;
+
+        deltas[deltasQ++] = (BoneDelta){
+            .bone = bs->bone,
+            .oldDirection = o->direction, .newDirection = bs->direction,
+            .oldLength = o->length,       .newLength = bs->length,
+            .oldSkinIndex = o->skin,      .newSkinIndex = bs->skin
+        };
+    }
+    free(olds);
+
+    if (old != NULL && new != NULL && deltasQ == 0 && (inPlace || old->next == NULL) &&
+        old->position.x == new->position.x && old->position.y == new->position.y &&
+        old->scale == new->scale){
+        free(deltas);
+        return;
+    }
+
+    // continuous edits (drags, number fields) end up in a single entry
+    JournalEntry *top = CoalescingTarget(JOURNAL_SNAPSHOT);
+    if (top != NULL && top->frame == f && top->puppet == p && top->hasNew && old != NULL && top->inPlace == inPlace){
+        for (int i=0; i<deltasQ; i++){
+            int o = 0;
+            while (o < top->deltasQ && top->deltas[o].bone != deltas[i].bone) o++;
+            if (o == top->deltasQ){
+                top->deltas = realloc(top->deltas, sizeof(BoneDelta) * (top->deltasQ+1));
+                top->deltas[top->deltasQ++] = deltas[i];
+                continue;
+            }
+
+            top->deltas[o].newDirection = deltas[i].newDirection;
+            top->deltas[o].newLength = deltas[i].newLength;
+            top->deltas[o].newSkinIndex = deltas[i].newSkinIndex;
+        }
+
+        top->hasNew = new != NULL;
+        top->newPosition = new != NULL ? new->position : old->position;
+        top->newScale = new != NULL ? new->scale : old->scale;
+        free(deltas);
+        ResizeEntry(top);
+        return;
+    }
+
+    JournalEntry *e = calloc(1, sizeof(JournalEntry));
+    e->type = JOURNAL_SNAPSHOT;
+    e->frame = f;
+    e->frameIndex = index >= 0 ? index : FrameIndex(f);
+    e->puppet = p;
+    e->inPlace = inPlace;
+    e->hadOld = old != NULL;
+    e->hasNew = new != NULL;
+    e->oldNext = (!inPlace && old != NULL && old->next != NULL) ? old->next->puppet : NULL;
+    e->oldPosition = old != NULL ? old->position : new->position;
+    e->oldScale = old != NULL ? old->scale : new->scale;
+    e->newPosition = new != NULL ? new->position : old->position;
+    e->newScale = new != NULL ? new->scale : old->scale;
+    e->deltasQ = deltasQ;
+    e->deltas = realloc(deltas, sizeof(BoneDelta) * (deltasQ > 0 ? deltasQ : 1));
+    PushEntry(e);
+}
+
+void JournalRecordSnapshot(Frame *f, PuppetSnapshot *old, PuppetSnapshot *new){
+    RecordSnapshot(f, -1, old, new, false);
+}
+
+// s was edited where it is, before is a detached copy of it as it was
+void JournalRecordSnapshotEdit(Frame *f, int index, PuppetSnapshot *before, PuppetSnapshot *s){
+    RecordSnapshot(f, index, before, s, true);
+}
+
+// every entry until JournalEndBatch is undone and redone as a single step
+void JournalBeginBatch(){
+    openBatch = ++batchesCount;
+    batchDropped = false;
+}
+
+void JournalEndBatch(){
+    openBatch = 0;
+    batchDropped = false;
+    EnforceBudget();
+}
+
+void JournalRecordFrameInsert(Frame *f, int index){
+    JournalRecordFramesInsert(f, f, 1, index);
+}
+
+void JournalRecordFrameRemove(Frame *f, Frame *prev, int index){
+    JournalRecordFramesRemove(f, f, prev, 1, index);
+}
+
+// first..last are already in the timeline
+void JournalRecordFramesInsert(Frame *first, Frame *last, int count, int index){
+    if (first == NULL || last == NULL) return;
+    JournalEntry *e = calloc(1, sizeof(JournalEntry));
+    e->type = JOURNAL_FRAME_INSERT;
+    e->frame = first;
+    e->lastFrame = last;
+    e->framesQ = count;
+    e->prevFrame = first->prev;
+    e->frameIndex = index;
+    PushEntry(e);
+}
+
+// first..last were unlinked from after prev, the journal keeps them alive
+void JournalRecordFramesRemove(Frame *first, Frame *last, Frame *prev, int count, int index){
+    if (first == NULL || last == NULL) return;
+    JournalEntry *e = calloc(1, sizeof(JournalEntry));
+    e->type = JOURNAL_FRAME_REMOVE;
+    e->frame = first;
+    e->lastFrame = last;
+    e->framesQ = count;
+    e->prevFrame = prev;
+    e->frameIndex = index;
+    PushEntry(e);
+}
+
+// first..last were moved from after prev, replaying links them back without walking the timeline
+void JournalRecordFramesMove(Frame *first, Frame *last, Frame *prev, int count, int from, int to){
+    if (first == NULL || last == NULL || from == to) return;
+    JournalEntry *e = calloc(1, sizeof(JournalEntry));
+    e->type = JOURNAL_FRAME_MOVE;
+    e->frame = first;
+    e->lastFrame = last;
+    e->framesQ = count;
+    e->frameIndex = from;
+    e->toIndex = to;
+    e->prevFrame = prev;
+    e->toPrevFrame = first->prev;
+    PushEntry(e);
+}
+
+// first..last as they were before reversing
+void JournalRecordFramesReverse(Frame *first, Frame *last, int count, int index){
+    if (first == NULL || last == NULL || first == last) return;
+    JournalEntry *e = calloc(1, sizeof(JournalEntry));
+    e->type = JOURNAL_FRAME_REVERSE;
+    e->frame = first;
+    e->lastFrame = last;
+    e->framesQ = count;
+    e->frameIndex = index;
+    PushEntry(e);
+}
+
+// moves the current content of dst into the journal, dst is left empty
+void JournalRecordFramePaste(Frame *dst, int index){
+    if (dst == NULL) return;
+    JournalEntry *e = calloc(1, sizeof(JournalEntry));
+    e->type = JOURNAL_FRAME_CONTENT;
+    e->frame = dst;
+    e->frameIndex = index;
+    e->stash = calloc(1, sizeof(Frame));
+    IndexFrame(dst, false);
+    SwapFrameContent(dst, e->stash);
+    dst->cameraPos = e->stash->cameraPos;
+    memcpy(dst->bgColor, e->stash->bgColor, sizeof(dst->bgColor));
+    PushEntry(e);
+}
+
+void JournalRecordSkin(Bone *b, Skin old){
+    if (b == NULL || b->root == NULL) return;
+    if (SkinEquals(&old, &b->skin)) return;
+
+    JournalEntry *top = CoalescingTarget(JOURNAL_SKIN);
+    if (top != NULL && top->deltas[0].bone == b){
+        top->deltas[0].newSkin = b->skin;
+        ResizeEntry(top);
+        return;
+    }
+
+    JournalEntry *e = calloc(1, sizeof(JournalEntry));
+    e->type = JOURNAL_SKIN;
+    e->puppet = b->root;
+    e->deltasQ = 1;
+    e->deltas = calloc(1, sizeof(BoneDelta));
+    e->deltas[0] = (BoneDelta){
+        .bone = b,
+        .oldDirection = b->direction, .newDirection = b->direction,
+        .oldLength = b->len,          .newLength = b->len,
+        .oldSkin = old,               .newSkin = b->skin
+    };
+    PushEntry(e);
+}
+
+/* <== Public =========================================> */
+
+bool JournalUndo(){
+    if (cursor <= 0){
+        PushLog("Nothing to undo!");
+        return false;
+    }
+
+    cursor--;
+    int batch = EntryAt(cursor)->batch;
+    ApplyEntry(EntryAt(cursor), true);
+    while (batch != 0 && cursor > 0 && EntryAt(cursor-1)->batch == batch){
+        cursor--;
+        ApplyEntry(EntryAt(cursor), true);
+    }
+    if (batch != 0) GoToFrame(timeline.currentFrame, timeline.currentFrameIndex, &timeline);
+    return true;
+}
+
+bool JournalRedo(){
+    if (cursor >= count){
+        PushLog("Nothing to redo!");
+        return false;
+    }
+
+    int batch = EntryAt(cursor)->batch;
+    ApplyEntry(EntryAt(cursor), false);
+    cursor++;
+    while (batch != 0 && cursor < count && EntryAt(cursor)->batch == batch){
+        ApplyEntry(EntryAt(cursor), false);
+        cursor++;
+    }
+    if (batch != 0) GoToFrame(timeline.currentFrame, timeline.currentFrameIndex, &timeline);
+    return true;
+}
+
+void JournalShortcuts(){
+    if (!IsKeyDown(UNDO_MODKEY)) return;
+    if (IsKeyPressed(UNDO_KEY)){
+        if (IsKeyDown(MODKEY)) JournalRedo();
+        else JournalUndo();
+    }
+    if (IsKeyPressed(REDO_KEY)) JournalRedo();
+}
+
+void JournalClear(){
+    while (count > 0){
+        count--;
+        DisposeEntry(EntryAt(count), count < cursor);
+    }
+    first = cursor = 0;
+    usage = 0;
+}
+
+// the snapshots of p in frames the journal keeps out of the timeline, the
+// occurrences of p don't reach them
+static void DropPuppetFromFrames(Puppet *p, Frame *f, int framesQ){
+    for (int i=0; i<framesQ && f != NULL; i++, f = f->next)
+        DeletePuppetSnapshot(PuppetIsOnFrame(p, f), f);
+}
+
+// removed also drops the timeline edits of p, the rest of the history is kept
+static void DropPuppetEntries(Puppet *p, bool removed){
+    int kept = 0, newCursor = cursor;
+    for (int i=0; i<count; i++){
+        JournalEntry *e = EntryAt(i);
+        bool done = i < cursor;
+        if (e->puppet == p && (e->type == JOURNAL_SKIN || (removed && e->type == JOURNAL_SNAPSHOT))){
+            DisposeEntry(e, done);
+            if (done) newCursor--;
+            continue;
+        }
+
+        if (removed){
+            if (e->oldNext == p) e->oldNext = NULL;
+            if (e->type == JOURNAL_FRAME_CONTENT) DropPuppetFromFrames(p, e->stash, 1);
+            if ((e->type == JOURNAL_FRAME_REMOVE && done) || (e->type == JOURNAL_FRAME_INSERT && !done))
+                DropPuppetFromFrames(p, e->frame, e->framesQ);
+            usage -= e->size;
+            e->size = EntryBytes(e);
+            usage += e->size;
+        }
+        ring[(first+kept) % JOURNAL_MAX_ENTRIES] = e;
+        kept++;
+    }
+    count = kept;
+    cursor = newCursor;
+}
+
+// forgets the workshop skin edits of p (e.g. before p or some of its bones are deleted)
+void JournalDropPuppet(Puppet *p){
+    DropPuppetEntries(p, false);
+}
+
+// forgets every edit of p before it's deleted from the project, p leaves the frames
+// the journal holds too. The edits of the other puppets can still be undone
+void JournalRemovePuppet(Puppet *p){
+    DropPuppetEntries(p, true);
+}
+
+void JournalSetBudget(size_t bytes){
+    budget = bytes;
+    EnforceBudget();
+}
+
+size_t JournalGetBudget(){
+    return budget;
+}
+
+size_t JournalGetUsage(){
+    return usage;
+}
+
+int JournalGetDepth(){
+    return cursor;
+}
@@ -1,3 +1,8 @@
+// 64 bits off_t for fseeko on 32 bits systems, OpenDML files go past 4GB
+#if !defined(_WIN32) && !defined(_FILE_OFFSET_BITS)
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include "mjpegw.h"
 
 #include <stdio.h>
@@ -6,6 +11,41 @@
 #include <stdlib.h>
 #include <math.h>
 
+// emscripten builds have no pthreads, frames are always encoded on the calling thread
+#if defined(__EMSCRIPTEN__) && !defined(MJPEGW_NO_THREADS)
+#define MJPEGW_NO_THREADS
+#endif
+
+#ifndef MJPEGW_NO_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define MJPEGW_MAX_THREADS      64
+#define MJPEGW_JOBS_PER_THREAD  2   // frames in flight per worker, one encoding and one waiting
+#define MJPEGW_INDEX_CAPACITY   256     // frame entries, until mjpegw_reserve_frames or the index fills up
+#define MJPEGW_SUPER_INDEX_SIZE 1024    // RIFFs in a file, 1TB with the default limit
+#define MJPEGW_COPY_BLOCK       16384   // held frames copied from an earlier RIFF go through the stack
+#define MJPEGW_HEADERS_BOUND    2048    // markers, quantization and huffman tables of a frame
+#define MJPEGW_BLOCK_BOUND      432     // 64 symbols of 27 bits at most, doubled by 0xff stuffing
+#define MJPEGW_BLOCK_ESTIMATE   64      // block size the frame buffers take, noise at quality 100 is under 90
+#define MJPEGW_ARENA_ALIGN      16
+#define MJPEGW_RC_WINDOW        24  // frames the error on the average bitrate is spread over
+#define MJPEGW_RC_GAIN          16  // quality steps for a frame twice too big
+#define MJPEGW_RC_MAX_STEP      25
+
+// a RIFF grows up to this size, the following frames go to a new RIFF-AVIX (OpenDML). Old players
+// only read the first RIFF, 1GB keeps it in the limits of every AVI 1.0 reader
+#ifndef MJPEGW_RIFF_LIMIT
+#define MJPEGW_RIFF_LIMIT       0x40000000u
+#endif
+
+#if defined(_WIN32)
+#define mjpegw_seek(f, pos) _fseeki64(f, (__int64)(pos), SEEK_SET)
+#else
+#define mjpegw_seek(f, pos) fseeko(f, (off_t)(pos), SEEK_SET)
+#endif
+
 
 //-----------------------------------------------------------------------------------------------------------------------------
 // AVI chunks structures
@@ -109,6 +149,56 @@ typedef struct
     // followed by jpeg_data[size]
 } frame_chunk;
 
+// OpenDML super index, in the strl list. Space for every entry is reserved when the file is opened
+typedef struct
+{
+    char     id[4];       // "indx"
+    uint32_t size;        // 24 + 16 * MJPEGW_SUPER_INDEX_SIZE
+    uint16_t longs_per_entry;   // 4
+    uint8_t  index_sub_type;    // 0
+    uint8_t  index_type;        // 0 = AVI_INDEX_OF_INDEXES
+    uint32_t entries_in_use;    // PATCH LATER
+    char     chunk_id[4];       // "00dc"
+    uint32_t reserved[3];
+    // followed by indx_entry entries[MJPEGW_SUPER_INDEX_SIZE]
+} indx_header;
+
+typedef struct
+{
+    uint64_t offset;      // file position of an ix00 chunk
+    uint32_t size;        // of the ix00 chunk, header included
+    uint32_t duration;    // frames it indexes
+} indx_entry;
+
+// OpenDML standard index, one at the end of the movi list of every RIFF
+typedef struct
+{
+    char     id[4];       // "ix00"
+    uint32_t size;        // 24 + 8 * entries
+    uint16_t longs_per_entry;   // 2
+    uint8_t  index_sub_type;    // 0
+    uint8_t  index_type;        // 1 = AVI_INDEX_OF_CHUNKS
+    uint32_t entries_in_use;
+    char     chunk_id[4];       // "00dc"
+    uint64_t base_offset;       // file position the entries are relative to
+    uint32_t reserved;
+    // followed by ix00_entry entries[entries_in_use]
+} ix00_header;
+
+typedef struct
+{
+    uint32_t offset;      // of the frame data, relative to base_offset
+    uint32_t size;        // bit 31 set for delta frames, never with MJPEG
+} ix00_entry;
+
+typedef struct
+{
+    char     id[4];       // "dmlh"
+    uint32_t size;        // 248
+    uint32_t total_frames;      // PATCH LATER, every RIFF counted
+    uint32_t reserved[61];
+} dmlh_chunk;
+
 typedef struct
 {
     char     id[4];       // "00dc"
@@ -133,18 +223,108 @@ typedef struct
 
 typedef void tje_write_func(void* context, void* data, int size);
 
+// Huffman tables as DHT stores them: codes per length and symbols, for luma DC, luma AC, chroma DC and chroma AC
+typedef struct tje_huffman_spec
+{
+    uint8_t bits[4][16];
+    uint8_t vals[4][256];
+} tje_huffman_spec;
+
+// Symbol counts of the same four tables
+typedef struct tje_huffman_stats
+{
+    uint32_t freq[4][256];
+} tje_huffman_stats;
+
+// [huffman] NULL uses the standard tables of the spec (Annex K)
+// [stride] bytes from a row to the next, negative for bottom-up images (src_data is the top row)
 int tje_encode_with_func(tje_write_func* func,
                          void* context,
                          const int quality,
+                         const mjpegw_subsampling subsampling,
+                         const tje_huffman_spec* huffman,
                          const int width,
                          const int height,
                          const int num_components,
+                         const int stride,
                          const unsigned char* src_data);
 
+// Encoding state kept between images, set up again only when the quality, the subsampling or the
+// tables change. Allocated by the caller, tje_encoder_size bytes
+typedef struct tje_encoder tje_encoder;
+
+size_t tje_encoder_size(void);
+void tje_encoder_init(tje_encoder* encoder);
+int tje_encode_cached(tje_encoder* encoder,
+                      tje_write_func* func,
+                      void* context,
+                      const int quality,
+                      const mjpegw_subsampling subsampling,
+                      const tje_huffman_spec* huffman,
+                      const int width,
+                      const int height,
+                      const int num_components,
+                      const int stride,
+                      const unsigned char* src_data);
+
+// Adds the symbols encoding the image would write to stats
+int tje_gather_stats(tje_huffman_stats* stats,
+                     const int quality,
+                     const mjpegw_subsampling subsampling,
+                     const int width,
+                     const int height,
+                     const int num_components,
+                     const int stride,
+                     const unsigned char* src_data);
+
+// Optimal tables for stats. With keep_all every valid symbol gets a code, so the tables can
+// encode images other than the ones counted
+void tje_build_huffman(const tje_huffman_stats* stats, int keep_all, tje_huffman_spec* spec);
+
 
 //-----------------------------------------------------------------------------------------------------------------------------
 // mjpegw_context
 //-----------------------------------------------------------------------------------------------------------------------------
+typedef struct jpeg_buffer
+{
+    uint8_t* data;
+    uint32_t size;
+    uint32_t capacity;
+    mjpegw_mem_interface* mem;
+    int fixed;          // the capacity can't grow (frame buffers), writes past it only set overflow
+    int overflow;
+} jpeg_buffer;
+
+typedef enum
+{
+    JOB_FREE,
+    JOB_QUEUED,
+    JOB_ENCODING,
+    JOB_DONE
+} job_state;
+
+// a frame given to the worker pool, pixels and jpeg are kept between frames
+typedef struct mjpegw_job
+{
+    job_state state;
+    uint32_t frame;
+    int32_t repeat_of;  // frame it repeats, -1 when it's encoded
+    int quality;
+    int has_huffman;
+    tje_huffman_spec huffman;   // sampled tables, copied as they were when the frame was submitted
+    uint8_t* pixels;    // copy of the submitted frame
+    jpeg_buffer jpeg;   // scratch of the worker encoding it
+    uint32_t size;      // of the written JPEG, the rate control feedback
+    tje_encoder* encoder;
+} mjpegw_job;
+
+// where the data of a frame is, held frames share the chunk of an earlier one
+typedef struct mjpegw_chunk
+{
+    uint64_t pos;       // file position of the data, after the chunk header
+    uint32_t size;
+} mjpegw_chunk;
+
 typedef struct mjpegw_context
 {
     FILE* f;
@@ -153,13 +333,17 @@ typedef struct mjpegw_context
     uint32_t height;
     uint32_t fps;
     uint32_t frame_count;
+    mjpegw_subsampling subsampling;
 
     mjpegw_mem_interface mem;
 
-    long riff_pos;
-    long movi_pos;
-    long frame_count_pos;
-    long length_pos;
+    uint64_t pos;       // end of the file, where the next chunk goes
+    uint64_t riff_pos;  // RIFF being written, the first one or an AVIX
+    uint64_t avih_pos;
+    uint64_t strh_pos;
+    uint64_t indx_pos;
+    uint64_t dmlh_pos;
+    uint64_t movi_pos;
 
     // main avi structures
     riff_header riff;
@@ -169,14 +353,46 @@ typedef struct mjpegw_context
     strh_chunk strh;
     strf_chunk strf;
     movi_header movi;
-
-    idx1_entry* idx;
-    uint32_t idx_count;
-    uint32_t idx_capacity;
-
-    uint8_t* jpeg_data;
-    uint32_t jpeg_size;
-    uint32_t jpeg_capacity;
+    dmlh_chunk dmlh;
+
+    mjpegw_chunk* chunks;   // one per frame
+    uint32_t chunk_capacity;
+
+    // OpenDML, a RIFF-AVIX is started every MJPEGW_RIFF_LIMIT bytes
+    uint32_t riff_first_frame;  // first frame of the RIFF being written
+    uint32_t avi_frames;        // frames of the first RIFF, the ones idx1 and AVI 1.0 readers see
+    uint32_t riff_count;        // RIFFs finished, their ix00 are in super_index
+    indx_header indx;
+    indx_entry super_index[MJPEGW_SUPER_INDEX_SIZE];
+
+    jpeg_buffer jpeg;   // synchronous encoding
+    tje_encoder* encoder;
+
+    // huffman tables, see mjpegw_set_huffman
+    mjpegw_huffman huffman;
+    uint32_t sample_frames;
+    uint32_t frames_sampled;
+    tje_huffman_stats sample_stats;
+    tje_huffman_spec sample_spec;
+
+    // rate control, see mjpegw_set_rate_control
+    uint32_t target_bitrate;
+    uint32_t max_frame_size;
+    float rc_quality;           // of the next frame, 0 until the first one
+    uint64_t rc_bytes;          // written so far
+
+#ifndef MJPEGW_NO_THREADS
+    // worker pool, see mjpegw_set_threads. jobs is a ring indexed by frame number
+    pthread_t threads[MJPEGW_MAX_THREADS];
+    uint32_t thread_count;
+    mjpegw_job* jobs;
+    uint32_t job_count;
+    uint32_t submitted;         // frames handed to the workers, frame_count counts the written ones
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready;   // a job was queued or the pool is stopping
+    pthread_cond_t job_done;    // a job was encoded
+#endif
 } mjpegw_context;
 
 
@@ -215,7 +431,140 @@ static inline mjpegw_mem_interface default_allocator(void)
 }
 
 //-----------------------------------------------------------------------------------------------------------------------------
-mjpegw_context* mjpegw_open(const char *filename, uint32_t width, uint32_t height, uint32_t fps, mjpegw_mem_interface* mem)
+static void* arena_malloc(size_t size, void* user)
+{
+    mjpegw_arena* arena = (mjpegw_arena*) user;
+    size_t start = (arena->used + MJPEGW_ARENA_ALIGN - 1) & ~(size_t)(MJPEGW_ARENA_ALIGN - 1);
+    if (start > arena->size || size > arena->size - start)
+        return NULL;
+
+    arena->last = start;
+    arena->used = start + size;
+    return arena->base + start;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void* arena_realloc(void* old_ptr, size_t old_size, size_t new_size, void* user)
+{
+    mjpegw_arena* arena = (mjpegw_arena*) user;
+
+    // the last block grows in place
+    if (old_ptr && (uint8_t*)old_ptr == arena->base + arena->last && new_size <= arena->size - arena->last)
+    {
+        arena->used = arena->last + new_size;
+        return old_ptr;
+    }
+
+    void* ptr = arena_malloc(new_size, user);
+    if (ptr && old_ptr)
+        memcpy(ptr, old_ptr, old_size < new_size ? old_size : new_size);
+    return ptr;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void arena_free(void* ptr, void* user)
+{
+    (void)ptr;
+    (void)user;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+mjpegw_mem_interface mjpegw_arena_interface(mjpegw_arena* arena, void* buffer, size_t size)
+{
+    // blocks are aligned from the base, the base itself is aligned first
+    size_t skip = (MJPEGW_ARENA_ALIGN - (uintptr_t)buffer % MJPEGW_ARENA_ALIGN) % MJPEGW_ARENA_ALIGN;
+    if (skip > size)
+        skip = size;
+    *arena = (mjpegw_arena) { .base = (uint8_t*) buffer + skip, .size = size - skip };
+
+    return (mjpegw_mem_interface)
+    {
+        .malloc_fn  = arena_malloc,
+        .realloc_fn = arena_realloc,
+        .free_fn    = arena_free,
+        .user       = arena
+    };
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// JPEG of [mcu_rows] rows of MCUs with [block_size] bytes per block, plus the headers. Largest the
+// encoder can write with MJPEGW_BLOCK_BOUND
+static size_t jpeg_size_bound(uint32_t width, uint32_t mcu_rows, mjpegw_subsampling subsampling, size_t block_size)
+{
+    uint32_t h_factor = subsampling == MJPEGW_444 ? 1 : 2;
+    uint32_t v_factor = subsampling == MJPEGW_420 ? 2 : 1;
+    size_t mcus = (size_t)((width + 8 * h_factor - 1) / (8 * h_factor)) * mcu_rows;
+
+    return MJPEGW_HEADERS_BOUND + mcus * (h_factor * v_factor + 2) * block_size;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static size_t frame_size_bound(uint32_t width, uint32_t height, mjpegw_subsampling subsampling)
+{
+    uint32_t mcu_height = subsampling == MJPEGW_420 ? 16 : 8;
+    size_t bound = jpeg_size_bound(width, (height + mcu_height - 1) / mcu_height, subsampling, MJPEGW_BLOCK_BOUND);
+
+    // the chunk size is 32 bits, bigger frames can't be stored anyway
+    return bound < UINT32_MAX ? bound : UINT32_MAX;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// What the frame buffers take, a bigger frame is streamed to the file (write_streamed_frame)
+static size_t frame_size_estimate(uint32_t width, uint32_t height, mjpegw_subsampling subsampling)
+{
+    uint32_t mcu_height = subsampling == MJPEGW_420 ? 16 : 8;
+    uint32_t mcu_rows = (height + mcu_height - 1) / mcu_height;
+    size_t estimate = jpeg_size_bound(width, mcu_rows, subsampling, MJPEGW_BLOCK_ESTIMATE);
+    size_t bound = frame_size_bound(width, height, subsampling);
+    return estimate < bound ? estimate : bound;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+size_t mjpegw_memory_bound(uint32_t width, uint32_t height, mjpegw_subsampling subsampling, uint32_t threads,
+                           uint32_t frames)
+{
+    // every block rounded up to the arena alignment
+    #define MJPEGW_ALIGNED(size) (((size_t)(size) + MJPEGW_ARENA_ALIGN - 1) & ~(size_t)(MJPEGW_ARENA_ALIGN - 1))
+
+    size_t encoder = MJPEGW_ALIGNED(tje_encoder_size())
+                   + MJPEGW_ALIGNED(frame_size_estimate(width, height, subsampling));
+    size_t total = MJPEGW_ARENA_ALIGN + MJPEGW_ALIGNED(sizeof(mjpegw_context))
+                 + MJPEGW_ALIGNED(sizeof(mjpegw_chunk) * MJPEGW_INDEX_CAPACITY)
+                 + MJPEGW_ALIGNED(sizeof(mjpegw_chunk) * frames) + encoder;
+
+#ifndef MJPEGW_NO_THREADS
+    if (threads > MJPEGW_MAX_THREADS)
+        threads = MJPEGW_MAX_THREADS;
+    size_t jobs = (size_t)threads * MJPEGW_JOBS_PER_THREAD;
+    total += MJPEGW_ALIGNED(sizeof(mjpegw_job) * jobs) + jobs * (encoder + MJPEGW_ALIGNED((size_t)width * height * 4));
+#else
+    (void)threads;
+#endif
+
+    #undef MJPEGW_ALIGNED
+    return total;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Appends to the file, ctx->pos follows the end without asking the file (ftell is a long)
+static void write_data(mjpegw_context* ctx, const void* data, size_t size)
+{
+    fwrite(data, 1, size, ctx->f);
+    ctx->pos += size;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Overwrites a header written earlier and goes back to the end
+static void patch_data(mjpegw_context* ctx, uint64_t pos, const void* data, size_t size)
+{
+    mjpegw_seek(ctx->f, pos);
+    fwrite(data, 1, size, ctx->f);
+    mjpegw_seek(ctx->f, ctx->pos);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+mjpegw_context* mjpegw_open(const char *filename, uint32_t width, uint32_t height, uint32_t fps,
+                            mjpegw_subsampling subsampling, mjpegw_mem_interface* mem)
 {
     mjpegw_context* ctx = NULL;
 
@@ -231,6 +580,7 @@ mjpegw_context* mjpegw_open(const char *filename, uint32_t width, uint32_t heigh
     ctx->width  = width;
     ctx->height = height;
     ctx->fps = fps;
+    ctx->subsampling = subsampling;
     ctx->frame_count = 0;
     ctx->mem = allocator;
 
@@ -241,18 +591,21 @@ mjpegw_context* mjpegw_open(const char *filename, uint32_t width, uint32_t heigh
         return NULL;
     }
 
+    // hdrl: avih, strl (strh, strf, indx with room for every RIFF) and odml (dmlh)
+    ctx->strl.size = 4 + sizeof(strh_chunk) + sizeof(strf_chunk) + sizeof(indx_header) + sizeof(ctx->super_index);
+    ctx->hdrl.size = 4 + sizeof(avih_chunk) + 8 + ctx->strl.size + sizeof(list_header) + sizeof(dmlh_chunk);
+
     memcpy(ctx->riff.riff, "RIFF", 4);
     ctx->riff.size = 0; // patch later
     memcpy(ctx->riff.avi, "AVI ", 4);
-    ctx->riff_pos = ftell(ctx->f);
-    fwrite(&ctx->riff, sizeof(ctx->riff), 1, ctx->f);
+    ctx->riff_pos = ctx->pos;
+    write_data(ctx, &ctx->riff, sizeof(ctx->riff));
 
     memcpy(ctx->hdrl.list, "LIST", 4);
-    ctx->hdrl.size = 188;
     memcpy(ctx->hdrl.type, "hdrl", 4);
-    fwrite(&ctx->hdrl, sizeof(ctx->hdrl), 1, ctx->f);
+    write_data(ctx, &ctx->hdrl, sizeof(ctx->hdrl));
 
-    ctx->frame_count_pos = ftell(ctx->f) + 32;
+    ctx->avih_pos = ctx->pos;
     memcpy(ctx->avih.id, "avih", 4);
     ctx->avih.size = 56;
     ctx->avih.microsec_per_frame = 1000000 / fps;
@@ -265,15 +618,13 @@ mjpegw_context* mjpegw_open(const char *filename, uint32_t width, uint32_t heigh
     ctx->avih.suggested_buffer_size = ctx->width*ctx->height*3;
     ctx->avih.width = width;
     ctx->avih.height = height;
-    fwrite(&ctx->avih, sizeof(ctx->avih), 1, ctx->f);
+    write_data(ctx, &ctx->avih, sizeof(ctx->avih));
 
     memcpy(ctx->strl.list, "LIST", 4);
-    ctx->strl.size = sizeof(strh_chunk) + sizeof(strf_chunk);
-    assert(ctx->strl.size == 112);
     memcpy(ctx->strl.type, "strl", 4);
-    fwrite(&ctx->strl, sizeof(ctx->strl), 1, ctx->f);
+    write_data(ctx, &ctx->strl, sizeof(ctx->strl));
 
-    ctx->length_pos = ftell(ctx->f) + 44;
+    ctx->strh_pos = ctx->pos;
     memcpy(ctx->strh.id, "strh", 4);
     ctx->strh.size = 56;
     memcpy(ctx->strh.type, "vids", 4);
@@ -293,10 +644,10 @@ mjpegw_context* mjpegw_open(const char *filename, uint32_t width, uint32_t heigh
     ctx->strh.frame.top = 0;
     ctx->strh.frame.right = width;
     ctx->strh.frame.bottom = height;
-    fwrite(&ctx->strh, sizeof(ctx->strh), 1, ctx->f);
+    write_data(ctx, &ctx->strh, sizeof(ctx->strh));
 
     memcpy(ctx->strf.id, "strf", 4);
-    ctx->strf.size = sizeof(ctx->strf);
+    ctx->strf.size = sizeof(ctx->strf) - 8;
     ctx->strf.bi_size = 40;
     ctx->strf.bi_width = width;
     ctx->strf.bi_height = height;
@@ -308,204 +659,878 @@ mjpegw_context* mjpegw_open(const char *filename, uint32_t width, uint32_t heigh
     ctx->strf.bi_y_ppm = 0;
     ctx->strf.bi_clr_used = 0;
     ctx->strf.bi_clr_important = 0;
-    fwrite(&ctx->strf, sizeof(ctx->strf), 1, ctx->f);
+    write_data(ctx, &ctx->strf, sizeof(ctx->strf));
+
+    ctx->indx_pos = ctx->pos;
+    memcpy(ctx->indx.id, "indx", 4);
+    ctx->indx.size = sizeof(indx_header) - 8 + sizeof(ctx->super_index);
+    ctx->indx.longs_per_entry = 4;
+    ctx->indx.index_sub_type = 0;
+    ctx->indx.index_type = 0; // AVI_INDEX_OF_INDEXES
+    ctx->indx.entries_in_use = 0; // patch later
+    memcpy(ctx->indx.chunk_id, "00dc", 4);
+    write_data(ctx, &ctx->indx, sizeof(ctx->indx));
+    write_data(ctx, ctx->super_index, sizeof(ctx->super_index));
+
+    list_header odml = { .size = 4 + sizeof(dmlh_chunk) };
+    memcpy(odml.list, "LIST", 4);
+    memcpy(odml.type, "odml", 4);
+    write_data(ctx, &odml, sizeof(odml));
+
+    ctx->dmlh_pos = ctx->pos;
+    memcpy(ctx->dmlh.id, "dmlh", 4);
+    ctx->dmlh.size = sizeof(dmlh_chunk) - 8;
+    ctx->dmlh.total_frames = 0; // patch later
+    write_data(ctx, &ctx->dmlh, sizeof(ctx->dmlh));
+    assert(ctx->pos == ctx->riff_pos + sizeof(riff_header) + 8 + ctx->hdrl.size);
 
     memcpy(ctx->movi.list, "LIST", 4);
     ctx->movi.size = 0; // patch later
     memcpy(ctx->movi.type, "movi", 4);
-    ctx->movi_pos = ftell(ctx->f);
-    fwrite(&ctx->movi, sizeof(ctx->movi), 1, ctx->f);
+    ctx->movi_pos = ctx->pos;
+    write_data(ctx, &ctx->movi, sizeof(ctx->movi));
 
-    ctx->idx_capacity = 256;
-    ctx->idx_count = 0;
-    ctx->idx = ctx->mem.malloc_fn(sizeof(idx1_entry) * ctx->idx_capacity, ctx->mem.user);
-    if (!ctx->idx)
+    ctx->chunk_capacity = MJPEGW_INDEX_CAPACITY;
+    ctx->chunks = ctx->mem.malloc_fn(sizeof(mjpegw_chunk) * ctx->chunk_capacity, ctx->mem.user);
+    if (!ctx->chunks)
     {
         fclose(ctx->f);
         ctx->mem.free_fn(ctx, ctx->mem.user);
         return NULL;
     }
 
-    ctx->jpeg_capacity = width*height;
-    ctx->jpeg_data = ctx->mem.malloc_fn(ctx->jpeg_capacity, ctx->mem.user);
-    ctx->jpeg_size = 0;
+    ctx->jpeg.mem = &ctx->mem;
 
     return ctx;
 }
 
 //-----------------------------------------------------------------------------------------------------------------------------
-void jpeg_write_func(void* context, void* data, int size)
+void mjpegw_set_frame_duration(mjpegw_context *ctx, uint32_t microseconds)
+{
+    assert(ctx);
+    assert(ctx->frame_count == 0);
+
+    if (microseconds == 0)
+        return;
+
+    // rate/scale is the exact frame rate, 1000000/microseconds
+    ctx->avih.microsec_per_frame = microseconds;
+    ctx->strh.scale = microseconds;
+    ctx->strh.rate = 1000000;
+
+    patch_data(ctx, ctx->avih_pos, &ctx->avih, sizeof(ctx->avih));
+    patch_data(ctx, ctx->strh_pos, &ctx->strh, sizeof(ctx->strh));
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void jpeg_write_func(void* context, void* data, int size)
+{
+    jpeg_buffer* buf = (jpeg_buffer*) context;
+
+    if (buf->overflow)
+        return;
+
+    if ((buf->size + size) > buf->capacity)
+    {
+        if (buf->fixed)
+        {
+            buf->overflow = 1;
+            return;
+        }
+
+        uint32_t new_capacity = buf->capacity ? buf->capacity * 2 : 64 * 1024;
+        while (new_capacity < buf->size + size)
+            new_capacity *= 2;
+
+        buf->data = buf->mem->realloc_fn(buf->data, buf->capacity, new_capacity, buf->mem->user);
+        assert(buf->data);
+        buf->capacity = new_capacity;
+    }
+
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void free_jpeg_buffer(jpeg_buffer* buf)
+{
+    if (buf->data)
+        buf->mem->free_fn(buf->data, buf->mem->user);
+
+    buf->data = NULL;
+    buf->size = 0;
+    buf->capacity = 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static int reserve_jpeg_buffer(jpeg_buffer* buf, size_t capacity)
+{
+    if (capacity <= buf->capacity)
+        return 1;
+
+    uint8_t* data = buf->mem->realloc_fn(buf->data, buf->capacity, capacity, buf->mem->user);
+    if (!data)
+        return 0;
+
+    buf->data = data;
+    buf->capacity = (uint32_t)capacity;
+    return 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// The output buffer takes a usual frame and never grows, a bigger one is encoded again into the file
+// on the calling thread. Encoding never allocates afterwards
+static int alloc_encoder(mjpegw_context* ctx, jpeg_buffer* buf, tje_encoder** encoder)
+{
+    *encoder = ctx->mem.malloc_fn(tje_encoder_size(), ctx->mem.user);
+    if (!*encoder)
+        return 0;
+
+    tje_encoder_init(*encoder);
+    buf->fixed = 1;
+    return reserve_jpeg_buffer(buf, frame_size_estimate(ctx->width, ctx->height, ctx->subsampling));
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void free_encoder(mjpegw_context* ctx, jpeg_buffer* buf, tje_encoder** encoder)
+{
+    if (*encoder)
+        ctx->mem.free_fn(*encoder, ctx->mem.user);
+    *encoder = NULL;
+    free_jpeg_buffer(buf);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// [huffman] are the sampled tables, per frame tables are built here. Runs on the workers too
+static void encode_frame(mjpegw_context *ctx, tje_encoder* encoder, tje_write_func* func, void* context,
+                         const void* pixels, int stride, int quality, const tje_huffman_spec* huffman)
+{
+    tje_huffman_spec spec;
+    if (ctx->huffman == MJPEGW_HUFFMAN_PER_FRAME)
+    {
+        tje_huffman_stats stats = {0};
+        tje_gather_stats(&stats, quality, ctx->subsampling, ctx->width, ctx->height, 4, stride, pixels);
+        tje_build_huffman(&stats, 0, &spec);
+        huffman = &spec;
+    }
+
+    tje_encode_cached(encoder, func, context, quality, ctx->subsampling, huffman, ctx->width, ctx->height, 4, stride,
+                      (const unsigned char*)pixels);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// From the start of [out], out->overflow is set if the frame didn't fit
+static void encode_frame_buffer(mjpegw_context *ctx, tje_encoder* encoder, jpeg_buffer* out, const void* pixels,
+                                int stride, int quality, const tje_huffman_spec* huffman)
+{
+    out->size = 0;
+    out->overflow = 0;
+    encode_frame(ctx, encoder, jpeg_write_func, out, pixels, stride, quality, huffman);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Moves the quality of the next frames toward the size the targets leave them. The feedback is
+// [frame], encoded at [quality]: the last one on the calling thread. With workers it's the frame
+// job_count frames before the next, not whichever frames they happen to have finished
+static void update_rate_control(mjpegw_context *ctx, uint32_t frame, int quality, uint32_t size)
 {
-    mjpegw_context *ctx = (mjpegw_context*) context;
+    if (!ctx->target_bitrate && !ctx->max_frame_size)
+        return;
+
+    ctx->rc_bytes += size;
 
-    if ((ctx->jpeg_size + size) >= ctx->jpeg_capacity)
+    double target = 0.0;
+    if (ctx->target_bitrate)
     {
-        ctx->jpeg_data = ctx->mem.realloc_fn(ctx->jpeg_data, ctx->jpeg_capacity, ctx->jpeg_size * 2, ctx->mem.user);
-        assert(ctx->jpeg_data);
-        ctx->jpeg_capacity *= 2;
+        double per_frame = ctx->target_bitrate / 8.0 * ctx->avih.microsec_per_frame / 1000000.0;
+        double budget = per_frame * (frame + 1) - (double)ctx->rc_bytes;
+        target = per_frame + budget / MJPEGW_RC_WINDOW;
+        if (target < per_frame / 4)
+            target = per_frame / 4;
     }
 
-    uint8_t* ptr = (uint8_t*) ctx->jpeg_data;
-    ptr += ctx->jpeg_size;
-    memcpy(ptr, data, size);
-    ctx->jpeg_size += size;
+    // some headroom, the feedback comes too late for sudden changes
+    double max_target = ctx->max_frame_size * 0.9;
+    if (ctx->max_frame_size && (target == 0.0 || target > max_target))
+        target = max_target;
+
+    float step = MJPEGW_RC_GAIN * log2f((float)(target / (size ? size : 1)));
+    if (step > MJPEGW_RC_MAX_STEP)
+        step = MJPEGW_RC_MAX_STEP;
+    if (step < -MJPEGW_RC_MAX_STEP)
+        step = -MJPEGW_RC_MAX_STEP;
+
+    ctx->rc_quality = quality + step;
+    if (ctx->rc_quality < 1.f)
+        ctx->rc_quality = 1.f;
+    if (ctx->rc_quality > 100.f)
+        ctx->rc_quality = 100.f;
 }
 
+//-----------------------------------------------------------------------------------------------------------------------------
+static void push_chunk(mjpegw_context *ctx, mjpegw_chunk chunk)
+{
+    if(ctx->frame_count >= ctx->chunk_capacity)
+    {
+        uint32_t new_capacity = ctx->chunk_capacity * 2;
+        mjpegw_chunk* new_chunks = ctx->mem.realloc_fn(ctx->chunks, sizeof(mjpegw_chunk) * ctx->chunk_capacity,
+                                                       sizeof(mjpegw_chunk) * new_capacity, ctx->mem.user);
+
+        assert(new_chunks != NULL);
+        ctx->chunks = new_chunks;
+        ctx->chunk_capacity = new_capacity;
+    }
+
+    ctx->chunks[ctx->frame_count++] = chunk;
+}
 
 //-----------------------------------------------------------------------------------------------------------------------------
-void mjpegw_add_frame(mjpegw_context *ctx, const void* pixels, const int quality)
+// Closes the movi list of the RIFF being written with its ix00, the first RIFF gets an idx1 too
+static void end_riff(mjpegw_context *ctx)
 {
-    ctx->jpeg_size = 0;
+    uint32_t first = ctx->riff_first_frame;
+    uint32_t frames = ctx->frame_count - first;
+    uint64_t base = ctx->movi_pos;
+
+    assert(ctx->riff_count < MJPEGW_SUPER_INDEX_SIZE);
+    indx_entry* super = &ctx->super_index[ctx->riff_count++];
+    super->offset = ctx->pos;
+    super->size = sizeof(ix00_header) + frames * sizeof(ix00_entry);
+    super->duration = frames;
+
+    ix00_header ix = { .size = super->size - 8, .longs_per_entry = 2, .index_type = 1, .entries_in_use = frames };
+    memcpy(ix.id, "ix00", 4);
+    memcpy(ix.chunk_id, "00dc", 4);
+    ix.base_offset = base;
+    write_data(ctx, &ix, sizeof(ix));
+    for (uint32_t i = first; i < ctx->frame_count; i++)
+    {
+        ix00_entry entry = { .offset = (uint32_t)(ctx->chunks[i].pos - base), .size = ctx->chunks[i].size };
+        write_data(ctx, &entry, sizeof(entry));
+    }
+
+    uint32_t movi_size = (uint32_t)(ctx->pos - (ctx->movi_pos + 8));
+    patch_data(ctx, ctx->movi_pos + offsetof(movi_header, size), &movi_size, sizeof(movi_size));
 
-    tje_encode_with_func(jpeg_write_func, ctx, quality, ctx->width, ctx->height, 4, (const unsigned char*)pixels);
-    
-    if(ctx->idx_count >= ctx->idx_capacity)
+    if (ctx->riff_count == 1)
     {
-        uint32_t new_capacity = ctx->idx_capacity * 2;
-        idx1_entry* new_idx = ctx->mem.realloc_fn(ctx->idx, sizeof(idx1_entry) * ctx->idx_capacity,
-                                                  sizeof(idx1_entry) * new_capacity, ctx->mem.user);
+        idx1_header idxh = { .size = frames * sizeof(idx1_entry) };
+        memcpy(idxh.id, "idx1", 4);
+        write_data(ctx, &idxh, sizeof(idxh));
+
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            // relative to the 'movi' fourcc, pointing at the chunk header
+            idx1_entry entry = { .flags = 0x10, .size = ctx->chunks[i].size };
+            memcpy(entry.id, "00dc", 4);
+            entry.offset = (uint32_t)(ctx->chunks[i].pos - sizeof(frame_chunk) - (ctx->movi_pos + 8));
+            write_data(ctx, &entry, sizeof(entry));
+        }
 
-        assert(new_idx != NULL);
-        ctx->idx = new_idx;
-        ctx->idx_capacity = new_capacity;
+        ctx->avi_frames = frames;
     }
 
-    long frame_pos = ftell(ctx->f);
-    assert(frame_pos != -1L);
+    uint32_t riff_size = (uint32_t)(ctx->pos - (ctx->riff_pos + 8));
+    patch_data(ctx, ctx->riff_pos + offsetof(riff_header, size), &riff_size, sizeof(riff_size));
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Starts a RIFF-AVIX when a chunk of [size] bytes and the indexes wouldn't fit in the current one
+static void reserve_riff(mjpegw_context *ctx, uint32_t size)
+{
+    uint64_t frames = ctx->frame_count - ctx->riff_first_frame + 1;
+    uint64_t indexes = sizeof(ix00_header) + frames * sizeof(ix00_entry);
+    if (ctx->riff_count == 0)
+        indexes += sizeof(idx1_header) + frames * sizeof(idx1_entry);
+
+    uint64_t riff_size = ctx->pos + sizeof(frame_chunk) + size + indexes - ctx->riff_pos;
+    if (riff_size <= MJPEGW_RIFF_LIMIT || frames == 1 || ctx->riff_count + 1 >= MJPEGW_SUPER_INDEX_SIZE)
+        return;
+
+    end_riff(ctx);
+
+    riff_header avix = {0};
+    memcpy(avix.riff, "RIFF", 4);
+    memcpy(avix.avi, "AVIX", 4);
+    ctx->riff_pos = ctx->pos;
+    write_data(ctx, &avix, sizeof(avix));
+
+    ctx->movi_pos = ctx->pos;
+    write_data(ctx, &ctx->movi, sizeof(ctx->movi));
+    ctx->riff_first_frame = ctx->frame_count;
+}
 
-    uint32_t chunk_size = ctx->jpeg_size;
-    if (ctx->jpeg_size & 1)
+//-----------------------------------------------------------------------------------------------------------------------------
+// Appends an encoded frame to the movi list, frames must come in order
+static void write_frame_chunk(mjpegw_context *ctx, const jpeg_buffer* jpeg)
+{
+    uint32_t chunk_size = jpeg->size;
+    if (jpeg->size & 1)
         chunk_size++;
 
+    reserve_riff(ctx, chunk_size);
+
     frame_chunk hdr = { .size = chunk_size };
     memcpy(hdr.id, "00dc", 4);
-    fwrite(&hdr, sizeof(frame_chunk), 1, ctx->f);
-    fwrite(ctx->jpeg_data, 1, ctx->jpeg_size, ctx->f);
+    write_data(ctx, &hdr, sizeof(frame_chunk));
+    mjpegw_chunk chunk = { .pos = ctx->pos, .size = chunk_size };
+    write_data(ctx, jpeg->data, jpeg->size);
 
-    if (ctx->jpeg_size & 1)
+    if (jpeg->size & 1)
     {
         uint8_t pad = 0;
-        fwrite(&pad, 1, 1, ctx->f);
+        write_data(ctx, &pad, 1);
     }
 
-    ctx->movi.size += sizeof(frame_chunk) + chunk_size;
+    push_chunk(ctx, chunk);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void file_write_func(void* context, void* data, int size)
+{
+    write_data((mjpegw_context*) context, data, (size_t)size);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// A frame that didn't fit its buffer, encoded again straight into the file on the calling thread. Its
+// size is only known afterwards, the RIFF makes room for the largest one and the chunk header is patched.
+// Returns the size of the JPEG
+static uint32_t write_streamed_frame(mjpegw_context *ctx, tje_encoder* encoder, const void* pixels, int stride,
+                                     int quality, const tje_huffman_spec* huffman)
+{
+    reserve_riff(ctx, (uint32_t)frame_size_bound(ctx->width, ctx->height, ctx->subsampling));
+
+    uint64_t hdr_pos = ctx->pos;
+    frame_chunk hdr = {0};
+    memcpy(hdr.id, "00dc", 4);
+    write_data(ctx, &hdr, sizeof(frame_chunk));
+    mjpegw_chunk chunk = { .pos = ctx->pos };
 
-    idx1_entry* entry = &ctx->idx[ctx->idx_count++];
-    memcpy(entry->id, "00dc", 4);
-    entry->flags = 0x10;
-    entry->offset = (uint32_t)(frame_pos - ctx->movi_pos - 8); // relative to 'movi' data start
-    entry->size = chunk_size;
+    encode_frame(ctx, encoder, file_write_func, ctx, pixels, stride, quality, huffman);
+    uint32_t size = (uint32_t)(ctx->pos - chunk.pos);
+    if (size & 1)
+    {
+        uint8_t pad = 0;
+        write_data(ctx, &pad, 1);
+    }
 
-    ctx->frame_count++;
+    hdr.size = chunk.size = size + (size & 1);
+    patch_data(ctx, hdr_pos, &hdr, sizeof(hdr));
+    push_chunk(ctx, chunk);
+    return size;
 }
 
 //-----------------------------------------------------------------------------------------------------------------------------
-void mjpegw_close(mjpegw_context *ctx)
+// A frame identical to a written one. Its index entry points to the same chunk when it's in the same
+// RIFF, ix00 offsets can't reach an earlier RIFF so the chunk is copied then
+static void write_repeated_frame(mjpegw_context *ctx, uint32_t frame)
 {
-    assert(ctx);
+    assert(frame < ctx->frame_count);
 
-    // patch frame count
-    fseek(ctx->f, ctx->frame_count_pos, SEEK_SET);
-    fwrite(&ctx->frame_count, sizeof(uint32_t), 1, ctx->f);
-    fseek(ctx->f, ctx->length_pos, SEEK_SET);
-    fwrite(&ctx->frame_count, sizeof(uint32_t), 1, ctx->f);
-
-    // write idx1 chunk
-    fseek(ctx->f, 0, SEEK_END); 
-    idx1_header idxh = {0};
-    memcpy(idxh.id, "idx1", 4);
-    idxh.size = ctx->idx_count * sizeof(idx1_entry);
-
-    fwrite(&idxh, sizeof(idx1_header), 1, ctx->f);
-    if (ctx->idx_count)
-        fwrite(ctx->idx, sizeof(idx1_entry), ctx->idx_count, ctx->f);
-
-    // patch movi LIST size
-    long cur_pos = ftell(ctx->f);
-    fseek(ctx->f, ctx->movi_pos + 4, SEEK_SET);
-    uint32_t movi_size = (uint32_t)(cur_pos - (ctx->movi_pos + 8));
-    fwrite(&movi_size, sizeof(uint32_t), 1, ctx->f);
-
-    // patch RIFF size
-    fseek(ctx->f, ctx->riff_pos + 4, SEEK_SET);
-    uint32_t riff_size = (uint32_t)(cur_pos - (ctx->riff_pos + 8));
-    fwrite(&riff_size, sizeof(uint32_t), 1, ctx->f);
-
-    if (ctx->idx)
+    mjpegw_chunk chunk = ctx->chunks[frame];
+    reserve_riff(ctx, 0);
+    if (chunk.pos > ctx->movi_pos)
     {
-        ctx->mem.free_fn(ctx->idx, ctx->mem.user);
-        ctx->idx = NULL;
-        ctx->idx_capacity = 0;
+        push_chunk(ctx, chunk);
+        return;
     }
 
-    if (ctx->jpeg_data)
+    reserve_riff(ctx, chunk.size);
+
+    frame_chunk hdr = { .size = chunk.size };
+    memcpy(hdr.id, "00dc", 4);
+    write_data(ctx, &hdr, sizeof(frame_chunk));
+    mjpegw_chunk copy = { .pos = ctx->pos, .size = chunk.size };
+
+    uint8_t block[MJPEGW_COPY_BLOCK];
+    for (uint32_t done = 0; done < chunk.size; )
     {
-        ctx->mem.free_fn(ctx->jpeg_data, ctx->mem.user);
-        ctx->jpeg_data = NULL;
-        ctx->jpeg_capacity = 0;
+        uint32_t size = chunk.size - done < sizeof(block) ? chunk.size - done : (uint32_t)sizeof(block);
+
+        mjpegw_seek(ctx->f, chunk.pos + done);
+        size_t read = fread(block, 1, size, ctx->f);
+        assert(read == size);
+        (void)read;
+
+        mjpegw_seek(ctx->f, ctx->pos);
+        write_data(ctx, block, size);
+        done += size;
     }
 
-    fclose(ctx->f);
-    ctx->f = NULL;
+    push_chunk(ctx, copy);
 }
 
+#ifndef MJPEGW_NO_THREADS
+
 //-----------------------------------------------------------------------------------------------------------------------------
-// tiny_jpeg, code copied and stripped from https://github.com/serge-rgb/TinyJPEG
+// Worker pool
 //-----------------------------------------------------------------------------------------------------------------------------
 
-#define tjei_min(a, b) ((a) < b) ? (a) : (b);
-#define tjei_max(a, b) ((a) < b) ? (b) : (a);
+static void* worker_main(void* arg)
+{
+    mjpegw_context* ctx = (mjpegw_context*) arg;
 
+    pthread_mutex_lock(&ctx->lock);
+    for (;;)
+    {
+        // oldest queued frame first, it's the one the writer waits for
+        mjpegw_job* job = NULL;
+        for (uint32_t i = 0; i < ctx->job_count; i++)
+        {
+            mjpegw_job* candidate = &ctx->jobs[i];
+            if (candidate->state == JOB_QUEUED && (!job || candidate->frame < job->frame))
+                job = candidate;
+        }
 
-#if defined(_MSC_VER)
-#define TJEI_FORCE_INLINE __forceinline
-// #define TJEI_FORCE_INLINE __declspec(noinline)  // For profiling
-#else
-#define TJEI_FORCE_INLINE static // TODO: equivalent for gcc & clang
-#endif
+        if (!job)
+        {
+            if (ctx->stopping)
+                break;
 
+            pthread_cond_wait(&ctx->job_ready, &ctx->lock);
+            continue;
+        }
 
-#define TJEI_BUFFER_SIZE 1024
-#define tje_log(msg)
+        job->state = JOB_ENCODING;
+        pthread_mutex_unlock(&ctx->lock);
 
+        encode_frame_buffer(ctx, job->encoder, &job->jpeg, job->pixels, ctx->width * 4, job->quality,
+                            job->has_huffman ? &job->huffman : NULL);
 
-typedef struct
+        pthread_mutex_lock(&ctx->lock);
+        job->state = JOB_DONE;
+        pthread_cond_broadcast(&ctx->job_done);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// The single writer, runs on the calling thread. Writes the encoded jobs in frame order and
+// waits for the workers until no more than [max_in_flight] frames are left unwritten
+static void write_encoded_jobs(mjpegw_context* ctx, uint32_t max_in_flight)
 {
-    void*           context;
-    tje_write_func* func;
-} TJEWriteContext;
+    pthread_mutex_lock(&ctx->lock);
+    while (ctx->frame_count < ctx->submitted)
+    {
+        mjpegw_job* next = &ctx->jobs[ctx->frame_count % ctx->job_count];
+        if (next->state == JOB_DONE)
+        {
+            // nobody else touches a done job, the file is written without holding the lock
+            pthread_mutex_unlock(&ctx->lock);
+            if (next->repeat_of >= 0)
+                write_repeated_frame(ctx, (uint32_t)next->repeat_of);
+            else if (next->jpeg.overflow)
+                next->size = write_streamed_frame(ctx, next->encoder, next->pixels, ctx->width * 4, next->quality,
+                                                  next->has_huffman ? &next->huffman : NULL);
+            else
+            {
+                write_frame_chunk(ctx, &next->jpeg);
+                next->size = next->jpeg.size;
+            }
+            pthread_mutex_lock(&ctx->lock);
+            next->state = JOB_FREE;
+        }
+        else if (ctx->submitted - ctx->frame_count > max_in_flight)
+            pthread_cond_wait(&ctx->job_done, &ctx->lock);
+        else
+            break;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
 
-typedef struct
+//-----------------------------------------------------------------------------------------------------------------------------
+// Makes room in the ring, the slot of the next frame is free afterwards. It held the frame submitted
+// job_count frames before, that frame is the rate control feedback
+static mjpegw_job* next_free_job(mjpegw_context* ctx)
 {
-    // Huffman data.
-    uint8_t         ehuffsize[4][257];
-    uint16_t        ehuffcode[4][256];
-    uint8_t const * ht_bits[4];
-    uint8_t const * ht_vals[4];
+    write_encoded_jobs(ctx, ctx->job_count - 1);
 
-    // Cuantization tables.
-    uint8_t         qt_luma[64];
-    uint8_t         qt_chroma[64];
+    mjpegw_job* job = &ctx->jobs[ctx->submitted % ctx->job_count];
+    if (ctx->submitted >= ctx->job_count && job->repeat_of < 0)
+        update_rate_control(ctx, job->frame, job->quality, job->size);
+    return job;
+}
 
-    // fwrite by default. User-defined when using tje_encode_with_func.
-    TJEWriteContext write_context;
+//-----------------------------------------------------------------------------------------------------------------------------
+// [job] comes from next_free_job
+static void submit_job(mjpegw_context* ctx, mjpegw_job* job, const void* pixels, int stride, const int quality,
+                       const tje_huffman_spec* huffman)
+{
+    // packed and top-down whatever the stride is
+    size_t row_size = (size_t)ctx->width * 4;
+    for (uint32_t y = 0; y < ctx->height; y++)
+        memcpy(job->pixels + y * row_size, (const uint8_t*)pixels + (ptrdiff_t)y * stride, row_size);
+
+    pthread_mutex_lock(&ctx->lock);
+    job->frame = ctx->submitted++;
+    job->repeat_of = -1;
+    job->quality = quality;
+    job->has_huffman = huffman != NULL;
+    if (huffman)
+        job->huffman = *huffman;
+    job->state = JOB_QUEUED;
+    pthread_cond_signal(&ctx->job_ready);
+    pthread_mutex_unlock(&ctx->lock);
+}
 
-    // Buffered output. Big performance win when using the usual stdlib implementations.
-    size_t          output_buffer_count;
-    uint8_t         output_buffer[TJEI_BUFFER_SIZE];
-} TJEState;
+//-----------------------------------------------------------------------------------------------------------------------------
+// Takes a slot in the ring so the repeat is written in order, there's nothing to encode
+static void submit_repeat(mjpegw_context* ctx, uint32_t frame)
+{
+    mjpegw_job* job = next_free_job(ctx);
 
-// ============================================================
-// Table definitions.
-//
-// The spec defines tjei_default reasonably good quantization matrices and huffman
-// specification tables.
-//
-//
-// Instead of hard-coding the final huffman table, we only hard-code the table
-// spec suggested by the specification, and then derive the full table from
-// there.  This is only for didactic purposes but it might be useful if there
-// ever is the case that we need to swap huffman tables from various sources.
+    pthread_mutex_lock(&ctx->lock);
+    job->frame = ctx->submitted++;
+    job->repeat_of = (int32_t)frame;
+    job->state = JOB_DONE;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void free_jobs(mjpegw_context* ctx)
+{
+    for (uint32_t i = 0; i < ctx->job_count; i++)
+    {
+        if (ctx->jobs[i].pixels)
+            ctx->mem.free_fn(ctx->jobs[i].pixels, ctx->mem.user);
+        free_encoder(ctx, &ctx->jobs[i].jpeg, &ctx->jobs[i].encoder);
+    }
+
+    ctx->mem.free_fn(ctx->jobs, ctx->mem.user);
+    ctx->jobs = NULL;
+    ctx->job_count = 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Every submitted frame must have been written already
+static void stop_workers(mjpegw_context* ctx)
+{
+    pthread_mutex_lock(&ctx->lock);
+    ctx->stopping = 1;
+    pthread_cond_broadcast(&ctx->job_ready);
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (uint32_t i = 0; i < ctx->thread_count; i++)
+        pthread_join(ctx->threads[i], NULL);
+
+    pthread_cond_destroy(&ctx->job_done);
+    pthread_cond_destroy(&ctx->job_ready);
+    pthread_mutex_destroy(&ctx->lock);
+    ctx->thread_count = 0;
+    free_jobs(ctx);
+}
+
+#endif // MJPEGW_NO_THREADS
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static uint32_t count_cores(void)
+{
+#ifndef MJPEGW_NO_THREADS
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores > 0)
+        return (uint32_t)cores;
+#endif
+    return 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+uint32_t mjpegw_count_threads(void)
+{
+#ifdef MJPEGW_NO_THREADS
+    return 0;
+#else
+    uint32_t threads = count_cores();
+    return threads < MJPEGW_MAX_THREADS ? threads : MJPEGW_MAX_THREADS;
+#endif
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+int mjpegw_reserve_frames(mjpegw_context *ctx, uint32_t frames)
+{
+    assert(ctx);
+
+    if (frames <= ctx->chunk_capacity)
+        return 1;
+
+    mjpegw_chunk* new_chunks = ctx->mem.realloc_fn(ctx->chunks, sizeof(mjpegw_chunk) * ctx->chunk_capacity,
+                                                   sizeof(mjpegw_chunk) * frames, ctx->mem.user);
+    if (!new_chunks)
+        return 0;
+
+    ctx->chunks = new_chunks;
+    ctx->chunk_capacity = frames;
+    return 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+void mjpegw_set_huffman(mjpegw_context *ctx, mjpegw_huffman huffman, uint32_t sample_frames)
+{
+    assert(ctx);
+    assert(ctx->frame_count == 0);
+
+    ctx->huffman = huffman;
+    ctx->sample_frames = sample_frames ? sample_frames : 1;
+    ctx->frames_sampled = 0;
+    ctx->sample_stats = (tje_huffman_stats) {0};
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+void mjpegw_set_rate_control(mjpegw_context *ctx, uint32_t bitrate, uint32_t max_frame_size)
+{
+    assert(ctx);
+    assert(ctx->frame_count == 0);
+
+    ctx->target_bitrate = bitrate;
+    ctx->max_frame_size = max_frame_size;
+    ctx->rc_quality = 0.f;
+    ctx->rc_bytes = 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+uint32_t mjpegw_set_threads(mjpegw_context *ctx, uint32_t threads)
+{
+    assert(ctx);
+    assert(ctx->frame_count == 0);
+
+#ifdef MJPEGW_NO_THREADS
+    (void)threads;
+    return 0;
+#else
+    assert(ctx->thread_count == 0);
+
+    if (threads == 0)
+        threads = count_cores();
+    if (threads > MJPEGW_MAX_THREADS)
+        threads = MJPEGW_MAX_THREADS;
+
+    ctx->job_count = threads * MJPEGW_JOBS_PER_THREAD;
+    ctx->jobs = ctx->mem.malloc_fn(sizeof(mjpegw_job) * ctx->job_count, ctx->mem.user);
+    if (!ctx->jobs)
+    {
+        ctx->job_count = 0;
+        return 0;
+    }
+
+    int failed = 0;
+    for (uint32_t i = 0; i < ctx->job_count; i++)
+    {
+        ctx->jobs[i] = (mjpegw_job) { .state = JOB_FREE, .jpeg.mem = &ctx->mem };
+        ctx->jobs[i].pixels = ctx->mem.malloc_fn((size_t)ctx->width * ctx->height * 4, ctx->mem.user);
+        failed |= ctx->jobs[i].pixels == NULL;
+        failed |= !alloc_encoder(ctx, &ctx->jobs[i].jpeg, &ctx->jobs[i].encoder);
+    }
+    if (failed)
+    {
+        free_jobs(ctx);
+        return 0;
+    }
+
+    ctx->submitted = 0;
+    ctx->stopping = 0;
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->job_ready, NULL);
+    pthread_cond_init(&ctx->job_done, NULL);
+
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        if (pthread_create(&ctx->threads[ctx->thread_count], NULL, worker_main, ctx) != 0)
+            break;
+        ctx->thread_count++;
+    }
+
+    // no thread could be started, keep encoding synchronously
+    if (ctx->thread_count == 0)
+        stop_workers(ctx);
+
+    return ctx->thread_count;
+#endif
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+void mjpegw_add_frame(mjpegw_context *ctx, const void* pixels, int stride, int quality)
+{
+    if (stride == 0)
+        stride = (int)ctx->width * 4;
+
+#ifndef MJPEGW_NO_THREADS
+    // before the quality is chosen, the feedback of the frame leaving the ring comes in
+    mjpegw_job* job = ctx->thread_count ? next_free_job(ctx) : NULL;
+#endif
+
+    if (ctx->target_bitrate || ctx->max_frame_size)
+    {
+        // the given quality is the ceiling
+        if (ctx->rc_quality == 0.f || ctx->rc_quality > quality)
+            ctx->rc_quality = (float)quality;
+        quality = (int)lroundf(ctx->rc_quality);
+    }
+
+    const tje_huffman_spec* huffman = NULL;
+    if (ctx->huffman == MJPEGW_HUFFMAN_SAMPLED)
+    {
+        // the tables grow with every sampled frame and stay fixed afterwards
+        if (ctx->frames_sampled < ctx->sample_frames)
+        {
+            tje_gather_stats(&ctx->sample_stats, quality, ctx->subsampling, ctx->width, ctx->height, 4, stride, pixels);
+            tje_build_huffman(&ctx->sample_stats, 1, &ctx->sample_spec);
+            ctx->frames_sampled++;
+        }
+        huffman = &ctx->sample_spec;
+    }
+
+#ifndef MJPEGW_NO_THREADS
+    if (job)
+    {
+        submit_job(ctx, job, pixels, stride, quality, huffman);
+        return;
+    }
+#endif
+
+    if (!ctx->encoder && !alloc_encoder(ctx, &ctx->jpeg, &ctx->encoder))
+    {
+        free_encoder(ctx, &ctx->jpeg, &ctx->encoder);
+        return;
+    }
+
+    encode_frame_buffer(ctx, ctx->encoder, &ctx->jpeg, pixels, stride, quality, huffman);
+    uint32_t size = ctx->jpeg.size;
+    if (ctx->jpeg.overflow)
+        size = write_streamed_frame(ctx, ctx->encoder, pixels, stride, quality, huffman);
+    else
+        write_frame_chunk(ctx, &ctx->jpeg);
+    update_rate_control(ctx, ctx->frame_count - 1, quality, size);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+void mjpegw_repeat_frame(mjpegw_context *ctx, uint32_t frame)
+{
+    assert(ctx);
+
+#ifndef MJPEGW_NO_THREADS
+    if (ctx->thread_count)
+    {
+        assert(frame < ctx->submitted);
+        submit_repeat(ctx, frame);
+        return;
+    }
+#endif
+
+    write_repeated_frame(ctx, frame);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+void mjpegw_close(mjpegw_context *ctx)
+{
+    assert(ctx);
+
+#ifndef MJPEGW_NO_THREADS
+    if (ctx->thread_count)
+    {
+        write_encoded_jobs(ctx, 0);
+        stop_workers(ctx);
+    }
+#endif
+
+    end_riff(ctx);
+
+    // AVI 1.0 readers only see the first RIFF, the stream length and dmlh count every frame
+    patch_data(ctx, ctx->avih_pos + offsetof(avih_chunk, total_frames), &ctx->avi_frames, sizeof(uint32_t));
+    patch_data(ctx, ctx->strh_pos + offsetof(strh_chunk, length), &ctx->frame_count, sizeof(uint32_t));
+    patch_data(ctx, ctx->dmlh_pos + offsetof(dmlh_chunk, total_frames), &ctx->frame_count, sizeof(uint32_t));
+
+    ctx->indx.entries_in_use = ctx->riff_count;
+    patch_data(ctx, ctx->indx_pos, &ctx->indx, sizeof(ctx->indx));
+    patch_data(ctx, ctx->indx_pos + sizeof(ctx->indx), ctx->super_index, sizeof(indx_entry) * ctx->riff_count);
+
+    if (ctx->chunks)
+    {
+        ctx->mem.free_fn(ctx->chunks, ctx->mem.user);
+        ctx->chunks = NULL;
+        ctx->chunk_capacity = 0;
+    }
+
+    free_encoder(ctx, &ctx->jpeg, &ctx->encoder);
+
+    fclose(ctx->f);
+    ctx->mem.free_fn(ctx, ctx->mem.user);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// tiny_jpeg, code copied and stripped from https://github.com/serge-rgb/TinyJPEG
+//-----------------------------------------------------------------------------------------------------------------------------
+
+#define tjei_min(a, b) ((a) < b) ? (a) : (b);
+#define tjei_max(a, b) ((a) < b) ? (b) : (a);
+
+
+#if defined(_MSC_VER)
+#define TJEI_FORCE_INLINE __forceinline
+// #define TJEI_FORCE_INLINE __declspec(noinline)  // For profiling
+#else
+#define TJEI_FORCE_INLINE static // TODO: equivalent for gcc & clang
+#endif
+
+
+#define TJEI_BUFFER_SIZE 1024
+#define tje_log(msg)
+
+
+typedef struct
+{
+    void*           context;
+    tje_write_func* func;
+} TJEWriteContext;
+
+struct TJEProcessedQT
+{
+    float chroma[64];
+    float luma[64];
+};
+
+typedef struct
+{
+    // Huffman data.
+    uint8_t         ehuffsize[4][257];
+    uint16_t        ehuffcode[4][256];
+    uint8_t const * ht_bits[4];
+    uint8_t const * ht_vals[4];
+
+    // Cuantization tables.
+    uint8_t         qt_luma[64];
+    uint8_t         qt_chroma[64];
+    struct TJEProcessedQT pqt;
+
+    // fwrite by default. User-defined when using tje_encode_with_func.
+    TJEWriteContext write_context;
+
+    // Buffered output. Big performance win when using the usual stdlib implementations.
+    size_t          output_buffer_count;
+    uint8_t         output_buffer[TJEI_BUFFER_SIZE];
+
+    // Color conversion and DCT for the CPU, see tjei_select_kernels.
+    const struct TJEKernels* kernels;
+
+    // Luma blocks per MCU, across and down. 1x1 is 4:4:4, 2x1 4:2:2 and 2x2 4:2:0.
+    uint8_t         h_factor;
+    uint8_t         v_factor;
+
+    // When set, encoding only counts the huffman symbols, see tje_gather_stats.
+    tje_huffman_stats* stats;
+} TJEState;
+
+// ============================================================
+// Table definitions.
+//
+// The spec defines tjei_default reasonably good quantization matrices and huffman
+// specification tables.
+//
+//
+// Instead of hard-coding the final huffman table, we only hard-code the table
+// spec suggested by the specification, and then derive the full table from
+// there.  This is only for didactic purposes but it might be useful if there
+// ever is the case that we need to swap huffman tables from various sources.
 // ============================================================
 
 
@@ -873,6 +1898,16 @@ TJEI_FORCE_INLINE void tjei_write_bits(TJEState* state,
     }
 }
 
+// Fused multiply-adds round once where two operations round twice. They stay off from the DCT to the
+// kernels selection, so a build for a CPU with FMA (-march=native) still matches the vector kernels
+#if defined(__clang__)
+#pragma float_control(push)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
 // DCT implementation by Thomas G. Lane.
 // Obtained through NVIDIA
 //  http://developer.download.nvidia.com/SDK/9.5/Samples/vidimaging_samples.html#gpgpu_dct
@@ -993,21 +2028,46 @@ static void tjei_fdct (float * data)
     }
 }
 
-#define ABS(x) ((x) < 0 ? -(x) : (x))
+// ============================================================
+// Block kernels: color conversion and DCT + quantization.
+//
+// The vector versions run the same float operations in the same
+// order as the scalar code, one block row (or column) per lane, so
+// with IEEE single precision math the output is the scalar one bit
+// for bit. That holds on x86-64 (SSE2 and AVX2 paths), with fused
+// multiply-adds off (see above). NEON builds are only held to one
+// quantization step on a rounding edge. -ffast-math breaks both.
+// MJPEGW_NO_SIMD keeps the scalar kernels only. tests/mjpegw_kernels.c
+// checks every table the CPU runs.
+// ============================================================
 
-static void tjei_encode_and_write_MCU(TJEState* state,
-                                      float* mcu,
-                                      float* qt,  // Pre-processed quantization matrix.
-                                      uint8_t* huff_dc_len, uint16_t* huff_dc_code, // Huffman tables
-                                      uint8_t* huff_ac_len, uint16_t* huff_ac_code,
-                                      int* pred,  // Previous DC coefficient
-                                      uint32_t* bitbuffer,  // Bitstack.
-                                      uint32_t* location)
+typedef struct TJEKernels
 {
-    int du[64];  // Data unit in zig-zag order
+    // 64 pixels of a block (R8G8B8A8, row major) to Y, Cb and Cr, luma centered on 0
+    void (*rgba_to_ycbcr)(const uint8_t* rgba, float* y, float* cb, float* cr);
+    // forward DCT of a block quantized by the processed qt and rounded, natural order
+    void (*fdct_quantize)(const float* block, const float* qt, int* out);
+    // box filter of 2 (v_factor 2: 4) blocks side by side into one, 2x1 or 2x2 samples per output
+    void (*downsample)(const float* blocks, int v_factor, float* out);
+} TJEKernels;
+
+static void tjei_rgba_to_ycbcr_scalar(const uint8_t* rgba, float* y, float* cb, float* cr)
+{
+    for ( int i = 0; i < 64; ++i ) {
+        uint8_t r = rgba[i*4 + 0];
+        uint8_t g = rgba[i*4 + 1];
+        uint8_t b = rgba[i*4 + 2];
 
+        y[i]  = 0.299f   * r + 0.587f    * g + 0.114f    * b - 128;
+        cb[i] = -0.1687f * r - 0.3313f   * g + 0.5f      * b;
+        cr[i] = 0.5f     * r - 0.4187f   * g - 0.0813f   * b;
+    }
+}
+
+static void tjei_fdct_quantize_scalar(const float* block, const float* qt, int* out)
+{
     float dct_mcu[64];
-    memcpy(dct_mcu, mcu, 64 * sizeof(float));
+    memcpy(dct_mcu, block, 64 * sizeof(float));
 
     tjei_fdct(dct_mcu);
     for ( int i = 0; i < 64; ++i ) {
@@ -1015,66 +2075,472 @@ static void tjei_encode_and_write_MCU(TJEState* state,
         fval *= qt[i];
         fval = floorf(fval + 1024 + 0.5f);
         fval -= 1024;
-        int val = (int)fval;
-        du[tjei_zig_zag[i]] = val;
-    }
-
-    uint16_t vli[2];
-
-    // Encode DC coefficient.
-    int diff = du[0] - *pred;
-    *pred = du[0];
-    if ( diff != 0 ) {
-        tjei_calculate_variable_length_int(diff, vli);
-        // Write number of bits with Huffman coding
-        tjei_write_bits(state, bitbuffer, location, huff_dc_len[vli[1]], huff_dc_code[vli[1]]);
-        // Write the bits.
-        tjei_write_bits(state, bitbuffer, location, vli[1], vli[0]);
-    } else {
-        tjei_write_bits(state, bitbuffer, location, huff_dc_len[0], huff_dc_code[0]);
-    }
-
-    // ==== Encode AC coefficients ====
-
-    int last_non_zero_i = 0;
-    // Find the last non-zero element.
-    for ( int i = 63; i > 0; --i ) {
-        if (du[i] != 0) {
-            last_non_zero_i = i;
-            break;
-        }
+        out[i] = (int)fval;
     }
+}
 
-    for ( int i = 1; i <= last_non_zero_i; ++i ) {
-        // If zero, increase count. If >=15, encode (FF,00)
-        int zero_count = 0;
-        while ( du[i] == 0 ) {
-            ++zero_count;
-            ++i;
-            if (zero_count == 16) {
-                // encode (ff,00) == 0xf0
-                tjei_write_bits(state, bitbuffer, location, huff_ac_len[0xf0], huff_ac_code[0xf0]);
-                zero_count = 0;
+// blocks holds the 8x8 blocks of the MCU one after the other, left to right and top to bottom
+static void tjei_downsample_scalar(const float* blocks, int v_factor, float* out)
+{
+    const float scale = v_factor == 2 ? 0.25f : 0.5f;
+    for ( int y = 0; y < 8; ++y ) {
+        for ( int half = 0; half < 2; ++half ) {
+            const float* row = blocks + ((y * v_factor / 8) * 2 + half) * 64 + ((y * v_factor) % 8) * 8;
+            for ( int i = 0; i < 4; ++i ) {
+                float sum = row[2*i] + row[2*i + 1];
+                if (v_factor == 2) {
+                    sum = sum + (row[8 + 2*i] + row[8 + 2*i + 1]);
+                }
+                out[y*8 + half*4 + i] = sum * scale;
             }
         }
-        tjei_calculate_variable_length_int(du[i], vli);
+    }
+}
 
-        assert(zero_count < 0x10);
-        assert(vli[1] <= 10);
+static const TJEKernels tjei_kernels_scalar = { tjei_rgba_to_ycbcr_scalar, tjei_fdct_quantize_scalar, tjei_downsample_scalar };
 
-        uint16_t sym1 = (uint16_t)((uint16_t)zero_count << 4) | vli[1];
+#if !defined(MJPEGW_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TJEI_SIMD_X86
+#include <immintrin.h>
+#elif !defined(MJPEGW_NO_SIMD) && defined(__ARM_NEON)
+#define TJEI_SIMD_NEON
+#include <arm_neon.h>
+#endif
 
-        assert(huff_ac_len[sym1] != 0);
+// One pass of tjei_fdct over d[0..7], every lane is a row (or a column) of its own
+#define TJEI_FDCT_PASS(T, d, ADD, SUB, MUL, SPLAT) do {             \
+        T tmp0 = ADD(d[0], d[7]);                                   \
+        T tmp7 = SUB(d[0], d[7]);                                   \
+        T tmp1 = ADD(d[1], d[6]);                                   \
+        T tmp6 = SUB(d[1], d[6]);                                   \
+        T tmp2 = ADD(d[2], d[5]);                                   \
+        T tmp5 = SUB(d[2], d[5]);                                   \
+        T tmp3 = ADD(d[3], d[4]);                                   \
+        T tmp4 = SUB(d[3], d[4]);                                   \
+                                                                    \
+        T tmp10 = ADD(tmp0, tmp3);                                  \
+        T tmp13 = SUB(tmp0, tmp3);                                  \
+        T tmp11 = ADD(tmp1, tmp2);                                  \
+        T tmp12 = SUB(tmp1, tmp2);                                  \
+                                                                    \
+        d[0] = ADD(tmp10, tmp11);                                   \
+        d[4] = SUB(tmp10, tmp11);                                   \
+                                                                    \
+        T z1 = MUL(ADD(tmp12, tmp13), SPLAT(0.707106781f));         \
+        d[2] = ADD(tmp13, z1);                                      \
+        d[6] = SUB(tmp13, z1);                                      \
+                                                                    \
+        tmp10 = ADD(tmp4, tmp5);                                    \
+        tmp11 = ADD(tmp5, tmp6);                                    \
+        tmp12 = ADD(tmp6, tmp7);                                    \
+                                                                    \
+        T z5 = MUL(SUB(tmp10, tmp12), SPLAT(0.382683433f));         \
+        T z2 = ADD(MUL(SPLAT(0.541196100f), tmp10), z5);            \
+        T z4 = ADD(MUL(SPLAT(1.306562965f), tmp12), z5);            \
+        T z3 = MUL(tmp11, SPLAT(0.707106781f));                     \
+                                                                    \
+        T z11 = ADD(tmp7, z3);                                      \
+        T z13 = SUB(tmp7, z3);                                      \
+                                                                    \
+        d[5] = ADD(z13, z2);                                        \
+        d[3] = SUB(z13, z2);                                        \
+        d[1] = ADD(z11, z4);                                        \
+        d[7] = SUB(z11, z4);                                        \
+    } while (0)
+
+// ==== 4 lanes: SSE2 or NEON ====
+
+#if defined(TJEI_SIMD_X86)
+
+typedef __m128 tjei_v4;
+#define TJEI_V4_TARGET          __attribute__((target("sse2")))
+#define tjei_v4_load            _mm_loadu_ps
+#define tjei_v4_store           _mm_storeu_ps
+#define tjei_v4_add             _mm_add_ps
+#define tjei_v4_sub             _mm_sub_ps
+#define tjei_v4_mul             _mm_mul_ps
+#define tjei_v4_splat           _mm_set1_ps
+
+static inline TJEI_V4_TARGET void tjei_v4_transpose(tjei_v4* v)
+{
+    _MM_TRANSPOSE4_PS(v[0], v[1], v[2], v[3]);
+}
+
+// floor(v*qt + 0.5), truncation corrected where it rounded up
+static inline TJEI_V4_TARGET void tjei_v4_quantize(tjei_v4 v, tjei_v4 qt, int* out)
+{
+    __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v, qt), _mm_set1_ps(1024)), _mm_set1_ps(0.5f));
+    __m128i t = _mm_cvttps_epi32(x);
+    __m128i above = _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(t), x));
+    t = _mm_add_epi32(t, above);
+    _mm_storeu_si128((__m128i*)out, _mm_sub_epi32(t, _mm_set1_epi32(1024)));
+}
+
+// a0+a1, a2+a3, b0+b1, b2+b3
+static inline TJEI_V4_TARGET tjei_v4 tjei_v4_pairsum(tjei_v4 a, tjei_v4 b)
+{
+    return _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+static inline TJEI_V4_TARGET void tjei_v4_rgba(const uint8_t* rgba, tjei_v4* r, tjei_v4* g, tjei_v4* b)
+{
+    __m128i px = _mm_loadu_si128((const __m128i*)rgba);
+    __m128i mask = _mm_set1_epi32(0xff);
+    *r = _mm_cvtepi32_ps(_mm_and_si128(px, mask));
+    *g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), mask));
+    *b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), mask));
+}
+
+#elif defined(TJEI_SIMD_NEON)
+
+typedef float32x4_t tjei_v4;
+#define TJEI_V4_TARGET
+#define tjei_v4_load            vld1q_f32
+#define tjei_v4_store           vst1q_f32
+#define tjei_v4_add             vaddq_f32
+#define tjei_v4_sub             vsubq_f32
+#define tjei_v4_mul             vmulq_f32
+#define tjei_v4_splat           vdupq_n_f32
+
+static inline void tjei_v4_transpose(tjei_v4* v)
+{
+    float32x4x2_t t01 = vtrnq_f32(v[0], v[1]);
+    float32x4x2_t t23 = vtrnq_f32(v[2], v[3]);
+    v[0] = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+    v[1] = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+    v[2] = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+    v[3] = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+}
+
+static inline void tjei_v4_quantize(tjei_v4 v, tjei_v4 qt, int* out)
+{
+    float32x4_t x = vaddq_f32(vaddq_f32(vmulq_f32(v, qt), vdupq_n_f32(1024)), vdupq_n_f32(0.5f));
+    int32x4_t t = vcvtq_s32_f32(x);
+    uint32x4_t above = vcgtq_f32(vcvtq_f32_s32(t), x);
+    t = vaddq_s32(t, vreinterpretq_s32_u32(above));
+    vst1q_s32(out, vsubq_s32(t, vdupq_n_s32(1024)));
+}
+
+static inline tjei_v4 tjei_v4_pairsum(tjei_v4 a, tjei_v4 b)
+{
+    float32x4x2_t even_odd = vuzpq_f32(a, b);
+    return vaddq_f32(even_odd.val[0], even_odd.val[1]);
+}
+
+static inline void tjei_v4_rgba(const uint8_t* rgba, tjei_v4* r, tjei_v4* g, tjei_v4* b)
+{
+    uint32x4_t px = vreinterpretq_u32_u8(vld1q_u8(rgba));
+    uint32x4_t mask = vdupq_n_u32(0xff);
+    *r = vcvtq_f32_u32(vandq_u32(px, mask));
+    *g = vcvtq_f32_u32(vandq_u32(vshrq_n_u32(px, 8), mask));
+    *b = vcvtq_f32_u32(vandq_u32(vshrq_n_u32(px, 16), mask));
+}
+
+#endif
+
+#if defined(TJEI_SIMD_X86) || defined(TJEI_SIMD_NEON)
+
+static TJEI_V4_TARGET void tjei_rgba_to_ycbcr_v4(const uint8_t* rgba, float* y, float* cb, float* cr)
+{
+    for ( int i = 0; i < 64; i += 4 ) {
+        tjei_v4 r, g, b;
+        tjei_v4_rgba(rgba + i*4, &r, &g, &b);
+
+        tjei_v4 luma = tjei_v4_add(tjei_v4_mul(tjei_v4_splat(0.299f), r), tjei_v4_mul(tjei_v4_splat(0.587f), g));
+        luma = tjei_v4_sub(tjei_v4_add(luma, tjei_v4_mul(tjei_v4_splat(0.114f), b)), tjei_v4_splat(128));
+        tjei_v4 blue = tjei_v4_sub(tjei_v4_mul(tjei_v4_splat(-0.1687f), r), tjei_v4_mul(tjei_v4_splat(0.3313f), g));
+        blue = tjei_v4_add(blue, tjei_v4_mul(tjei_v4_splat(0.5f), b));
+        tjei_v4 red = tjei_v4_sub(tjei_v4_mul(tjei_v4_splat(0.5f), r), tjei_v4_mul(tjei_v4_splat(0.4187f), g));
+        red = tjei_v4_sub(red, tjei_v4_mul(tjei_v4_splat(0.0813f), b));
+
+        tjei_v4_store(y + i, luma);
+        tjei_v4_store(cb + i, blue);
+        tjei_v4_store(cr + i, red);
+    }
+}
+
+static TJEI_V4_TARGET void tjei_fdct_pass_v4(tjei_v4* d)
+{
+    TJEI_FDCT_PASS(tjei_v4, d, tjei_v4_add, tjei_v4_sub, tjei_v4_mul, tjei_v4_splat);
+}
+
+// The block is two halves of 4 columns. Transposing it turns the rows pass of tjei_fdct into
+// a columns pass, which is the one that maps to lanes.
+static TJEI_V4_TARGET void tjei_fdct_quantize_v4(const float* block, const float* qt, int* out)
+{
+    tjei_v4 l[8], r[8];  // columns 0-3 and 4-7 of every row
+    tjei_v4 tl[8], tr[8];  // rows 0-3 and 4-7 of every column
+    for ( int k = 0; k < 8; ++k ) {
+        l[k] = tjei_v4_load(block + k*8);
+        r[k] = tjei_v4_load(block + k*8 + 4);
+    }
+
+    for ( int k = 0; k < 4; ++k ) {
+        tl[k] = l[k];
+        tl[k + 4] = r[k];
+        tr[k] = l[k + 4];
+        tr[k + 4] = r[k + 4];
+    }
+    tjei_v4_transpose(tl);
+    tjei_v4_transpose(tl + 4);
+    tjei_v4_transpose(tr);
+    tjei_v4_transpose(tr + 4);
+
+    // Pass 1: process rows.
+    tjei_fdct_pass_v4(tl);
+    tjei_fdct_pass_v4(tr);
+
+    for ( int k = 0; k < 4; ++k ) {
+        l[k] = tl[k];
+        r[k] = tl[k + 4];
+        l[k + 4] = tr[k];
+        r[k + 4] = tr[k + 4];
+    }
+    tjei_v4_transpose(l);
+    tjei_v4_transpose(l + 4);
+    tjei_v4_transpose(r);
+    tjei_v4_transpose(r + 4);
+
+    // Pass 2: process columns.
+    tjei_fdct_pass_v4(l);
+    tjei_fdct_pass_v4(r);
+
+    for ( int k = 0; k < 8; ++k ) {
+        tjei_v4_quantize(l[k], tjei_v4_load(qt + k*8), out + k*8);
+        tjei_v4_quantize(r[k], tjei_v4_load(qt + k*8 + 4), out + k*8 + 4);
+    }
+}
+
+// Every output row is a pair sum of 8 floats per half, the same additions as the scalar filter
+static TJEI_V4_TARGET void tjei_downsample_v4(const float* blocks, int v_factor, float* out)
+{
+    const tjei_v4 scale = tjei_v4_splat(v_factor == 2 ? 0.25f : 0.5f);
+    for ( int y = 0; y < 8; ++y ) {
+        for ( int half = 0; half < 2; ++half ) {
+            const float* row = blocks + ((y * v_factor / 8) * 2 + half) * 64 + ((y * v_factor) % 8) * 8;
+            tjei_v4 sum = tjei_v4_pairsum(tjei_v4_load(row), tjei_v4_load(row + 4));
+            if (v_factor == 2) {
+                sum = tjei_v4_add(sum, tjei_v4_pairsum(tjei_v4_load(row + 8), tjei_v4_load(row + 12)));
+            }
+            tjei_v4_store(out + y*8 + half*4, tjei_v4_mul(sum, scale));
+        }
+    }
+}
+
+static const TJEKernels tjei_kernels_v4 = { tjei_rgba_to_ycbcr_v4, tjei_fdct_quantize_v4, tjei_downsample_v4 };
+
+#endif
+
+// ==== 8 lanes: AVX2 ====
+
+#if defined(TJEI_SIMD_X86)
+
+#define TJEI_AVX2_TARGET        __attribute__((target("avx2")))
+
+static inline TJEI_AVX2_TARGET __m256 tjei_v8_splat(float f)
+{
+    return _mm256_set1_ps(f);
+}
+
+static inline TJEI_AVX2_TARGET void tjei_v8_transpose(__m256* v)
+{
+    __m256 t0 = _mm256_unpacklo_ps(v[0], v[1]);
+    __m256 t1 = _mm256_unpackhi_ps(v[0], v[1]);
+    __m256 t2 = _mm256_unpacklo_ps(v[2], v[3]);
+    __m256 t3 = _mm256_unpackhi_ps(v[2], v[3]);
+    __m256 t4 = _mm256_unpacklo_ps(v[4], v[5]);
+    __m256 t5 = _mm256_unpackhi_ps(v[4], v[5]);
+    __m256 t6 = _mm256_unpacklo_ps(v[6], v[7]);
+    __m256 t7 = _mm256_unpackhi_ps(v[6], v[7]);
+
+    __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+    v[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    v[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    v[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    v[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    v[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    v[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    v[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    v[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+static TJEI_AVX2_TARGET void tjei_rgba_to_ycbcr_avx2(const uint8_t* rgba, float* y, float* cb, float* cr)
+{
+    __m256i mask = _mm256_set1_epi32(0xff);
+    for ( int i = 0; i < 64; i += 8 ) {
+        __m256i px = _mm256_loadu_si256((const __m256i*)(rgba + i*4));
+        __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(px, mask));
+        __m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 8), mask));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 16), mask));
+
+        __m256 luma = _mm256_add_ps(_mm256_mul_ps(tjei_v8_splat(0.299f), r), _mm256_mul_ps(tjei_v8_splat(0.587f), g));
+        luma = _mm256_sub_ps(_mm256_add_ps(luma, _mm256_mul_ps(tjei_v8_splat(0.114f), b)), tjei_v8_splat(128));
+        __m256 blue = _mm256_sub_ps(_mm256_mul_ps(tjei_v8_splat(-0.1687f), r), _mm256_mul_ps(tjei_v8_splat(0.3313f), g));
+        blue = _mm256_add_ps(blue, _mm256_mul_ps(tjei_v8_splat(0.5f), b));
+        __m256 red = _mm256_sub_ps(_mm256_mul_ps(tjei_v8_splat(0.5f), r), _mm256_mul_ps(tjei_v8_splat(0.4187f), g));
+        red = _mm256_sub_ps(red, _mm256_mul_ps(tjei_v8_splat(0.0813f), b));
+
+        _mm256_storeu_ps(y + i, luma);
+        _mm256_storeu_ps(cb + i, blue);
+        _mm256_storeu_ps(cr + i, red);
+    }
+}
+
+static TJEI_AVX2_TARGET void tjei_fdct_pass_avx2(__m256* d)
+{
+    TJEI_FDCT_PASS(__m256, d, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, tjei_v8_splat);
+}
+
+// One row per vector, transposed for the rows pass and back for the columns one
+static TJEI_AVX2_TARGET void tjei_fdct_quantize_avx2(const float* block, const float* qt, int* out)
+{
+    __m256 v[8];
+    for ( int k = 0; k < 8; ++k ) {
+        v[k] = _mm256_loadu_ps(block + k*8);
+    }
+
+    tjei_v8_transpose(v);
+    tjei_fdct_pass_avx2(v);
+    tjei_v8_transpose(v);
+    tjei_fdct_pass_avx2(v);
+
+    for ( int k = 0; k < 8; ++k ) {
+        __m256 x = _mm256_mul_ps(v[k], _mm256_loadu_ps(qt + k*8));
+        x = _mm256_add_ps(_mm256_add_ps(x, tjei_v8_splat(1024)), tjei_v8_splat(0.5f));
+        __m256i t = _mm256_cvttps_epi32(x);
+        __m256i above = _mm256_castps_si256(_mm256_cmp_ps(_mm256_cvtepi32_ps(t), x, _CMP_GT_OQ));
+        t = _mm256_add_epi32(t, above);
+        _mm256_storeu_si256((__m256i*)(out + k*8), _mm256_sub_epi32(t, _mm256_set1_epi32(1024)));
+    }
+}
+
+// the filter is light next to the DCT, it keeps the 4 lanes version
+static const TJEKernels tjei_kernels_avx2 = { tjei_rgba_to_ycbcr_avx2, tjei_fdct_quantize_avx2, tjei_downsample_v4 };
+
+#endif
+
+// The widest kernels the CPU runs
+static const TJEKernels* tjei_select_kernels(void)
+{
+#if defined(TJEI_SIMD_X86)
+    if (__builtin_cpu_supports("avx2")) {
+        return &tjei_kernels_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return &tjei_kernels_v4;
+    }
+#elif defined(TJEI_SIMD_NEON)
+    return &tjei_kernels_v4;
+#endif
+    return &tjei_kernels_scalar;
+}
+
+#if defined(__clang__)
+#pragma float_control(pop)
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#define ABS(x) ((x) < 0 ? -(x) : (x))
+
+// Huffman coded symbol. In the statistics pass (freq set) it's only counted.
+TJEI_FORCE_INLINE void tjei_write_symbol(TJEState* state,
+                                         uint32_t* bitbuffer, uint32_t* location,
+                                         uint8_t* huff_len, uint16_t* huff_code,
+                                         uint32_t* freq, uint16_t symbol)
+{
+    if (freq) {
+        freq[symbol]++;
+        return;
+    }
+    assert(huff_len[symbol] != 0);
+    tjei_write_bits(state, bitbuffer, location, huff_len[symbol], huff_code[symbol]);
+}
+
+static void tjei_encode_and_write_MCU(TJEState* state,
+                                      float* mcu,
+                                      float* qt,  // Pre-processed quantization matrix.
+                                      uint8_t* huff_dc_len, uint16_t* huff_dc_code, // Huffman tables
+                                      uint8_t* huff_ac_len, uint16_t* huff_ac_code,
+                                      uint32_t* dc_freq, uint32_t* ac_freq, // Symbol counts, NULL when writing
+                                      int* pred,  // Previous DC coefficient
+                                      uint32_t* bitbuffer,  // Bitstack.
+                                      uint32_t* location)
+{
+    int du[64];  // Data unit in zig-zag order
+
+    int values[64];
+    state->kernels->fdct_quantize(mcu, qt, values);
+    for ( int i = 0; i < 64; ++i ) {
+        du[tjei_zig_zag[i]] = values[i];
+    }
+
+    uint16_t vli[2];
+
+    // Encode DC coefficient.
+    int diff = du[0] - *pred;
+    *pred = du[0];
+    if ( diff != 0 ) {
+        tjei_calculate_variable_length_int(diff, vli);
+        // Write number of bits with Huffman coding
+        tjei_write_symbol(state, bitbuffer, location, huff_dc_len, huff_dc_code, dc_freq, vli[1]);
+        // Write the bits.
+        if (!dc_freq) {
+            tjei_write_bits(state, bitbuffer, location, vli[1], vli[0]);
+        }
+    } else {
+        tjei_write_symbol(state, bitbuffer, location, huff_dc_len, huff_dc_code, dc_freq, 0);
+    }
+
+    // ==== Encode AC coefficients ====
+
+    int last_non_zero_i = 0;
+    // Find the last non-zero element.
+    for ( int i = 63; i > 0; --i ) {
+        if (du[i] != 0) {
+            last_non_zero_i = i;
+            break;
+        }
+    }
+
+    for ( int i = 1; i <= last_non_zero_i; ++i ) {
+        // If zero, increase count. If >=15, encode (FF,00)
+        int zero_count = 0;
+        while ( du[i] == 0 ) {
+            ++zero_count;
+            ++i;
+            if (zero_count == 16) {
+                // encode (ff,00) == 0xf0
+                tjei_write_symbol(state, bitbuffer, location, huff_ac_len, huff_ac_code, ac_freq, 0xf0);
+                zero_count = 0;
+            }
+        }
+        tjei_calculate_variable_length_int(du[i], vli);
+
+        assert(zero_count < 0x10);
+        assert(vli[1] <= 10);
+
+        uint16_t sym1 = (uint16_t)((uint16_t)zero_count << 4) | vli[1];
 
         // Write symbol 1  --- (RUNLENGTH, SIZE)
-        tjei_write_bits(state, bitbuffer, location, huff_ac_len[sym1], huff_ac_code[sym1]);
+        tjei_write_symbol(state, bitbuffer, location, huff_ac_len, huff_ac_code, ac_freq, sym1);
         // Write symbol 2  --- (AMPLITUDE)
-        tjei_write_bits(state, bitbuffer, location, vli[1], vli[0]);
+        if (!ac_freq) {
+            tjei_write_bits(state, bitbuffer, location, vli[1], vli[0]);
+        }
     }
 
     if (last_non_zero_i != 63) {
         // write EOB HUFF(00,00)
-        tjei_write_bits(state, bitbuffer, location, huff_ac_len[0], huff_ac_code[0]);
+        tjei_write_symbol(state, bitbuffer, location, huff_ac_len, huff_ac_code, ac_freq, 0);
     }
     return;
 }
@@ -1086,14 +2552,8 @@ enum {
     TJEI_CHROMA_AC,
 };
 
-struct TJEProcessedQT
-{
-    float chroma[64];
-    float luma[64];
-};
-
-// Set up huffman tables in state.
-static void tjei_huff_expand(TJEState* state)
+// Set up huffman tables in state, the spec ones unless huffman is given (it must outlive state).
+static void tjei_huff_expand(TJEState* state, const tje_huffman_spec* huffman)
 {
     assert(state);
 
@@ -1107,6 +2567,13 @@ static void tjei_huff_expand(TJEState* state)
     state->ht_vals[TJEI_CHROMA_DC] = tjei_default_ht_chroma_dc;
     state->ht_vals[TJEI_CHROMA_AC] = tjei_default_ht_chroma_ac;
 
+    if (huffman) {
+        for ( int i = 0; i < 4; ++i ) {
+            state->ht_bits[i] = huffman->bits[i];
+            state->ht_vals[i] = huffman->vals[i];
+        }
+    }
+
     // How many codes in total for each of LUMA_(DC|AC) and CHROMA_(DC|AC)
     int32_t spec_tables_len[4] = { 0 };
 
@@ -1134,21 +2601,132 @@ static void tjei_huff_expand(TJEState* state)
     }
 }
 
-static int tjei_encode_main(TJEState* state,
-                            const unsigned char* src_data,
-                            const int width,
-                            const int height,
-                            const int src_num_components)
+// Code lengths for the counts, at most 16 bits and never all ones (JPEG Annex K.2, as libjpeg does it)
+static void tjei_huff_optimal(const uint32_t* counts, int keep_all, TJEHuffmanTableClass ht_class,
+                              uint8_t* bits, uint8_t* vals)
 {
-    if (src_num_components != 3 && src_num_components != 4) {
-        return 0;
+    int64_t freq[257];
+    int codesize[257];
+    int others[257];
+
+    int used = 0;
+    for ( int i = 0; i < 256; ++i ) {
+        freq[i] = counts[i];
+        if (keep_all) {
+            int valid = ht_class == TJEI_DC ? i < 12 : (i == 0x00 || i == 0xf0 || ((i & 0x0f) >= 1 && (i & 0x0f) <= 10));
+            freq[i] += valid;
+        }
+        used |= freq[i] > 0;
     }
+    if (!used) {
+        freq[0] = 1;
+    }
+    freq[256] = 1;  // reserved, takes the all ones code
 
-    if (width > 0xffff || height > 0xffff) {
-        return 0;
+    for ( int i = 0; i < 257; ++i ) {
+        codesize[i] = 0;
+        others[i] = -1;
     }
 
-    struct TJEProcessedQT pqt;
+    // Join the two least frequent trees until one is left
+    for (;;) {
+        int c1 = -1;
+        int64_t v = INT64_MAX;
+        for ( int i = 0; i < 257; ++i ) {
+            if (freq[i] && freq[i] <= v) {
+                v = freq[i];
+                c1 = i;
+            }
+        }
+
+        int c2 = -1;
+        v = INT64_MAX;
+        for ( int i = 0; i < 257; ++i ) {
+            if (freq[i] && freq[i] <= v && i != c1) {
+                v = freq[i];
+                c2 = i;
+            }
+        }
+
+        if (c2 < 0) {
+            break;
+        }
+
+        freq[c1] += freq[c2];
+        freq[c2] = 0;
+
+        codesize[c1]++;
+        while (others[c1] >= 0) {
+            c1 = others[c1];
+            codesize[c1]++;
+        }
+        others[c1] = c2;
+
+        codesize[c2]++;
+        while (others[c2] >= 0) {
+            c2 = others[c2];
+            codesize[c2]++;
+        }
+    }
+
+    int count[258] = { 0 };
+    int max_size = 0;
+    for ( int i = 0; i < 257; ++i ) {
+        if (codesize[i]) {
+            count[codesize[i]]++;
+            if (codesize[i] > max_size) {
+                max_size = codesize[i];
+            }
+        }
+    }
+
+    // Move the codes longer than 16 bits up, a pair at a time
+    for ( int i = max_size; i > 16; --i ) {
+        while (count[i] > 0) {
+            int j = i - 2;
+            while (count[j] == 0) {
+                --j;
+            }
+            count[i] -= 2;
+            count[i - 1]++;
+            count[j + 1] += 2;
+            count[j]--;
+        }
+    }
+
+    // Drop the reserved symbol from the longest codes
+    int longest = 16;
+    while (count[longest] == 0) {
+        --longest;
+    }
+    count[longest]--;
+
+    for ( int i = 0; i < 16; ++i ) {
+        bits[i] = (uint8_t)count[i + 1];
+    }
+
+    // Symbols by their original length, the longest codes go to the least frequent ones
+    memset(vals, 0, 256);
+    int k = 0;
+    for ( int size = 1; size <= max_size; ++size ) {
+        for ( int i = 0; i < 256; ++i ) {
+            if (codesize[i] == size) {
+                vals[k++] = (uint8_t)i;
+            }
+        }
+    }
+}
+
+void tje_build_huffman(const tje_huffman_stats* stats, int keep_all, tje_huffman_spec* spec)
+{
+    for ( int i = 0; i < 4; ++i ) {
+        TJEHuffmanTableClass ht_class = (i == TJEI_LUMA_DC || i == TJEI_CHROMA_DC) ? TJEI_DC : TJEI_AC;
+        tjei_huff_optimal(stats->freq[i], keep_all, ht_class, spec->bits[i], spec->vals[i]);
+    }
+}
+
+static void tjei_build_processed_qt(const TJEState* state, struct TJEProcessedQT* pqt)
+{
     // Again, taken from classic japanese implementation.
     //
     /* For float AA&N IDCT method, divisors are equal to quantization
@@ -1168,11 +2746,24 @@ static int tjei_encode_main(TJEState* state,
     for(int y=0; y<8; y++) {
         for(int x=0; x<8; x++) {
             int i = y*8 + x;
-            pqt.luma[y*8+x] = 1.0f / (8 * aan_scales[x] * aan_scales[y] * state->qt_luma[tjei_zig_zag[i]]);
-            pqt.chroma[y*8+x] = 1.0f / (8 * aan_scales[x] * aan_scales[y] * state->qt_chroma[tjei_zig_zag[i]]);
+            pqt->luma[y*8+x] = 1.0f / (8 * aan_scales[x] * aan_scales[y] * state->qt_luma[tjei_zig_zag[i]]);
+            pqt->chroma[y*8+x] = 1.0f / (8 * aan_scales[x] * aan_scales[y] * state->qt_chroma[tjei_zig_zag[i]]);
         }
     }
+}
+
+static void tjei_flush(TJEState* state)
+{
+    if (state->output_buffer_count) {
+        state->write_context.func(state->write_context.context, state->output_buffer, (int)state->output_buffer_count);
+        state->output_buffer_count = 0;
+    }
+}
 
+// Everything before the entropy coded data. A restart_interval (in MCUs) other than 0 adds a DRI
+// segment, the scan must then have a RSTn marker after every restart_interval MCUs.
+static void tjei_write_headers(TJEState* state, const int width, const int height, const uint16_t restart_interval)
+{
     { // Write header
         TJEJPEGHeader header;
         // JFIF header.
@@ -1222,7 +2813,8 @@ static int tjei_encode_main(TJEState* state,
         for (int i = 0; i < 3; ++i) {
             TJEComponentSpec spec;
             spec.component_id = (uint8_t)(i + 1);  // No particular reason. Just 1, 2, 3.
-            spec.sampling_factors = (uint8_t)0x11;
+            // Chroma is subsampled by having luma sampled more often
+            spec.sampling_factors = i == 0 ? (uint8_t)((state->h_factor << 4) | state->v_factor) : (uint8_t)0x11;
             spec.qt = tables[i];
 
             header.component_spec[i] = spec;
@@ -1236,6 +2828,11 @@ static int tjei_encode_main(TJEState* state,
     tjei_write_DHT(state, state->ht_bits[TJEI_CHROMA_DC], state->ht_vals[TJEI_CHROMA_DC], TJEI_DC, 1);
     tjei_write_DHT(state, state->ht_bits[TJEI_CHROMA_AC], state->ht_vals[TJEI_CHROMA_AC], TJEI_AC, 1);
 
+    if (restart_interval) {  // Write the restart interval.
+        uint16_t DRI[3] = { tjei_be_word(0xffdd), tjei_be_word(4), tjei_be_word(restart_interval) };
+        tjei_write(state, DRI, sizeof(uint16_t), 3);
+    }
+
     // Write start of scan
     {
         TJEScanHeader header;
@@ -1262,9 +2859,64 @@ static int tjei_encode_main(TJEState* state,
         tjei_write(state, &header, sizeof(TJEScanHeader), 1);
 
     }
-    // Write compressed data.
+}
+
+// Copies the 8x8 block at x, y as R8G8B8A8, edge pixels are repeated past the image borders
+static void tjei_gather_block(const unsigned char* src_data,
+                              const int width,
+                              const int height,
+                              const int src_num_components,
+                              const int stride,
+                              const int x,
+                              const int y,
+                              uint8_t* block)
+{
+    for ( int off_y = 0; off_y < 8; ++off_y ) {
+        int row = y + off_y < height ? y + off_y : height - 1;
+        const unsigned char* line = src_data + (ptrdiff_t)row * stride;
 
-    float du_y[64];
+        if (src_num_components == 4 && x + 8 <= width) {
+            memcpy(block + off_y * 32, line + x * 4, 32);
+            continue;
+        }
+        for ( int off_x = 0; off_x < 8; ++off_x ) {
+            int col = x + off_x < width ? x + off_x : width - 1;
+            memcpy(block + (off_y * 8 + off_x) * 4, line + col * src_num_components, 3);
+        }
+    }
+}
+
+// Entropy codes the MCU rows [first_row, end_row), each 8 * v_factor pixels tall. The rows are independent from the rest of the
+// image, DC predictions start from 0 and the last byte is padded, so they can be one restart interval.
+static void tjei_encode_rows(TJEState* state,
+                             const unsigned char* src_data,
+                             const int width,
+                             const int height,
+                             const int src_num_components,
+                             const int stride,
+                             const int first_row,
+                             const int end_row)
+{
+    struct TJEProcessedQT* pqt = &state->pqt;
+
+    // An MCU is h_factor x v_factor luma blocks and one block of each chroma,
+    // averaged down from the same area
+    const int blocks = state->h_factor * state->v_factor;
+    const int mcu_width = 8 * state->h_factor;
+    const int mcu_height = 8 * state->v_factor;
+
+    // statistics pass, nothing is written
+    uint32_t* freq[4] = { NULL, NULL, NULL, NULL };
+    if (state->stats) {
+        for ( int i = 0; i < 4; ++i ) {
+            freq[i] = state->stats->freq[i];
+        }
+    }
+
+    uint8_t block[64 * 4];
+    float du_y[4][64];
+    float full_b[4 * 64];
+    float full_r[4 * 64];
     float du_b[64];
     float du_r[64];
 
@@ -1278,132 +2930,392 @@ static int tjei_encode_main(TJEState* state,
     uint32_t location = 0;
 
 
-    for ( int y = 0; y < height; y += 8 ) {
-        for ( int x = 0; x < width; x += 8 ) {
+    for ( int y = first_row * mcu_height; y < height && y < end_row * mcu_height; y += mcu_height ) {
+        for ( int x = 0; x < width; x += mcu_width ) {
             // Block loop: ====
-            for ( int off_y = 0; off_y < 8; ++off_y ) {
-                for ( int off_x = 0; off_x < 8; ++off_x ) {
-                    int block_index = (off_y * 8 + off_x);
-
-                    int src_index = (((y + off_y) * width) + (x + off_x)) * src_num_components;
-
-                    int col = x + off_x;
-                    int row = y + off_y;
-
-                    if(row >= height) {
-                        src_index -= (width * (row - height + 1)) * src_num_components;
-                    }
-                    if(col >= width) {
-                        src_index -= (col - width + 1) * src_num_components;
-                    }
-                    assert(src_index < width * height * src_num_components);
-
-                    uint8_t r = src_data[src_index + 0];
-                    uint8_t g = src_data[src_index + 1];
-                    uint8_t b = src_data[src_index + 2];
-
-                    float luma = 0.299f   * r + 0.587f    * g + 0.114f    * b - 128;
-                    float cb   = -0.1687f * r - 0.3313f   * g + 0.5f      * b;
-                    float cr   = 0.5f     * r - 0.4187f   * g - 0.0813f   * b;
-
-                    du_y[block_index] = luma;
-                    du_b[block_index] = cb;
-                    du_r[block_index] = cr;
-                }
+            for ( int i = 0; i < blocks; ++i ) {
+                int block_x = x + (i % state->h_factor) * 8;
+                int block_y = y + (i / state->h_factor) * 8;
+                tjei_gather_block(src_data, width, height, src_num_components, stride, block_x, block_y, block);
+                state->kernels->rgba_to_ycbcr(block, du_y[i], full_b + i * 64, full_r + i * 64);
             }
 
-            tjei_encode_and_write_MCU(state, du_y,
-                                     pqt.luma,
-                                     state->ehuffsize[TJEI_LUMA_DC], state->ehuffcode[TJEI_LUMA_DC],
-                                     state->ehuffsize[TJEI_LUMA_AC], state->ehuffcode[TJEI_LUMA_AC],
-                                     &pred_y, &bitbuffer, &location);
+            if (blocks == 1) {
+                memcpy(du_b, full_b, sizeof(du_b));
+                memcpy(du_r, full_r, sizeof(du_r));
+            } else {
+                state->kernels->downsample(full_b, state->v_factor, du_b);
+                state->kernels->downsample(full_r, state->v_factor, du_r);
+            }
+
+            for ( int i = 0; i < blocks; ++i ) {
+                tjei_encode_and_write_MCU(state, du_y[i],
+                                         pqt->luma,
+                                         state->ehuffsize[TJEI_LUMA_DC], state->ehuffcode[TJEI_LUMA_DC],
+                                         state->ehuffsize[TJEI_LUMA_AC], state->ehuffcode[TJEI_LUMA_AC],
+                                         freq[TJEI_LUMA_DC], freq[TJEI_LUMA_AC],
+                                         &pred_y, &bitbuffer, &location);
+            }
             tjei_encode_and_write_MCU(state, du_b,
-                                     pqt.chroma,
+                                     pqt->chroma,
                                      state->ehuffsize[TJEI_CHROMA_DC], state->ehuffcode[TJEI_CHROMA_DC],
                                      state->ehuffsize[TJEI_CHROMA_AC], state->ehuffcode[TJEI_CHROMA_AC],
+                                     freq[TJEI_CHROMA_DC], freq[TJEI_CHROMA_AC],
                                      &pred_b, &bitbuffer, &location);
             tjei_encode_and_write_MCU(state, du_r,
-                                     pqt.chroma,
+                                     pqt->chroma,
                                      state->ehuffsize[TJEI_CHROMA_DC], state->ehuffcode[TJEI_CHROMA_DC],
                                      state->ehuffsize[TJEI_CHROMA_AC], state->ehuffcode[TJEI_CHROMA_AC],
+                                     freq[TJEI_CHROMA_DC], freq[TJEI_CHROMA_AC],
                                      &pred_r, &bitbuffer, &location);
 
 
         }
     }
 
-    // Finish the image.
-    { // Flush
+    if (state->stats) {
+        return;
+    }
+
+    // Finish the rows.
+    { // Flush, padding with 1 bits as the spec asks
         if (location > 0 && location < 8) {
-            tjei_write_bits(state, &bitbuffer, &location, (uint16_t)(8 - location), 0);
+            tjei_write_bits(state, &bitbuffer, &location, (uint16_t)(8 - location), (uint16_t)((1 << (8 - location)) - 1));
         }
     }
+    tjei_flush(state);
+}
+
+static int tjei_encode_main(TJEState* state,
+                            const unsigned char* src_data,
+                            const int width,
+                            const int height,
+                            const int src_num_components,
+                            const int stride)
+{
+    if (src_num_components != 3 && src_num_components != 4) {
+        return 0;
+    }
+
+    if (width > 0xffff || height > 0xffff) {
+        return 0;
+    }
+
+    tjei_write_headers(state, width, height, 0);
+
+    // Write compressed data.
+    int mcu_height = 8 * state->v_factor;
+    tjei_encode_rows(state, src_data, width, height, src_num_components, stride, 0, (height + mcu_height - 1) / mcu_height);
+
     uint16_t EOI = tjei_be_word(0xffd9);
     tjei_write(state, &EOI, sizeof(uint16_t), 1);
+    tjei_flush(state);
 
-    if (state->output_buffer_count) {
-        state->write_context.func(state->write_context.context, state->output_buffer, (int)state->output_buffer_count);
-        state->output_buffer_count = 0;
+    return 1;
+}
+
+// Baseline tables are 8 bits
+static uint8_t tjei_scale_qt(uint8_t base, int scale)
+{
+    int q = (base * scale + 50) / 100;
+    if (q < 1) {
+        q = 1;
+    }
+    if (q > 255) {
+        q = 255;
+    }
+    return (uint8_t)q;
+}
+
+// Sets the quantization and huffman tables for quality, output goes to func
+static int tjei_init_state(TJEState* state, tje_write_func* func, void* context, const int quality,
+                           const mjpegw_subsampling subsampling, const tje_huffman_spec* huffman)
+{
+    if (quality < 1 || quality > 100) {
+        tje_log("[ERROR] -- Valid 'quality' values are 1 (lowest) to 100 (highest)\n");
+        return 0;
     }
 
+    *state = (TJEState){ 0 };
+
+    // The usual (IJG) scaling: 50 keeps the tables of the spec, 100 gives all ones
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    for ( int i = 0; i < 64; ++i ) {
+        state->qt_luma[i]   = tjei_scale_qt(tjei_default_qt_luma_from_spec[i], scale);
+        state->qt_chroma[i] = tjei_scale_qt(tjei_default_qt_chroma_from_paper[i], scale);
+    }
+    tjei_build_processed_qt(state, &state->pqt);
+
+    TJEWriteContext wc = { 0 };
+
+    wc.context = context;
+    wc.func = func;
+
+    state->write_context = wc;
+    state->kernels = tjei_select_kernels();
+    state->h_factor = subsampling == MJPEGW_444 ? 1 : 2;
+    state->v_factor = subsampling == MJPEGW_420 ? 2 : 1;
+
+
+    tjei_huff_expand(state, huffman);
+
     return 1;
 }
 
 int tje_encode_with_func(tje_write_func* func,
                          void* context,
                          const int quality,
+                         const mjpegw_subsampling subsampling,
+                         const tje_huffman_spec* huffman,
                          const int width,
                          const int height,
                          const int num_components,
+                         const int stride,
                          const unsigned char* src_data)
 {
-    if (quality < 1 || quality > 3) {
-        tje_log("[ERROR] -- Valid 'quality' values are 1 (lowest), 2, or 3 (highest)\n");
+    TJEState state;
+    if (!tjei_init_state(&state, func, context, quality, subsampling, huffman))
         return 0;
-    }
 
-    TJEState state = { 0 };
+    int result = tjei_encode_main(&state, src_data, width, height, num_components, stride);
+
+    return result;
+}
 
-    uint8_t qt_factor = 1;
-    switch(quality) {
-    case 3:
-        for ( int i = 0; i < 64; ++i ) {
-            state.qt_luma[i]   = 1;
-            state.qt_chroma[i] = 1;
+struct tje_encoder
+{
+    TJEState state;
+    int quality;                    // 0 until the state is set up
+    mjpegw_subsampling subsampling;
+    int has_huffman;
+    tje_huffman_spec huffman;       // the state tables point here
+};
+
+size_t tje_encoder_size(void)
+{
+    return sizeof(tje_encoder);
+}
+
+void tje_encoder_init(tje_encoder* encoder)
+{
+    encoder->quality = 0;
+}
+
+int tje_encode_cached(tje_encoder* encoder,
+                      tje_write_func* func,
+                      void* context,
+                      const int quality,
+                      const mjpegw_subsampling subsampling,
+                      const tje_huffman_spec* huffman,
+                      const int width,
+                      const int height,
+                      const int num_components,
+                      const int stride,
+                      const unsigned char* src_data)
+{
+    int same_tables = huffman ? encoder->has_huffman && memcmp(&encoder->huffman, huffman, sizeof(*huffman)) == 0
+                              : !encoder->has_huffman;
+
+    if (encoder->quality != quality || encoder->subsampling != subsampling || !same_tables) {
+        encoder->quality = 0;
+        encoder->has_huffman = huffman != NULL;
+        if (huffman) {
+            encoder->huffman = *huffman;
         }
-        break;
-    case 2:
-        qt_factor = 10;
-        // don't break. fall through.
-    case 1:
-        for ( int i = 0; i < 64; ++i ) {
-            state.qt_luma[i]   = tjei_default_qt_luma_from_spec[i] / qt_factor;
-            if (state.qt_luma[i] == 0) {
-                state.qt_luma[i] = 1;
-            }
-            state.qt_chroma[i] = tjei_default_qt_chroma_from_paper[i] / qt_factor;
-            if (state.qt_chroma[i] == 0) {
-                state.qt_chroma[i] = 1;
-            }
+        if (!tjei_init_state(&encoder->state, func, context, quality, subsampling, huffman ? &encoder->huffman : NULL)) {
+            return 0;
         }
-        break;
-    default:
-        assert(!"invalid code path");
-        break;
+        encoder->quality = quality;
+        encoder->subsampling = subsampling;
     }
 
-    TJEWriteContext wc = { 0 };
+    encoder->state.write_context.func = func;
+    encoder->state.write_context.context = context;
+    encoder->state.output_buffer_count = 0;
 
-    wc.context = context;
-    wc.func = func;
+    return tjei_encode_main(&encoder->state, src_data, width, height, num_components, stride);
+}
+
+int tje_gather_stats(tje_huffman_stats* stats,
+                     const int quality,
+                     const mjpegw_subsampling subsampling,
+                     const int width,
+                     const int height,
+                     const int num_components,
+                     const int stride,
+                     const unsigned char* src_data)
+{
+    if ((num_components != 3 && num_components != 4) || width > 0xffff || height > 0xffff) {
+        return 0;
+    }
 
-    state.write_context = wc;
+    TJEState state;
+    if (!tjei_init_state(&state, NULL, NULL, quality, subsampling, NULL))
+        return 0;
 
+    state.stats = stats;
+    int mcu_height = 8 * state.v_factor;
+    tjei_encode_rows(&state, src_data, width, height, num_components, stride, 0, (height + mcu_height - 1) / mcu_height);
 
-    tjei_huff_expand(&state);
+    return 1;
+}
 
-    int result = tjei_encode_main(&state, src_data, width, height, num_components);
+//-----------------------------------------------------------------------------------------------------------------------------
+// Restart interval slicing
+//-----------------------------------------------------------------------------------------------------------------------------
 
-    return result;
+// a run of MCU rows encoded on its own, its scan data is joined to the others with RSTn markers
+typedef struct mjpegw_slice
+{
+    TJEState state;
+    jpeg_buffer out;
+    const unsigned char* pixels;
+    uint32_t width, height;
+    int stride;
+    int first_row, end_row;
+} mjpegw_slice;
+
+typedef struct mjpegw_slice_worker
+{
+    mjpegw_slice* slices;
+    uint32_t first, count, step;
+} mjpegw_slice_worker;
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void* slice_worker_main(void* arg)
+{
+    mjpegw_slice_worker* w = (mjpegw_slice_worker*) arg;
+    for (uint32_t i = w->first; i < w->count; i += w->step)
+    {
+        mjpegw_slice* s = &w->slices[i];
+        tjei_encode_rows(&s->state, s->pixels, s->width, s->height, 4, s->stride, s->first_row, s->end_row);
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Splits the scan in restart intervals of whole MCU rows, one or more per thread, and joins them in
+// order. The result is a baseline JPEG like the one tje_encode_with_func gives, plus a DRI segment
+static int encode_sliced(jpeg_buffer* out, mjpegw_mem_interface* mem, const void* pixels, int stride,
+                         uint32_t width, uint32_t height, int quality, mjpegw_subsampling subsampling,
+                         uint32_t threads)
+{
+    if (width == 0 || height == 0 || width > 0xffff || height > 0xffff)
+        return 0;
+
+    TJEState header;
+    if (!tjei_init_state(&header, jpeg_write_func, out, quality, subsampling, NULL))
+        return 0;
+
+    // the interval is counted in MCUs and has to fit in 16 bits
+    uint32_t mcu_width = 8 * header.h_factor;
+    uint32_t mcu_height = 8 * header.v_factor;
+    uint32_t mcu_cols = (width + mcu_width - 1) / mcu_width;
+    uint32_t mcu_rows = (height + mcu_height - 1) / mcu_height;
+    uint32_t max_rows = 0xffff / mcu_cols;
+    uint32_t rows = (mcu_rows + threads - 1) / threads;
+    if (rows > max_rows)
+        rows = max_rows;
+    uint32_t count = (mcu_rows + rows - 1) / rows;
+
+    mjpegw_slice* slices = mem->malloc_fn(sizeof(mjpegw_slice) * count, mem->user);
+    if (!slices)
+        return 0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        mjpegw_slice* s = &slices[i];
+        s->state = header;
+        s->out = (jpeg_buffer){ .mem = mem };
+        s->state.write_context.context = &s->out;
+        s->pixels = (const unsigned char*) pixels;
+        s->width = width;
+        s->height = height;
+        s->stride = stride;
+        s->first_row = i * rows;
+        s->end_row = (i + 1) * rows;
+    }
+
+    // every buffer takes its worst case here, the workers never allocate
+    int reserved = reserve_jpeg_buffer(out, jpeg_size_bound(width, mcu_rows, subsampling, MJPEGW_BLOCK_BOUND) + count * 2);
+    for (uint32_t i = 0; i < count; i++)
+        reserved &= reserve_jpeg_buffer(&slices[i].out, jpeg_size_bound(width, rows, subsampling, MJPEGW_BLOCK_BOUND));
+    if (!reserved)
+    {
+        for (uint32_t i = 0; i < count; i++)
+            free_jpeg_buffer(&slices[i].out);
+        mem->free_fn(slices, mem->user);
+        return 0;
+    }
+
+    if (threads > count)
+        threads = count;
+
+    mjpegw_slice_worker workers[MJPEGW_MAX_THREADS];
+    for (uint32_t t = 0; t < threads; t++)
+        workers[t] = (mjpegw_slice_worker) { .slices = slices, .first = t, .count = count, .step = threads };
+
+#ifndef MJPEGW_NO_THREADS
+    // the calling thread takes the first share, slices of a thread that couldn't start go to it too
+    pthread_t handles[MJPEGW_MAX_THREADS];
+    uint32_t started = 1;
+    while (started < threads && pthread_create(&handles[started], NULL, slice_worker_main, &workers[started]) == 0)
+        started++;
+
+    for (uint32_t t = started; t < threads; t++)
+        slice_worker_main(&workers[t]);
+    slice_worker_main(&workers[0]);
+
+    for (uint32_t t = 1; t < started; t++)
+        pthread_join(handles[t], NULL);
+#else
+    for (uint32_t t = 0; t < threads; t++)
+        slice_worker_main(&workers[t]);
+#endif
+
+    tjei_write_headers(&header, width, height, (uint16_t)(rows * mcu_cols));
+    tjei_flush(&header);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        jpeg_write_func(out, slices[i].out.data, slices[i].out.size);
+        if (i + 1 < count)
+        {
+            uint8_t rst[2] = { 0xff, (uint8_t)(0xd0 + (i & 7)) };
+            jpeg_write_func(out, rst, 2);
+        }
+        free_jpeg_buffer(&slices[i].out);
+    }
+    uint8_t eoi[2] = { 0xff, 0xd9 };
+    jpeg_write_func(out, eoi, 2);
+
+    mem->free_fn(slices, mem->user);
+    return 1;
 }
 
+//-----------------------------------------------------------------------------------------------------------------------------
+int mjpegw_write_jpeg(const char *filename, uint32_t width, uint32_t height, const void* pixels, int stride,
+                      const int quality, mjpegw_subsampling subsampling, uint32_t threads, mjpegw_mem_interface* mem)
+{
+    mjpegw_mem_interface allocator = mem ? *mem : default_allocator();
+    jpeg_buffer jpeg = { .mem = &allocator };
+
+    if (threads == 0)
+        threads = count_cores();
+    if (threads > MJPEGW_MAX_THREADS)
+        threads = MJPEGW_MAX_THREADS;
+
+    if (stride == 0)
+        stride = (int)width * 4;
+
+    int result = encode_sliced(&jpeg, &allocator, pixels, stride, width, height, quality, subsampling, threads);
+    if (result)
+    {
+        FILE* f = fopen(filename, "wb");
+        result = f && fwrite(jpeg.data, 1, jpeg.size, f) == jpeg.size;
+        if (f)
+            fclose(f);
+    }
+
+    free_jpeg_buffer(&jpeg);
+    return result;
+}
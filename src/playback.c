@@ -0,0 +1,337 @@
+#include <raylib.h>
+#include <raymath.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "puppets.h"
+#include "theater.h"
+#include "playback.h"
+
+// Playback is driven by an absolute clock: frame n of the run is due at
+// clockStart + n*frameDelay, the same timing the exported video has. Poses of
+// the upcoming frames are evaluated ahead of time into a ring, so reaching a
+// frame boundary only copies values into the puppets.
+static PlaybackDropPolicy dropPolicy;
+static double clockStart;
+static long shownTicks;
+static int anchorFrame;
+static float lastFrameDelay;
+static bool rebase;
+static int droppedFrames;
+
+static Pose ring[PLAYBACK_RING_SIZE];
+static bool ringEvaluated[PLAYBACK_RING_SIZE]; // false for frames found in the render cache
+static int ringFirst = 0;
+static int ringCount = 0;
+static Pose shown;
+static bool shownEvaluated;
+static bool poseSkipped; // a cached frame is shown, the puppets still hold an older pose
+
+// Frames rendered ahead through the virtual camera, once a frame is here
+// showing it is a texture blit. Entries are replaced in insertion order and
+// a slot keeps its texture for the next frame cached there.
+static bool cacheEnabled;
+static CachedFrame cache[PLAYBACK_CACHE_MAX_FRAMES];
+static int cacheNext = 0;
+static int cacheCount = 0;
+static int cacheTextures = 0;
+static int cacheWidth, cacheHeight;
+static size_t cacheBudget = PLAYBACK_CACHE_DEFAULT_BUDGET;
+static int cacheHits;
+static int cacheLookups;
+
+/* <== Poses ==========================================> */
+
+static void ShowPose(Pose *pose){
+    SetCurrentFrame(pose->frame, pose->frameIndex, &timeline);
+    ApplyPose(pose);
+}
+
+/* <== Render cache ===================================> */
+
+static size_t CachedFrameBytes(){
+    return (size_t) camera.w * camera.h * 4;
+}
+
+static int CacheCapacity(){
+    size_t bytes = CachedFrameBytes();
+    if (bytes == 0) return 0;
+    size_t capacity = cacheBudget / bytes;
+    return capacity > PLAYBACK_CACHE_MAX_FRAMES ? PLAYBACK_CACHE_MAX_FRAMES : capacity;
+}
+
+static void DropCachedFrame(CachedFrame *c){
+    c->frame = NULL;
+    cacheCount--;
+}
+
+static CachedFrame *FindCachedFrame(Frame *f){
+    for (int i=0; i<PLAYBACK_CACHE_MAX_FRAMES && cacheCount > 0; i++){
+        CachedFrame *c = &cache[i];
+        if (c->frame != f) continue;
+
+        // edits on the camera, the background or the output size
+        if (c->texture.texture.width != (int) camera.w ||
+            c->texture.texture.height != (int) camera.h ||
+            memcmp(&c->cameraPos, &f->cameraPos, sizeof(c->cameraPos)) != 0 ||
+            memcmp(c->bgColor, f->bgColor, sizeof(c->bgColor)) != 0){
+            DropCachedFrame(c);
+            return NULL;
+        }
+        return c;
+    }
+    return NULL;
+}
+
+// renders the frame of the pose into the cache
+static void CachePose(Pose *pose){
+    // the output size changed, nothing in the cache is usable
+    if (cacheWidth != (int) camera.w || cacheHeight != (int) camera.h){
+        PlaybackClearCache();
+        cacheWidth = camera.w;
+        cacheHeight = camera.h;
+    }
+
+    int capacity = CacheCapacity();
+    if (capacity <= 0) return;
+    if (FindCachedFrame(pose->frame) != NULL) return;
+
+    if (cacheNext >= capacity) cacheNext = 0;
+    CachedFrame *c = &cache[cacheNext];
+    cacheNext++;
+
+    if (c->frame != NULL) DropCachedFrame(c);
+    if (c->texture.id == 0){
+        c->texture = LoadRenderTexture(camera.w, camera.h);
+        cacheTextures++;
+    }
+    c->frame = pose->frame;
+    c->cameraPos = pose->frame->cameraPos;
+    memcpy(c->bgColor, pose->frame->bgColor, sizeof(c->bgColor));
+    cacheCount++;
+
+    RenderFrameTo(pose->frame, c->texture);
+}
+
+/* <== Ring ===========================================> */
+
+static Pose *RingAt(int i){
+    return &ring[(ringFirst+i) % PLAYBACK_RING_SIZE];
+}
+
+static bool *RingEvaluatedAt(int i){
+    return &ringEvaluated[(ringFirst+i) % PLAYBACK_RING_SIZE];
+}
+
+static void RingPop(){
+    ringFirst = (ringFirst+1) % PLAYBACK_RING_SIZE;
+    ringCount--;
+}
+
+// evaluates a few of the upcoming frames, the cost is spread over several updates
+static void Prefetch(bool loop){
+    int limit = timeline.frameCount-1;
+    if (limit > PLAYBACK_RING_SIZE) limit = PLAYBACK_RING_SIZE;
+
+    for (int n=0; n<PLAYBACK_EVALS_PER_UPDATE && ringCount < limit; n++){
+        Frame *f = timeline.currentFrame->next;
+        int index = timeline.currentFrameIndex+1;
+        if (ringCount > 0){
+            f = RingAt(ringCount-1)->frame->next;
+            index = RingAt(ringCount-1)->frameIndex+1;
+        }
+
+        if (f == NULL){
+            if (!loop) return;
+            f = timeline.head;
+            index = 0;
+        }
+
+        // a frame already in the cache is only blitted, its pose isn't needed
+        Pose *pose = RingAt(ringCount);
+        bool cached = false;
+        if (cacheEnabled){
+            cacheLookups++;
+            cached = FindCachedFrame(f) != NULL;
+            if (cached) cacheHits++;
+        }
+
+        if (cached){
+            pose->frame = f;
+            pose->frameIndex = index;
+        }
+        else {
+            EvaluateFramePose(f, index, pose);
+            if (cacheEnabled) CachePose(pose);
+        }
+        *RingEvaluatedAt(ringCount) = !cached;
+        ringCount++;
+    }
+}
+
+static Frame *FrameAt(int index){
+    Frame *f = timeline.currentFrame;
+    int i = timeline.currentFrameIndex;
+    if (index < i){
+        f = timeline.head;
+        i = 0;
+    }
+
+    for (; f != NULL && i < index; f = f->next) i++;
+    return f;
+}
+
+static void ShowFrame(int index){
+    // frames before the due one were dropped
+    while (ringCount > 0 && RingAt(0)->frameIndex != index) RingPop();
+
+    if (ringCount > 0){
+        // the shown pose is kept so it can be restored after rendering ahead
+        Pose tmp = shown;
+        shown = *RingAt(0);
+        *RingAt(0) = tmp;
+        shownEvaluated = *RingEvaluatedAt(0);
+        RingPop();
+    }
+    else {
+        // the ring fell behind, evaluate synchronously
+        Frame *f = FrameAt(index);
+        if (f == NULL) return;
+        shown.frame = f;
+        shown.frameIndex = index;
+        shownEvaluated = false;
+    }
+
+    if (cacheEnabled && FindCachedFrame(shown.frame) != NULL){
+        SetCurrentFrame(shown.frame, shown.frameIndex, &timeline);
+        poseSkipped = true;
+        return;
+    }
+
+    // not cached, or evicted since it was prefetched
+    if (!shownEvaluated){
+        EvaluateFramePose(shown.frame, shown.frameIndex, &shown);
+        shownEvaluated = true;
+    }
+    ShowPose(&shown);
+    poseSkipped = false;
+}
+
+/* <== Public =========================================> */
+
+void PlaybackStart(PlaybackDropPolicy policy){
+    dropPolicy = policy;
+    droppedFrames = 0;
+    cacheHits = cacheLookups = 0;
+    PlaybackInvalidate();
+}
+
+// returns false once a non looping playback reaches the end
+bool PlaybackUpdate(float frameDelay, bool loop){
+    if (timeline.frameCount <= 0 || timeline.currentFrame == NULL) return false;
+    if (frameDelay <= 0) return true;
+
+    double now = GetTime();
+    double seconds = frameDelay/1000.0;
+
+    // the clock restarts from the current frame after edits or delay changes
+    if (rebase || frameDelay != lastFrameDelay){
+        clockStart = now;
+        shownTicks = 0;
+        anchorFrame = timeline.currentFrameIndex;
+        lastFrameDelay = frameDelay;
+        rebase = false;
+        EvaluateFramePose(timeline.currentFrame, timeline.currentFrameIndex, &shown);
+    }
+
+    long due = (long)((now - clockStart) / seconds);
+    if (due > shownTicks){
+        long ticks = due;
+        if (dropPolicy == PLAYBACK_HOLD_FRAMES){
+            ticks = shownTicks+1;
+            // a late frame still gets its full delay on screen
+            if (due > ticks) clockStart = now - ticks*seconds;
+        }
+        else droppedFrames += due - shownTicks - 1;
+        shownTicks = ticks;
+
+        long frame = anchorFrame + ticks;
+        if (frame >= timeline.frameCount){
+            if (!loop) return false;
+            frame %= timeline.frameCount;
+        }
+        ShowFrame(frame);
+    }
+
+    Prefetch(loop);
+    return true;
+}
+
+// must be called whenever the timeline or its frames change
+void PlaybackInvalidate(){
+    ringCount = 0;
+    ringFirst = 0;
+    rebase = true;
+}
+
+// must be called whenever the content of f changes (or before f is freed)
+void PlaybackInvalidateFrame(Frame *f){
+    CachedFrame *c = NULL;
+    for (int i=0; i<PLAYBACK_CACHE_MAX_FRAMES && cacheCount > 0; i++)
+        if (cache[i].frame == f) c = &cache[i];
+    if (c != NULL) DropCachedFrame(c);
+    PlaybackInvalidate();
+}
+
+void PlaybackStop(){
+    // the puppets are edited after playback, they must hold the shown frame
+    if (poseSkipped && timeline.currentFrame != NULL){
+        EvaluateFramePose(timeline.currentFrame, timeline.currentFrameIndex, &shown);
+        ApplyPose(&shown);
+    }
+    poseSkipped = false;
+    PlaybackInvalidate();
+}
+
+int PlaybackGetDroppedFrames(){
+    return droppedFrames;
+}
+
+void PlaybackSetCacheEnabled(bool enabled){
+    cacheEnabled = enabled;
+}
+
+RenderTexture *PlaybackGetCachedFrame(Frame *f){
+    if (!cacheEnabled) return NULL;
+    CachedFrame *c = FindCachedFrame(f);
+    return c != NULL ? &c->texture : NULL;
+}
+
+void PlaybackClearCache(){
+    for (int i=0; i<PLAYBACK_CACHE_MAX_FRAMES && cacheTextures > 0; i++){
+        if (cache[i].texture.id == 0) continue;
+        UnloadRenderTexture(cache[i].texture);
+        cacheTextures--;
+        cache[i] = (CachedFrame){0};
+    }
+    cacheCount = 0;
+    cacheNext = 0;
+}
+
+void PlaybackSetCacheBudget(size_t bytes){
+    cacheBudget = bytes;
+    PlaybackClearCache();
+}
+
+size_t PlaybackGetCacheBudget(){
+    return cacheBudget;
+}
+
+size_t PlaybackGetCacheUsage(){
+    return cacheTextures * CachedFrameBytes();
+}
+
+float PlaybackGetCacheHitRate(){
+    if (cacheLookups == 0) return 0;
+    return (float) cacheHits / cacheLookups;
+}
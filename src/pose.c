@@ -0,0 +1,278 @@
+#include <math.h>
+#include <raylib.h>
+#include <raymath.h>
+#include <stdlib.h>
+#include <string.h>
+#include "puppets.h"
+#include "theater.h"
+#include "utils.h"
+#include "pose.h"
+
+/* <== Utilities ======================================> */
+
+static void ReservePose(Pose *p, int puppetsQ, int bonesQ){
+    if (puppetsQ > p->puppetsCap){
+        p->puppetsCap = puppetsQ*2;
+        p->puppets = realloc(p->puppets, sizeof(PosePuppet) * p->puppetsCap);
+    }
+
+    if (bonesQ > p->bonesCap){
+        p->bonesCap = bonesQ*2;
+        p->bones = realloc(p->bones, sizeof(PoseBone) * p->bonesCap);
+    }
+}
+
+static void AppendPoseBone(Pose *out, PuppetSnapshot *s, Vector2 *ends, Bone *b, Vector2 direction, float length, int skin){
+    Puppet *p = s->puppet;
+    int parent = b->parent == p ? 0 : b->parent->index;
+    Vector2 end = Vector2Add(ends[parent], Vector2Scale(direction, length * s->scale));
+    if (b->index > 0 && b->index <= p->descendantsQ) ends[b->index] = end;
+
+    out->bones[out->bonesQ++] = (PoseBone){
+        .bone = b,
+        .direction = direction,
+        .length = length,
+        .skin = p->skins[skin],
+        .start = parent == 0 ? s->position : ends[parent],
+        .position = end
+    };
+    out->puppets[out->puppetsQ-1].bonesQ++;
+}
+
+/* <== Compact encoding ===============================> */
+
+static size_t PackedBytes(int bonesQ){
+    return sizeof(PackedBones) + sizeof(unsigned short) * bonesQ * 3;
+}
+
+// returns NULL if some value doesn't fit, the caller keeps the full snapshot then
+PackedBones *PackBones(Vector2 *directions, float *lengths, int *skins, int bonesQ){
+    if (bonesQ <= 0) return NULL;
+    for (int i=0; i<bonesQ; i++){
+        float unit = Vector2Length(directions[i]);
+        if (unit < 0.999f || unit > 1.001f) return NULL;
+        if (lengths[i] < 0 || lengths[i]*PACKED_LENGTH_SCALE > 65535) return NULL;
+        if (skins[i] < 0 || skins[i] > 65535) return NULL;
+    }
+
+    PackedBones *pk = malloc(PackedBytes(bonesQ));
+    pk->refCount = 1;
+    pk->bonesQ = bonesQ;
+    unsigned short *angles = pk->data;
+    unsigned short *lens = angles + bonesQ;
+    unsigned short *skinsOut = lens + bonesQ;
+
+    for (int i=0; i<bonesQ; i++){
+        float angle = atan2f(directions[i].y, directions[i].x);
+        angles[i] = (unsigned short) ((int) lroundf(angle * (65536.0f/(2*PI))) & 0xFFFF);
+        lens[i] = (unsigned short) lroundf(lengths[i]*PACKED_LENGTH_SCALE);
+        skinsOut[i] = skins[i];
+    }
+    return pk;
+}
+
+PackedBones *CopyPackedBones(PackedBones *pk){
+    if (pk != NULL) pk->refCount++;
+    return pk;
+}
+
+void ReleasePackedBones(PackedBones *pk){
+    if (pk == NULL) return;
+    if (--pk->refCount <= 0) free(pk);
+}
+
+// unit vectors of the 16 bit angles, split in the high and the low byte:
+// angle = high*256 + low, so the direction is coarse[high] rotated by fine[low]
+static Vector2 coarseAngles[256], fineAngles[256];
+static bool anglesReady = false;
+
+static void BuildAngleTables(){
+    for (int i=0; i<256; i++){
+        double coarse = i * 256 * (2*PI/65536.0);
+        double fine = i * (2*PI/65536.0);
+        coarseAngles[i] = (Vector2){(float) cos(coarse), (float) sin(coarse)};
+        fineAngles[i] = (Vector2){(float) cos(fine), (float) sin(fine)};
+    }
+    anglesReady = true;
+}
+
+// no cosf/sinf per bone, a direction is two table reads and a complex product
+// (error under 1e-6), which stays cheap in builds without optimizations too
+void UnpackBones(PackedBones *pk, Vector2 *directions, float *lengths, int *skins){
+    if (!anglesReady) BuildAngleTables();
+    int n = pk->bonesQ;
+    unsigned short *angles = pk->data;
+    unsigned short *lens = angles + n;
+    unsigned short *skinsIn = lens + n;
+
+    for (int i=0; i<n; i++){
+        Vector2 c = coarseAngles[angles[i] >> 8];
+        Vector2 f = fineAngles[angles[i] & 0xFF];
+        directions[i] = (Vector2){c.x*f.x - c.y*f.y, c.y*f.x + c.x*f.y};
+    }
+    for (int i=0; i<n; i++) lengths[i] = lens[i] * (1.0f/PACKED_LENGTH_SCALE);
+    for (int i=0; i<n; i++) skins[i] = skinsIn[i];
+}
+
+// shared bones are split between their owners
+size_t PackedBonesSize(PackedBones *pk){
+    return pk != NULL ? PackedBytes(pk->bonesQ) / pk->refCount : 0;
+}
+
+/* <== Evaluation =====================================> */
+
+void ClearPose(Pose *pose){
+    pose->frame = NULL;
+    pose->frameIndex = -1;
+    pose->puppetsQ = 0;
+    pose->bonesQ = 0;
+}
+
+void FreePose(Pose *pose){
+    free(pose->puppets);
+    free(pose->bones);
+    *pose = (Pose){0};
+}
+
+// appends the puppet of s to out, the same result ApplyPuppetSnapshot + UpdateDescendantsPos would give
+void EvaluateSnapshotPose(PuppetSnapshot *s, Pose *out){
+    Puppet *p = s->puppet;
+    int bonesQ = s->packed != NULL ? s->packed->bonesQ : s->bonesSnapshots.snapshotsQ;
+    ReservePose(out, out->puppetsQ+1, out->bonesQ + bonesQ);
+
+    PosePuppet *pp = &out->puppets[out->puppetsQ++];
+    *pp = (PosePuppet){
+        .puppet = p,
+        .position = s->position,
+        .scale = s->scale,
+        .firstBone = out->bonesQ,
+        .bonesQ = 0
+    };
+
+    // end points by bone index, 0 is the root (it has no snapshot of its own).
+    // bones without snapshot keep their rest pose
+    Vector2 ends[p->descendantsQ+1];
+    ends[0] = Vector2Add(s->position, Vector2Scale(p->direction, p->len));
+    for (int i=0; i<p->descendantsQ; i++){
+        Bone *b = p->descendants[i];
+        int parent = b->parent == p ? 0 : b->parent->index;
+        ends[i+1] = Vector2Add(ends[parent], Vector2Scale(b->direction, b->len * s->scale));
+    }
+
+    // snapshots follow the descendants order, parents are always evaluated first
+    if (s->packed != NULL){
+        Vector2 directions[bonesQ];
+        float lengths[bonesQ];
+        int skins[bonesQ];
+        UnpackBones(s->packed, directions, lengths, skins);
+        for (int i=0; i<bonesQ; i++)
+            AppendPoseBone(out, s, ends, p->descendants[i], directions[i], lengths[i], skins[i]);
+        return;
+    }
+
+    for (BoneSnapshot *bs = s->bonesSnapshots.head; bs != NULL; bs = bs->next)
+        AppendPoseBone(out, s, ends, bs->bone, bs->direction, bs->length, bs->skin);
+}
+
+void EvaluateFramePose(Frame *f, int index, Pose *out){
+    ClearPose(out);
+    out->frame = f;
+    out->frameIndex = index;
+    for (PuppetSnapshot *s = f->head; s != NULL; s = s->next)
+        EvaluateSnapshotPose(s, out);
+}
+
+// writes the pose into the puppets, like SwitchFrame does with the snapshots
+void ApplyPose(Pose *pose){
+    for (int i=0; i<pose->puppetsQ; i++){
+        pose->puppets[i].puppet->position = pose->puppets[i].position;
+        pose->puppets[i].puppet->scale = pose->puppets[i].scale;
+    }
+
+    for (int i=0; i<pose->bonesQ; i++){
+        Bone *b = pose->bones[i].bone;
+        b->direction = pose->bones[i].direction;
+        b->len = pose->bones[i].length;
+        b->skin = pose->bones[i].skin;
+        b->position = pose->bones[i].position;
+    }
+}
+
+/* <== Queries ========================================> */
+
+Rectangle GetPosePuppetBounds(Pose *pose, int puppet){
+    PosePuppet *pp = &pose->puppets[puppet];
+    float rightMargin = 0, leftMargin = 0, topMargin = 0, bottomMargin = 0;
+
+    for (int i=0; i<pp->bonesQ; i++){
+        PoseBone *pb = &pose->bones[pp->firstBone+i];
+        Skin *skin = &pb->skin;
+
+        float scale = (pb->length*pp->scale) / Vector2Length(Vector2Subtract(skin->pointA, skin->pointB));
+        Rectangle dst = (Rectangle){
+            pb->start.x,
+            pb->start.y,
+            skin->rect.width * scale,
+            skin->rect.height * scale
+        };
+
+        Vector2 org = (Vector2){
+            (skin->pointA.x - skin->rect.x)*scale,
+            (skin->pointA.y - skin->rect.y)*scale
+        };
+
+        float angle = VectorToDegrees(pb->direction)-skin->angle;
+        Vector2 corners[4];
+        GetRectCorners(dst, org, 1, angle, &corners[0], &corners[1], &corners[2], &corners[3]);
+
+        for (int o=0; o<4; o++){
+            float hDelta = corners[o].x - pp->position.x;
+            if (hDelta > rightMargin) rightMargin = hDelta;
+            if (hDelta < leftMargin) leftMargin = hDelta;
+
+            float vDelta = corners[o].y - pp->position.y;
+            if (vDelta > bottomMargin) bottomMargin = vDelta;
+            if (vDelta < topMargin) topMargin = vDelta;
+        }
+    }
+
+    return (Rectangle){
+        pp->position.x + leftMargin,
+        pp->position.y + topMargin,
+        rightMargin + leftMargin*-1,
+        bottomMargin + topMargin*-1
+    };
+}
+
+// fills out (room for descendantsQ bones) back to front, returns how many were written
+int GetPoseDrawOrder(Pose *pose, int puppet, PoseBone **out){
+    PosePuppet *pp = &pose->puppets[puppet];
+    Puppet *p = pp->puppet;
+
+    //SORT THE BONES BY THEIR Z-INDEX
+    PoseBone *bonesInOrder[p->descendantsQ+1];
+    memset(bonesInOrder, 0, sizeof(bonesInOrder));
+    for (int i=0; i<pp->bonesQ; i++){
+        PoseBone *pb = &pose->bones[pp->firstBone+i];
+        if (pb->skin.zIndex >= 0 && pb->skin.zIndex < p->descendantsQ)
+            bonesInOrder[pb->skin.zIndex] = pb;
+    }
+
+    int n = 0;
+    for (int i = p->descendantsQ - 1; i >= 0; i--)
+        if (bonesInOrder[i] != NULL) out[n++] = bonesInOrder[i];
+    return n;
+}
+
+void DrawPosePuppet(Pose *pose, int puppet, Vector2 offset){
+    PosePuppet *pp = &pose->puppets[puppet];
+    Puppet *p = pp->puppet;
+    if (p->atlas == NULL) return;
+
+    PoseBone *order[p->descendantsQ+1];
+    int n = GetPoseDrawOrder(pose, puppet, order);
+    for (int i=0; i<n; i++){
+        PoseBone *pb = order[i];
+        DrawSkin(p->atlas->texture, &pb->skin, Vector2Add(pb->start, offset), pb->direction, pb->length*pp->scale);
+    }
+}
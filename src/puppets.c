@@ -97,6 +97,37 @@ void SetSkinAngle(Skin *s){
     s->angle = VectorToDegrees(Vector2Normalize(Vector2Subtract(A, B))) + 180;
 }
 
+bool SkinEquals(Skin *a, Skin *b){
+    // field by field, Skin has padding bytes so memcmp is not reliable
+    return a->rect.x == b->rect.x && a->rect.y == b->rect.y &&
+           a->rect.width == b->rect.width && a->rect.height == b->rect.height &&
+           a->pointA.x == b->pointA.x && a->pointA.y == b->pointA.y &&
+           a->pointB.x == b->pointB.x && a->pointB.y == b->pointB.y &&
+           a->angle == b->angle && a->zIndex == b->zIndex &&
+           a->xFlip == b->xFlip && a->yFlip == b->yFlip;
+}
+
+// returns the palette entry of p holding s, adding it if it's new
+int InternSkin(Puppet *p, Skin *s){
+    for (int i=p->skinsQ-1; i>=0; i--){
+        if (SkinEquals(&p->skins[i], s)) return i;
+    }
+
+    if (p->skinsQ >= p->skinsCap){
+        p->skinsCap = p->skinsCap == 0 ? 32 : p->skinsCap*2;
+        p->skins = realloc(p->skins, sizeof(Skin) * p->skinsCap);
+    }
+    p->skins[p->skinsQ] = *s;
+    return p->skinsQ++;
+}
+
+int InternBoneSkin(Bone *b){
+    Puppet *p = b->root != NULL ? b->root : b;
+    if (b->skinIndex >= 0 && b->skinIndex < p->skinsQ && SkinEquals(&p->skins[b->skinIndex], &b->skin))
+        return b->skinIndex;
+    return b->skinIndex = InternSkin(p, &b->skin);
+}
+
 void XFlipSkin(Skin *s){
     if (s == NULL) return;
     s->xFlip = !s->xFlip;
@@ -405,7 +436,8 @@ void DeletePuppet(Puppet *p){
     
     if (p->name != NULL)
         free(p->name);
-    
+
+    free(p->skins);
     free(p);
 }
 
@@ -522,51 +554,52 @@ void DrawPuppetSkin(Puppet *p){
     //RENDER EACH BONE SKIN
     for (int i = p->descendantsQ - 1; i >= 0; i--){
         Bone *b = bonesInOrder[i];
-        float scale = (b->len*b->root->scale) / Vector2Length(Vector2Subtract(b->skin.pointA, b->skin.pointB));
-        
-        Rectangle src = (Rectangle){
-            b->skin.rect.x,
-            b->skin.rect.y,
-            b->skin.xFlip ? b->skin.rect.width*-1 : b->skin.rect.width,
-            b->skin.rect.height
-        };
-
-        Rectangle dst = (Rectangle){
-            b->parent->position.x,
-            b->parent->position.y,
-            b->skin.rect.width * scale,
-            b->skin.rect.height * scale
-        };
-
-        Vector2 A = b->skin.pointA;
-        Vector2 B = b->skin.pointB;
-
-        Vector2 org = (Vector2){
-            (A.x - b->skin.rect.x)*scale,
-            (A.y - b->skin.rect.y)*scale
-        };
-
-        Vector2 center = (Vector2){
-            dst.width/2,
-            dst.height/2
-        };
-
-        if (b->skin.xFlip){
-            float delta = org.x - center.x;
-            org.x = center.x-delta;
-        }
+        DrawSkin(p->atlas->texture, &b->skin, b->parent->position, b->direction, b->len*b->root->scale);
+    }
+}
+
+// places a skin hinged at start, stretched so pointA -> pointB measures scaledLength
+SkinQuad GetSkinQuad(Skin *skin, Vector2 start, Vector2 direction, float scaledLength){
+    float scale = scaledLength / Vector2Length(Vector2Subtract(skin->pointA, skin->pointB));
+
+    Rectangle src = (Rectangle){
+        skin->rect.x,
+        skin->rect.y,
+        skin->xFlip ? skin->rect.width*-1 : skin->rect.width,
+        skin->rect.height
+    };
+
+    Rectangle dst = (Rectangle){
+        start.x,
+        start.y,
+        skin->rect.width * scale,
+        skin->rect.height * scale
+    };
+
+    Vector2 A = skin->pointA;
 
-        float angle = VectorToDegrees(b->direction)-b->skin.angle;
+    Vector2 org = (Vector2){
+        (A.x - skin->rect.x)*scale,
+        (A.y - skin->rect.y)*scale
+    };
+
+    Vector2 center = (Vector2){
+        dst.width/2,
+        dst.height/2
+    };
 
-        DrawTexturePro(
-            p->atlas->texture,
-            src,
-            dst,
-            org,
-            angle,
-            WHITE
-        );
+    if (skin->xFlip){
+        float delta = org.x - center.x;
+        org.x = center.x-delta;
     }
+
+    float angle = VectorToDegrees(direction)-skin->angle;
+    return (SkinQuad){src, dst, org, angle};
+}
+
+void DrawSkin(Texture2D atlas, Skin *skin, Vector2 start, Vector2 direction, float scaledLength){
+    SkinQuad q = GetSkinQuad(skin, start, direction, scaledLength);
+    DrawTexturePro(atlas, q.src, q.dst, q.origin, q.rotation, WHITE);
 }
 
 void DrawPuppetSkinTo(Puppet *p, Vector2 pos){
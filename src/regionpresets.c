@@ -12,6 +12,7 @@
 #include "viewports.h"
 #include "config.h"
 #include "theater.h"
+#include "journal.h"
 
 typedef struct Region{
     char *name;
@@ -92,6 +93,7 @@ void AddRegion(char *name, Rectangle rect, Vector2 A, Vector2 B){
 void ApplyRegion(Region *r){
     if (r == NULL) return;
     if ((*closetSelectedBone) == NULL) return;
+    Skin old = (*closetSelectedBone)->skin;
     (*closetSelectedBone)->skin.rect = r->rect;
     (*closetSelectedBone)->skin.pointA = r->pointA;
     (*closetSelectedBone)->skin.pointB = r->pointB;
@@ -99,6 +101,7 @@ void ApplyRegion(Region *r){
     if (closetSelectorOpts == 1){ //theater
         NewPuppetSnapshot(*closetSelectedPuppet, timeline.currentFrame);
     }
+    else JournalRecordSkin(*closetSelectedBone, old);
 }
 
 int ExportRegions(char *path){
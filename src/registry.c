@@ -0,0 +1,159 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "puppets.h"
+#include "registry.h"
+
+// Every name is stored once and never freed, so interned names can be
+// compared (and hashed) by pointer.
+typedef struct InternedName{
+    unsigned int hash;
+    struct InternedName *next;
+    char name[];
+} InternedName;
+
+static InternedName **internBuckets = NULL;
+static int internBucketsQ = 0;
+static int internCount = 0;
+
+/* <== Utilities ======================================> */
+
+static unsigned int HashString(const char *s){
+    // FNV-1a
+    unsigned int h = 2166136261u;
+    for (; *s; s++){
+        h ^= (unsigned char) *s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static unsigned int HashPointer(const void *p){
+    uintptr_t v = (uintptr_t) p;
+    return (unsigned int) ((v >> 3) * 2654435761u);
+}
+
+static void GrowInternBuckets(){
+    int newQ = internBucketsQ == 0 ? REGISTRY_MIN_BUCKETS : internBucketsQ*2;
+    InternedName **newBuckets = calloc(newQ, sizeof(InternedName*));
+    for (int i=0; i<internBucketsQ; i++){
+        InternedName *n = internBuckets[i];
+        while (n != NULL){
+            InternedName *next = n->next;
+            n->next = newBuckets[n->hash & (newQ-1)];
+            newBuckets[n->hash & (newQ-1)] = n;
+            n = next;
+        }
+    }
+    free(internBuckets);
+    internBuckets = newBuckets;
+    internBucketsQ = newQ;
+}
+
+static void GrowBuckets(PuppetRegistry *r){
+    int newQ = r->bucketsQ == 0 ? REGISTRY_MIN_BUCKETS : r->bucketsQ*2;
+    Puppet **newBuckets = calloc(newQ, sizeof(Puppet*));
+    for (int i=0; i<r->bucketsQ; i++){
+        Puppet *p = r->buckets[i];
+        while (p != NULL){
+            Puppet *next = p->hashNext;
+            unsigned int b = HashPointer(p->name) & (newQ-1);
+            p->hashNext = newBuckets[b];
+            newBuckets[b] = p;
+            p = next;
+        }
+    }
+    free(r->buckets);
+    r->buckets = newBuckets;
+    r->bucketsQ = newQ;
+}
+
+/* <== Interned names =================================> */
+
+char *FindInternedName(const char *name){
+    if (name == NULL || internBucketsQ == 0) return NULL;
+    unsigned int h = HashString(name);
+    for (InternedName *n = internBuckets[h & (internBucketsQ-1)]; n != NULL; n = n->next){
+        if (n->hash == h && strcmp(n->name, name) == 0) return n->name;
+    }
+    return NULL;
+}
+
+char *InternName(const char *name){
+    if (name == NULL) return NULL;
+    char *found = FindInternedName(name);
+    if (found != NULL) return found;
+
+    if (internCount >= internBucketsQ) GrowInternBuckets();
+
+    size_t len = strlen(name);
+    InternedName *n = malloc(sizeof(InternedName) + len + 1);
+    n->hash = HashString(name);
+    memcpy(n->name, name, len + 1);
+    n->next = internBuckets[n->hash & (internBucketsQ-1)];
+    internBuckets[n->hash & (internBucketsQ-1)] = n;
+    internCount++;
+    return n->name;
+}
+
+/* <== Registry =======================================> */
+
+// p->name must be interned, id <= 0 (or an id already in use) gets a new one
+void RegistryAdd(PuppetRegistry *r, Puppet *p, int id){
+    if (r->count >= r->bucketsQ) GrowBuckets(r);
+
+    unsigned int b = HashPointer(p->name) & (r->bucketsQ-1);
+    p->hashNext = r->buckets[b];
+    r->buckets[b] = p;
+
+    if (id <= 0 || RegistryFindId(r, id) != NULL) id = r->nextId+1;
+    if (id > r->nextId) r->nextId = id;
+
+    if (id >= r->idsQ){
+        int newQ = r->idsQ == 0 ? REGISTRY_MIN_BUCKETS : r->idsQ;
+        while (newQ <= id) newQ *= 2;
+        r->ids = realloc(r->ids, sizeof(Puppet*) * newQ);
+        memset(r->ids + r->idsQ, 0, sizeof(Puppet*) * (newQ - r->idsQ));
+        r->idsQ = newQ;
+    }
+
+    r->ids[id] = p;
+    p->id = id;
+    r->count++;
+}
+
+void RegistryRemove(PuppetRegistry *r, Puppet *p){
+    if (r->bucketsQ == 0) return;
+
+    Puppet **link = &r->buckets[HashPointer(p->name) & (r->bucketsQ-1)];
+    while (*link != NULL && *link != p) link = &(*link)->hashNext;
+    if (*link == NULL) return;
+    *link = p->hashNext;
+    p->hashNext = NULL;
+
+    if (p->id > 0 && p->id < r->idsQ) r->ids[p->id] = NULL;
+    p->id = 0;
+    r->count--;
+}
+
+Puppet *RegistryFindName(PuppetRegistry *r, const char *name){
+    char *interned = FindInternedName(name);
+    if (interned == NULL || r->bucketsQ == 0) return NULL;
+
+    for (Puppet *p = r->buckets[HashPointer(interned) & (r->bucketsQ-1)]; p != NULL; p = p->hashNext){
+        if (p->name == interned) return p;
+    }
+    return NULL;
+}
+
+Puppet *RegistryFindId(PuppetRegistry *r, int id){
+    if (id <= 0 || id >= r->idsQ) return NULL;
+    return r->ids[id];
+}
+
+// ids are never reused while the registry lives, so they're only reset here
+void RegistryClear(PuppetRegistry *r){
+    free(r->buckets);
+    free(r->ids);
+    *r = (PuppetRegistry){0};
+}
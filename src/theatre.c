@@ -16,11 +16,30 @@
 #include "theater.h"
 #include "utils.h"
 #include "mjpegw.h"
+#include "journal.h"
+#include "playback.h"
+#include "pose.h"
+#include "displaylist.h"
 
 #define FORCE_CLOSE_IF_PLAYING (state == PLAYING_ANIMATION ? MU_OPT_FORCE_CLOSE : 0)
 #define TIMELINE_FRAME_DISTANCE 10
 #define TIMELINE_HEIGHT 100
 #define TIMELINE_SCROLLBAR_HEIGHT 10
+#define STAGE_HEADER_NAMES "PUPPET_STUDIO_V" // snapshots reference puppets by name and store whole skins
+#define STAGE_HEADER       "PUPPET_STAGE_V2" // puppets by id, skins by palette index, a file per scene
+#define STAGE_HEADER_LEN   15
+#define SCENE_HEADER       "PUPPET_SCENE_V1"
+#define SCENE_NAME_LEN     64
+#define EXPORT_QUEUE_FRAMES 3 // rendered frames waiting to be encoded
+#define EXPORT_HUFFMAN_SAMPLES 8 // frames the sampled huffman tables are built from
+#define EXPORT_MAX_WORKERS 8 // encoding keeps up with the rendering well before one per core
+#define EXPORT_MEMORY_BUDGET (256u << 20) // encoder memory, every worker adds two frames and their buffers
+
+#ifdef PLATFORM_WEB
+#define COMPACT_FRAMES_DEFAULT 1 // the browser has the tightest memory
+#else
+#define COMPACT_FRAMES_DEFAULT 0
+#endif
 
 typedef enum State {
     IDLE,
@@ -35,14 +54,36 @@ typedef enum State {
 } State;
 
 typedef enum VideoFormat {
-    MJPEG_AVI
+    MJPEG_AVI,
+    JPEG_FRAME // only the current frame
 } VideoFormats;
 
+typedef enum ExportStage {
+    EXPORT_RENDER,
+    EXPORT_READBACK,
+    EXPORT_ENCODE,
+    EXPORT_STAGES
+} ExportStage;
+
+// an exported frame by the hash of what it draws, see FindHeldFrame
+typedef struct HeldFrame{
+    uint64_t hash;
+    Frame *timelineFrame;
+    int frame; // +1, 0 is an empty slot
+} HeldFrame;
+
 typedef enum CameraModes {
     CAMERA_EDITOR_MODE,
     CAMERA_PREVIEW_MODE
 } CameraModes;
 
+// Scenes share the puppets and their palettes, only the current one has its
+// timeline in memory. The others stay in scenes/<name>.scene until opened
+typedef struct Scene{
+    char name[SCENE_NAME_LEN];
+    bool stored; // it has a scene file already
+} Scene;
+
 static Viewport *thisViewport;
 static State state;
 static Vector2 mousePosition;
@@ -53,9 +94,12 @@ static int autoMovementSettings = 1;
 static int blockRange = 1;
 static int propagateRotation = 1;
 static float frameDelay = 120.0; //ms
-static float frameTimer;
-static float frameTimerTarget;
 static int animationLoop = 1;
+static int dropFrames = 1;
+static int cacheFrames = 0;
+static int compactFrames = COMPACT_FRAMES_DEFAULT;
+static int dynamicResolution = 1;
+static float frameTimeTarget = 33; //ms, the render scale drops while interaction is slower
 static CameraModes cameraMode;
 static Camera2D savedEditorCamera;
 static Vector2 virtualCameraCorners[5];
@@ -65,10 +109,21 @@ static int timelineHoverFrame = -1;
 static int scrollbarThumbWidth = 0;
 static int scrollbarThumboOffset = 0;
 static int frameToCopy = -1;
+static int rangeAnchor = -1; // the other end of the range is the current frame
+static float rangeTarget = 0;
+static Vector2 batchOffset = {0};
+static float batchScale = 1;
+static float batchDegrees = 0;
 static Puppet *puppetsToDelete[16] = {0};
 static int puppetsToDeleteQ = 0;
 static VirtualCameraSnapshot copiedCamera = {.zoom = 1};
 static Color copiedColor = {51, 51, 54, 255};
+static int framesStamp = 0;
+static Scene *scenes = NULL;
+static int scenesQ = 0;
+static int scenesCap = 0;
+static int currentScene = 0;
+static char projectPath[PATH_MAX] = {0}; // where the project was saved or loaded, scenes need one
 static const char *commands[] = {
     NULL
 };
@@ -79,31 +134,30 @@ Puppet *theatreTargetPuppet;
 Bone *theatreTargetBone;
 VirtualCamera camera;
 VideoFormats outputFormat;
+mjpegw_subsampling outputSubsampling = MJPEGW_420; // flat shaded art keeps its look at half chroma
+mjpegw_huffman outputHuffman = MJPEGW_HUFFMAN_SAMPLED;
+float outputQuality = 100;      // 1..100, the highest one when a rate is set
+float outputBitrate = 0;        // kbit/s, 0 disables rate control
+float outputMaxFrameSize = 0;   // KB, 0 for no limit
 
 /* <== Utilities ======================================> */
 
 bool PupppetIsOnList(Puppet *puppet, PuppetLinkedList *list){
-    for (Puppet *p = list->head; p != NULL; p = p->next){
-        if (p == puppet) return  true;
-    }
-    return false;
+    if (puppet == NULL) return false;
+    return RegistryFindId(&list->registry, puppet->id) == puppet;
 }
 
 bool PuppetNameIsOnList(char *name, PuppetLinkedList *list){
-    for (Puppet *p = list->head; p != NULL; p = p->next){
-        if (strcmp(name, p->name) == 0) return true;
-    }
-    return false;
+    return RegistryFindName(&list->registry, name) != NULL;
 }
 
 Puppet *GetPuppetByName(char *name, PuppetLinkedList *list){
-    for (Puppet *p = list->head; p != NULL; p = p->next){
-        if (strcmp(name, p->name) == 0) return p;
-    }
-    return NULL;
+    return RegistryFindName(&list->registry, name);
 }
 
 void NewFrame(Timeline *t, bool copylast){
+    PlaybackInvalidate();
+    rangeAnchor = -1;
     Frame *f = calloc(1,sizeof(Frame));
     f->cameraPos.zoom = 1;
     if (t->currentFrame == NULL){
@@ -157,78 +211,71 @@ PuppetSnapshot *PuppetIsOnFrame(Puppet *p, Frame *f){
     return NULL;
 }
 
-void CalculateBoundaries(PuppetSnapshot *p){
-    if (p == NULL) return;
-    
-    float rightMargin = 0, leftMargin = 0, topMargin = 0, bottomMargin = 0;
-    for (int i=0; i<p->puppet->descendantsQ; i++){
-        Bone *b = p->puppet->descendants[i];
-        
-        float scale = (b->len*b->root->scale) / Vector2Length(Vector2Subtract(b->skin.pointA, b->skin.pointB));
-        Rectangle dst = (Rectangle){
-            b->parent->position.x,
-            b->parent->position.y,
-            b->skin.rect.width * scale,
-            b->skin.rect.height * scale
-        };
+// adds s to the occurrences of its puppet, f is the frame s lives in
+void IndexSnapshot(PuppetSnapshot *s, Frame *f){
+    if (s->frame != NULL) return;
+    Puppet *p = s->puppet;
+    s->frame = f;
+    s->prevOccurrence = NULL;
+    s->nextOccurrence = p->occurrences;
+    if (p->occurrences != NULL) p->occurrences->prevOccurrence = s;
+    p->occurrences = s;
+    p->occurrencesQ++;
+}
 
-        Vector2 A = b->skin.pointA;
-        Vector2 B = b->skin.pointB;
-        Vector2 org = (Vector2){
-            (A.x - b->skin.rect.x)*scale,
-            (A.y - b->skin.rect.y)*scale
-        };
+void UnindexSnapshot(PuppetSnapshot *s){
+    if (s->frame == NULL) return;
+    Puppet *p = s->puppet;
+    if (s == p->occurrences) p->occurrences = s->nextOccurrence;
+    if (s->prevOccurrence != NULL) s->prevOccurrence->nextOccurrence = s->nextOccurrence;
+    if (s->nextOccurrence != NULL) s->nextOccurrence->prevOccurrence = s->prevOccurrence;
+    s->frame = NULL;
+    s->nextOccurrence = s->prevOccurrence = NULL;
+    p->occurrencesQ--;
+}
 
-        float angle = VectorToDegrees(b->direction)-b->skin.angle;
-        Vector2 corners[4];
-        GetRectCorners(
-            dst, 
-            org, 
-            1, 
-            angle, 
-            &corners[0], 
-            &corners[1], 
-            &corners[2], 
-            &corners[3]
-        );
+// frames out of the timeline (e.g. kept by the journal) are not indexed
+void IndexFrame(Frame *f, bool index){
+    for (PuppetSnapshot *s = f->head; s != NULL; s = s->next){
+        if (index) IndexSnapshot(s, f);
+        else UnindexSnapshot(s);
+    }
+}
 
-        for (int o=0; o<4; o++){
-            float hDelta = corners[o].x - p->puppet->position.x;
-            if (hDelta > rightMargin) rightMargin = hDelta;
-            if (hDelta < leftMargin) leftMargin = hDelta;
+// after this, the frames featuring p are the ones with stamp == the returned value
+int MarkPuppetFrames(Puppet *p){
+    framesStamp++;
+    for (PuppetSnapshot *s = p->occurrences; s != NULL; s = s->nextOccurrence)
+        s->frame->stamp = framesStamp;
+    return framesStamp;
+}
 
-            float vDelta = corners[o].y - p->puppet->position.y;
-            if (vDelta > bottomMargin) bottomMargin = vDelta;
-            if (vDelta < topMargin) topMargin = vDelta;
-        }
-    }
+// both work from the snapshot alone, the puppet keeps whatever pose it has
+void CalculateBoundaries(PuppetSnapshot *p){
+    if (p == NULL) return;
 
-    p->boundaries.height = bottomMargin + topMargin*-1;
-    p->boundaries.width = rightMargin + leftMargin*-1;
-    p->boundaries.y = (p->position.y + topMargin);
-    p->boundaries.x = (p->position.x + leftMargin);
+    Pose pose = {0};
+    EvaluateSnapshotPose(p, &pose);
+    p->boundaries = GetPosePuppetBounds(&pose, 0);
+    FreePose(&pose);
 }
 
 void GenerateOnionSkin(PuppetSnapshot *p){
     if (p->onionSkin.id != 0){
         UnloadRenderTexture(p->onionSkin);
     }
+    p->onionSkinStale = false;
     
-    CalculateBoundaries(p);
+    Pose pose = {0};
+    EvaluateSnapshotPose(p, &pose);
+    p->boundaries = GetPosePuppetBounds(&pose, 0);
+
     p->onionSkin = LoadRenderTexture(p->boundaries.width, p->boundaries.height);
     BeginTextureMode(p->onionSkin);
         ClearBackground((Color){0,0,0,0});
-        DrawPuppetSkinTo(
-            p->puppet,
-            Vector2Subtract(
-                p->puppet->position,
-                (Vector2){
-                    p->boundaries.x,
-                    p->boundaries.y
-                }
-            )
-        );
+        DrawPosePuppet(&pose, 0, (Vector2){p->boundaries.x*-1, p->boundaries.y*-1});
     EndTextureMode();
+    FreePose(&pose);
 }
 
 void DrawOnionSkin(PuppetSnapshot *s, float opacity){
@@ -262,18 +309,32 @@ void DeleteBoneSnapshot(BoneSnapshot *s, BoneSnapshotLinkedList *list){
     list->snapshotsQ--;
 }
 
-void DeletePuppetSnapshot(PuppetSnapshot *s, Frame *list){
-    if (s == NULL) return;
-    if (list == NULL) return;
+static void FreeBoneSnapshots(PuppetSnapshot *s){
     for (BoneSnapshot *bs = s->bonesSnapshots.head; bs != NULL; bs = bs->next)
         if (bs->prev != NULL) DeleteBoneSnapshot(bs->prev, &s->bonesSnapshots);
     DeleteBoneSnapshot(s->bonesSnapshots.tail, &s->bonesSnapshots);
+}
+
+// for snapshots out of any frame
+void FreePuppetSnapshot(PuppetSnapshot *s){
+    if (s == NULL) return;
+    FreeBoneSnapshots(s);
+    ReleasePackedBones(s->packed);
+    if (s->onionSkin.id != 0) UnloadRenderTexture(s->onionSkin);
+    free(s);
+}
+
+void DeletePuppetSnapshot(PuppetSnapshot *s, Frame *list){
+    if (s == NULL) return;
+    if (list == NULL) return;
+    UnindexSnapshot(s);
+    InvalidateFrame(list);
 
     if (s == list->head) list->head = s->next;
     if (s == list->tail) list->tail = s->prev;
     if (s->prev != NULL) s->prev->next = s->next;
     if (s->next != NULL) s->next->prev = s->prev;
-    free(s);
+    FreePuppetSnapshot(s);
     list->snapshotsQ--;
 }
 
@@ -296,7 +357,7 @@ void NewBoneSnapshot(Bone *b, PuppetSnapshot *p){
     s->bone = b;
     s->direction = b->direction;
     s->length = b->len;
-    s->skin = b->skin;
+    s->skin = InternBoneSkin(b);
 
     // LINK THE LIST
     if (p->bonesSnapshots.tail != NULL){
@@ -316,12 +377,7 @@ void NewPuppetSnapshot(Puppet *p, Frame *f){
     if (p->root != NULL) p = p->root;
     
     // if there is an snapshot of this puppet already
-    for (PuppetSnapshot *s=f->head; s != NULL; s = s->next){
-        if (s->puppet == p){
-            DeletePuppetSnapshot(s,f);
-            break;
-        }
-    }
+    PuppetSnapshot *old = PuppetIsOnFrame(p, f);
 
     PuppetSnapshot *s = calloc(1,sizeof(PuppetSnapshot));
     s->puppet = p;
@@ -333,6 +389,10 @@ void NewPuppetSnapshot(Puppet *p, Frame *f){
         Bone *b = p->descendants[i];
         NewBoneSnapshot(b, s);
     }
+
+    // the journal diffs against the old snapshot before it goes away
+    JournalRecordSnapshot(f, old, s);
+    DeletePuppetSnapshot(old, f);
     
     // LINK THE LIST
     if (f->tail != NULL){
@@ -346,16 +406,166 @@ void NewPuppetSnapshot(Puppet *p, Frame *f){
     }
 
     GenerateOnionSkin(s);
+    PackSnapshot(s);
     f->snapshotsQ++;
+    IndexSnapshot(s, f);
+    InvalidateFrame(f);
+}
+
+// stores the bones of s compactly (when compact frames are on), the snapshot
+// must hold every bone of the puppet in descendants order
+void PackSnapshot(PuppetSnapshot *s){
+    if (!compactFrames || s->packed != NULL) return;
+    Puppet *p = s->puppet;
+    int n = s->bonesSnapshots.snapshotsQ;
+    if (n <= 0 || n != p->descendantsQ) return;
+
+    Vector2 directions[n];
+    float lengths[n];
+    int skins[n];
+    int i = 0;
+    for (BoneSnapshot *bs = s->bonesSnapshots.head; bs != NULL; bs = bs->next, i++){
+        if (bs->bone != p->descendants[i]) return;
+        directions[i] = bs->direction;
+        lengths[i] = bs->length;
+        skins[i] = bs->skin;
+    }
+
+    PackedBones *pk = PackBones(directions, lengths, skins, n);
+    if (pk == NULL) return;
+    FreeBoneSnapshots(s);
+    s->packed = pk;
+}
+
+// back to the bone snapshots list, for code that edits it
+void UnpackSnapshot(PuppetSnapshot *s){
+    if (s->packed == NULL) return;
+    int n = s->packed->bonesQ;
+    Vector2 directions[n];
+    float lengths[n];
+    int skins[n];
+    UnpackBones(s->packed, directions, lengths, skins);
+
+    for (int i=0; i<n; i++){
+        BoneSnapshot *bs = calloc(1, sizeof(BoneSnapshot));
+        bs->bone = s->puppet->descendants[i];
+        bs->direction = directions[i];
+        bs->length = lengths[i];
+        bs->skin = skins[i];
+
+        if (s->bonesSnapshots.tail != NULL){
+            s->bonesSnapshots.tail->next = bs;
+            bs->prev = s->bonesSnapshots.tail;
+        }
+        else s->bonesSnapshots.head = bs;
+        s->bonesSnapshots.tail = bs;
+    }
+    s->bonesSnapshots.snapshotsQ = n;
+
+    ReleasePackedBones(s->packed);
+    s->packed = NULL;
+}
+
+void SetCompactFrames(bool compact){
+    compactFrames = compact;
+    for (Frame *f = timeline.head; f != NULL; f = f->next){
+        for (PuppetSnapshot *s = f->head; s != NULL; s = s->next){
+            if (compact) PackSnapshot(s);
+            else UnpackSnapshot(s);
+        }
+    }
+}
+
+// one pass over the snapshots of p in the range, the whole batch is a single
+// undo step. Onion skins are rendered later, only for frames that are shown
+int BatchEditFrames(Puppet *p, Frame *first, int index, int count, BatchEdit *edit){
+    if (p == NULL || first == NULL) return 0;
+    if (p->root != NULL) p = p->root;
+    int skin = edit->type == BATCH_SKIN ? InternSkin(p, &edit->skin) : 0;
+    Vector2 rotation = DegreesToVector(edit->degrees);
+
+    // bones touched by the edit, by index
+    bool affected[p->descendantsQ+1];
+    affected[0] = edit->bone == p;
+    for (int i=0; i<p->descendantsQ; i++){
+        Bone *b = p->descendants[i];
+        int parent = b->parent == p ? 0 : b->parent->index;
+        affected[i+1] = b == edit->bone || (edit->propagate && affected[parent]);
+    }
+
+    int edited = 0;
+    JournalBeginBatch();
+    Frame *f = first;
+    for (int i=0; i<count && f != NULL; i++, f = f->next){
+        PuppetSnapshot *s = PuppetIsOnFrame(p, f);
+        if (s == NULL) continue;
+        UnpackSnapshot(s);
+        PuppetSnapshot *before = ClonePuppetSnapshot(s);
+
+        switch (edit->type){
+            case BATCH_OFFSET: s->position = Vector2Add(s->position, edit->offset); break;
+            case BATCH_SCALE:  s->scale *= edit->scale;                             break;
+            case BATCH_ROTATE:
+            case BATCH_SKIN:
+                for (BoneSnapshot *bs = s->bonesSnapshots.head; bs != NULL; bs = bs->next){
+                    if (bs->bone->index <= 0 || bs->bone->index > p->descendantsQ) continue;
+                    if (!affected[bs->bone->index]) continue;
+                    if (edit->type == BATCH_SKIN) bs->skin = skin;
+                    else bs->direction = (Vector2){
+                        bs->direction.x*rotation.x - bs->direction.y*rotation.y,
+                        bs->direction.x*rotation.y + bs->direction.y*rotation.x
+                    };
+                }
+                break;
+        }
+
+        JournalRecordSnapshotEdit(f, index+i, before, s);
+        FreePuppetSnapshot(before);
+        PackSnapshot(s);
+        s->onionSkinStale = true;
+        InvalidateFrame(f);
+        edited++;
+    }
+    JournalEndBatch();
+
+    SwitchFrame(timeline.currentFrameIndex, &timeline);
+    return edited;
+}
+
+// onion skins left stale by batch edits and duplicates are rendered once they can be seen
+static void RefreshOnionSkins(){
+    int i = 0;
+    for (Frame *f = timeline.currentFrame; f != NULL && i <= onionSkinsTrace; f = f->prev, i++){
+        for (PuppetSnapshot *s = f->head; s != NULL; s = s->next)
+            if (s->onionSkinStale) GenerateOnionSkin(s);
+    }
 }
 
 void ApplyPuppetSnapshot(PuppetSnapshot *p){
     p->puppet->position = p->position;
     p->puppet->scale = p->scale;
+
+    if (p->packed != NULL){
+        int n = p->packed->bonesQ;
+        Vector2 directions[n];
+        float lengths[n];
+        int skins[n];
+        UnpackBones(p->packed, directions, lengths, skins);
+        for (int i=0; i<n; i++){
+            Bone *b = p->puppet->descendants[i];
+            b->direction = directions[i];
+            b->len = lengths[i];
+            b->skin = p->puppet->skins[skins[i]];
+            b->skinIndex = skins[i];
+        }
+        return;
+    }
+
     for (BoneSnapshot *s = p->bonesSnapshots.head; s != NULL; s = s->next){
         s->bone->direction = s->direction;
         s->bone->len = s->length;
-        s->bone->skin = s->skin;
+        s->bone->skin = p->puppet->skins[s->skin];
+        s->bone->skinIndex = s->skin;
     }
 }
 
@@ -418,47 +628,67 @@ void SwitchFrame(int frame, Timeline *t){
         }
     }
 
-    
-    ApplyCameraSnapshot(&timeline.currentFrame->cameraPos);
-    UpdateVirtualCameraCorners(&timeline.currentFrame->cameraPos, virtualCameraCorners);
-    for (PuppetSnapshot *s = t->currentFrame->head; s != NULL; s = s->next){
+    GoToFrame(t->currentFrame, t->currentFrameIndex, t);
+}
+
+// makes f the current frame without applying its snapshots, the caller applies the pose
+void SetCurrentFrame(Frame *f, int index, Timeline *t){
+    t->currentFrame = f;
+    t->currentFrameIndex = index;
+    ApplyCameraSnapshot(&f->cameraPos);
+    UpdateVirtualCameraCorners(&f->cameraPos, virtualCameraCorners);
+}
+
+// SwitchFrame to f, the index-th frame, without walking the timeline to find it
+void GoToFrame(Frame *f, int index, Timeline *t){
+    PlaybackInvalidate();
+    SetCurrentFrame(f, index, t);
+    for (PuppetSnapshot *s = f->head; s != NULL; s = s->next){
         ApplyPuppetSnapshot(s);
         UpdateDescendantsPos(s->puppet, s->puppet->position, true);
     }
 }
 
+// a copy of src out of any frame and without onion skin, packed bones are shared
+PuppetSnapshot *ClonePuppetSnapshot(PuppetSnapshot *src){
+    PuppetSnapshot *newp = calloc(1,sizeof(PuppetSnapshot));
+    newp->puppet = src->puppet;
+    newp->position = src->position;
+    newp->scale = src->scale;
+    newp->packed = CopyPackedBones(src->packed);
+    
+    int bonesCount = 0;
+    for (BoneSnapshot *srcb = src->bonesSnapshots.head; srcb != NULL; srcb = srcb->next){
+        bonesCount++;
+        BoneSnapshot *newb = calloc(1,sizeof(BoneSnapshot));
+        newb->bone = srcb->bone;
+        newb->direction = srcb->direction;
+        newb->length = srcb->length;
+        newb->skin = srcb->skin;
+
+        // LINK THE BONE SNAPSHOTS LIST
+        if (newp->bonesSnapshots.tail == NULL){
+            newp->bonesSnapshots.head = newb;
+        }
+        else{
+            newp->bonesSnapshots.tail->next = newb;
+            newb->prev = newp->bonesSnapshots.tail;
+        }
+        newp->bonesSnapshots.tail = newb;
+    }
+
+    newp->bonesSnapshots.snapshotsQ = bonesCount;
+    return newp;
+}
+
 void CopyFrame(Frame *src, Frame *dst){
     if (src == NULL || dst == NULL) return;
+    InvalidateFrame(dst);
     CleanFrame(dst);
     dst->cameraPos = src->cameraPos;
 
     for (PuppetSnapshot *srcp = src->head; srcp != NULL; srcp = srcp->next){
-        PuppetSnapshot *newp = calloc(1,sizeof(PuppetSnapshot));
-        newp->puppet = srcp->puppet;
-        newp->position = srcp->position;
-        newp->scale = srcp->scale;
-        
-        int bonesCount = 0;
-        for (BoneSnapshot *srcb = srcp->bonesSnapshots.head; srcb != NULL; srcb = srcb->next){
-            bonesCount++;
-            BoneSnapshot *newb = calloc(1,sizeof(BoneSnapshot));
-            newb->bone = srcb->bone;
-            newb->direction = srcb->direction;
-            newb->length = srcb->length;
-            newb->skin = srcb->skin;
-
-            // LINK THE BONE SNAPSHOTS LIST
-            if (newp->bonesSnapshots.tail == NULL){
-                newp->bonesSnapshots.head = newb;
-            }
-            else{
-                newp->bonesSnapshots.tail->next = newb;
-                newb->prev = newp->bonesSnapshots.tail;
-            }
-            newp->bonesSnapshots.tail = newb;
-        }
-
-        newp->bonesSnapshots.snapshotsQ = bonesCount;
+        PuppetSnapshot *newp = ClonePuppetSnapshot(srcp);
 
         // LINK THE PUPPET SNAPSHOTS LIST
         if (dst->tail == NULL){
@@ -469,46 +699,215 @@ void CopyFrame(Frame *src, Frame *dst){
             newp->prev = dst->tail;
         }
         dst->tail = newp;
-        dst->snapshotsQ =  src->snapshotsQ;
-        dst->bgColor[0] = src->bgColor[0];
-        dst->bgColor[1] = src->bgColor[1];
-        dst->bgColor[2] = src->bgColor[2];
+        IndexSnapshot(newp, dst);
     }
 
+    dst->snapshotsQ =  src->snapshotsQ;
+    dst->bgColor[0] = src->bgColor[0];
+    dst->bgColor[1] = src->bgColor[1];
+    dst->bgColor[2] = src->bgColor[2];
 }
 
-void RemoveFrame(Frame *f, Timeline *t){
-    if (f == NULL) return;
-    if (f->prev == NULL && f->next == NULL) return;
-    
-    if (f == t->currentFrame){
-        if (f->next != NULL){
-            SwitchFrame(t->currentFrameIndex+1, t);
-            t->currentFrameIndex--;
+/* <== Frame ranges ===================================> */
+
+// Ranges are chains of frames, first..last with count frames and first at
+// index. A chain out of the timeline keeps its inner links, so it can be
+// linked back as it was.
+
+static Frame *FrameAt(int index, Timeline *t){
+    Frame *f = t->head;
+    for (int i=0; f != NULL && i < index; i++) f = f->next;
+    return f;
+}
+
+static int IndexOfFrame(Frame *f, Timeline *t){
+    if (f == t->currentFrame) return t->currentFrameIndex;
+    int i = 0;
+    for (Frame *fi = t->head; fi != NULL; fi = fi->next, i++)
+        if (fi == f) return i;
+    return -1;
+}
+
+static void IndexFrames(Frame *first, int count, bool index){
+    Frame *f = first;
+    for (int i=0; i<count; i++, f = f->next) IndexFrame(f, index);
+}
+
+static void DetachFrames(Frame *first, Frame *last, Timeline *t){
+    if (first == t->head) t->head = last->next;
+    if (last == t->tail) t->tail = first->prev;
+    if (first->prev != NULL) first->prev->next = last->next;
+    if (last->next != NULL) last->next->prev = first->prev;
+}
+
+static void AttachFrames(Frame *first, Frame *last, Frame *prev, Timeline *t){
+    first->prev = prev;
+    last->next = prev != NULL ? prev->next : t->head;
+    if (first->prev != NULL) first->prev->next = first;
+    else t->head = first;
+    if (last->next != NULL) last->next->prev = last;
+    else t->tail = last;
+}
+
+// the timeline always keeps at least one frame
+Frame *UnlinkFrames(Frame *first, Frame *last, int index, int count, Timeline *t){
+    if (first == NULL || last == NULL || index < 0) return NULL;
+    if (count <= 0 || count >= t->frameCount) return NULL;
+    PlaybackInvalidate();
+    IndexFrames(first, count, false);
+
+    int current = t->currentFrameIndex;
+    if (current >= index && current < index+count){
+        if (last->next != NULL){
+            SwitchFrame(index+count, t);
+            t->currentFrameIndex = index;
         }
-        else SwitchFrame(t->currentFrameIndex-1, t);
+        else SwitchFrame(index-1, t);
     }
+    else if (current >= index+count){
+        t->currentFrameIndex -= count;
+    }
+
+    DetachFrames(first, last, t);
+    t->frameCount -= count;
+    if (t->currentFrameIndex >= t->frameCount)
+        t->currentFrameIndex = t->frameCount-1;
+
+    frameToCopy = rangeAnchor = -1;
+    return first;
+}
+
+// inserts the chain right after prev (at the head if prev is NULL), index is first's new position
+void LinkFrames(Frame *first, Frame *last, Frame *prev, int index, int count, Timeline *t){
+    PlaybackInvalidate();
+    IndexFrames(first, count, true);
+    AttachFrames(first, last, prev, t);
 
-    for (PuppetSnapshot *p=f->head; p != NULL; p = p->next)
-        DeletePuppetSnapshot(p->prev, f);
-    DeletePuppetSnapshot(f->tail, f);
+    t->frameCount += count;
+    if (index <= t->currentFrameIndex)
+        t->currentFrameIndex += count;
 
-    if (f == t->head) t->head = f->next;
-    if (f == t->tail) t->tail = f->prev;
-    if (f->prev != NULL) f->prev->next = f->next;
-    if (f->next != NULL) f->next->prev = f->prev;
+    frameToCopy = rangeAnchor = -1;
+}
+
+// index is the position of f in the timeline, or -1 if unknown
+Frame *UnlinkFrame(Frame *f, int index, Timeline *t){
+    if (f == NULL) return NULL;
+    if (index < 0) index = IndexOfFrame(f, t);
+    return UnlinkFrames(f, f, index, 1, t);
+}
+
+// inserts f right after prev (at the head if prev is NULL), index is f's new position
+void LinkFrame(Frame *f, Frame *prev, int index, Timeline *t){
+    LinkFrames(f, f, prev, index, 1, t);
+}
+
+// the range ends up starting at to, counted once the range is out of the way.
+// Only links change, the frames and their snapshots stay where they are
+void MoveFrames(Frame *first, Frame *last, int index, int count, int to, Timeline *t){
+    if (first == NULL || last == NULL || to == index) return;
+    if (to < 0 || to > t->frameCount-count) return;
+
+    // the frame that ends up right before the range, counted with the range still in place
+    Frame *prev = to > 0 ? FrameAt(to < index ? to-1 : to+count-1, t) : NULL;
+    MoveFramesAfter(first, last, prev, index, count, to, t);
+}
+
+// MoveFrames when the frame before to is known (e.g. replaying the journal)
+void MoveFramesAfter(Frame *first, Frame *last, Frame *prev, int index, int count, int to, Timeline *t){
+    if (first == NULL || last == NULL || to == index) return;
+    PlaybackInvalidate();
+
+    DetachFrames(first, last, t);
+    AttachFrames(first, last, prev, t);
+
+    int current = t->currentFrameIndex;
+    if (current >= index && current < index+count) current = to + current-index;
+    else {
+        if (current >= index+count) current -= count;
+        if (current >= to) current += count;
+    }
+    t->currentFrameIndex = current;
+    frameToCopy = rangeAnchor = -1;
+}
+
+// afterwards last is the first frame of the range
+void ReverseFrames(Frame *first, Frame *last, int index, int count, Timeline *t){
+    if (first == NULL || last == NULL || first == last) return;
+    PlaybackInvalidate();
+
+    Frame *before = first->prev;
+    Frame *after = last->next;
+    Frame *f = first;
+    for (int i=0; i<count; i++){
+        Frame *next = f->next;
+        f->next = f->prev;
+        f->prev = next;
+        f = next;
+    }
+
+    last->prev = before;
+    first->next = after;
+    if (before != NULL) before->next = last;
+    else t->head = last;
+    if (after != NULL) after->prev = first;
+    else t->tail = first;
+
+    int current = t->currentFrameIndex;
+    if (current >= index && current < index+count)
+        t->currentFrameIndex = index + (index+count-1 - current);
+    frameToCopy = rangeAnchor = -1;
+}
+
+// copies of the range are linked right after it, returns the first copy.
+// Packed bones are shared with the originals, onion skins are left to RefreshOnionSkins
+Frame *DuplicateFrames(Frame *first, int index, int count, Timeline *t){
+    if (first == NULL || count <= 0) return NULL;
+    Frame *copyFirst = NULL, *copyLast = NULL;
+    Frame *src = first, *last = first;
+    for (int i=0; i<count; i++, src = src->next){
+        Frame *f = calloc(1, sizeof(Frame));
+        CopyFrame(src, f);
+        // same pose, same bounds, the texture is rendered once the copy can be seen
+        for (PuppetSnapshot *s = f->head, *o = src->head; s != NULL && o != NULL; s = s->next, o = o->next){
+            s->boundaries = o->boundaries;
+            s->onionSkinStale = true;
+        }
+
+        f->prev = copyLast;
+        if (copyLast != NULL) copyLast->next = f;
+        else copyFirst = f;
+        copyLast = f;
+        last = src;
+    }
+
+    LinkFrames(copyFirst, copyLast, last, index+count, count, t);
+    return copyFirst;
+}
+
+void DeleteFrame(Frame *f){
+    if (f == NULL) return;
+    PlaybackInvalidateFrame(f);
+    CleanFrame(f);
+    ReleaseFrameDisplayList(f);
     free(f);
+}
 
-    t->frameCount--;
-    if (t->currentFrameIndex >= t->frameCount)
-        t->currentFrameIndex = t->frameCount-1;
+void DeleteFrames(Frame *first, int count){
+    Frame *f = first;
+    for (int i=0; i<count && f != NULL; i++){
+        Frame *next = f->next;
+        DeleteFrame(f);
+        f = next;
+    }
+}
 
-    if (frameToCopy >= t->currentFrameIndex)
-        frameToCopy = -1;
-    
+void RemoveFrame(Frame *f, Timeline *t){
+    DeleteFrame(UnlinkFrame(f, -1, t));
 }
 
-void CopyPuppetToList(Puppet *puppet, PuppetLinkedList *list, char* name){
+// id is the one the puppet had when saved, 0 for a new puppet
+Puppet *CopyPuppetToList(Puppet *puppet, PuppetLinkedList *list, char* name, int id){
     RebuildDescendants(puppet);
     RebuildDescendantsIndex(puppet);
     
@@ -529,8 +928,8 @@ void CopyPuppetToList(Puppet *puppet, PuppetLinkedList *list, char* name){
     newPuppet->atlas = puppet->atlas;
     newPuppet->atlas->refCount++;
     
-    newPuppet->name = calloc(strlen(name)+1, sizeof(char));
-    strcpy(newPuppet->name,name);
+    newPuppet->name = InternName(name);
+    RegistryAdd(&list->registry, newPuppet, id);
     
     // LINK THE LIST
     if (list->tail != NULL){
@@ -544,6 +943,7 @@ void CopyPuppetToList(Puppet *puppet, PuppetLinkedList *list, char* name){
     }
 
     list->puppetsQ++;
+    return newPuppet;
 }
 
 void RemovePuppetFromList(Puppet *puppet, PuppetLinkedList *list){
@@ -552,6 +952,8 @@ void RemovePuppetFromList(Puppet *puppet, PuppetLinkedList *list){
     if (puppet == list->tail) list->tail = puppet->prev;
     if (puppet->prev != NULL) puppet->prev->next = puppet->next;
     if (puppet->next != NULL) puppet->next->prev = puppet->prev;
+    RegistryRemove(&list->registry, puppet);
+    puppet->name = NULL; // interned names are never freed
     DeletePuppet(puppet);
     list->puppetsQ--;
 }
@@ -559,16 +961,11 @@ void RemovePuppetFromList(Puppet *puppet, PuppetLinkedList *list){
 void RemovePuppetFromCache(Puppet *p){
     if (p == NULL) return;
     if (p == theatreTargetBone) theatreTargetBone = NULL;
-    for (Frame *f = timeline.head; f != NULL; f = f->next){
-        for (PuppetSnapshot *s = f->head; s != NULL; s = s->next){
-            if (s->prev != NULL && s->prev->puppet == p){
-                DeletePuppetSnapshot(s->prev, f);
-            }
-        }
 
-        if (f->tail != NULL && f->tail->puppet == p)
-            DeletePuppetSnapshot(f->tail, f);
-    }
+    // history entries hold raw puppet and bone pointers
+    JournalRemovePuppet(p);
+    while (p->occurrences != NULL)
+        DeletePuppetSnapshot(p->occurrences, p->occurrences->frame);
 
     RemovePuppetFromList(p, &puppetsCache);
 }
@@ -606,23 +1003,94 @@ static void OffsetUpdate(Viewport *v){
     };
 }
 
-static void CleanProject(){
+// leaves the timeline with a single empty frame, as a new project has
+static void ClearTimeline(){
+    JournalClear();
+
     //Delete every frame (except first one)
-    for (Frame *f=timeline.tail; f != NULL; f=f->prev)
-        if (f->next !=  NULL) RemoveFrame(f, &timeline);
-    
-    //Delete every puppet
-    for (Puppet *p=puppetsCache.head; p!=NULL; p=p->next)
-        if (p->prev != NULL) RemovePuppetFromCache(p->prev);
-    if (puppetsCache.tail != NULL) RemovePuppetFromCache(puppetsCache.tail);
+    int count = timeline.frameCount-1;
+    if (count > 0){
+        SwitchFrame(0, &timeline);
+        DeleteFrames(UnlinkFrames(timeline.head->next, timeline.tail, 1, count, &timeline), count);
+    }
+    CleanFrame(timeline.head);
 
     timeline.currentFrame->cameraPos = (VirtualCameraSnapshot){0,0,1,0};
     UpdateVirtualCameraCorners(&timeline.currentFrame->cameraPos, virtualCameraCorners);
     timeline.currentFrame->bgColor[0] =  51;
     timeline.currentFrame->bgColor[1] =  51;
     timeline.currentFrame->bgColor[2] =  54;
+    InvalidateFrame(timeline.currentFrame);
+
+    frameToCopy = rangeAnchor = -1;
+}
+
+static void ResetScenes(){
+    if (scenesCap < 1){
+        scenesCap = 8;
+        scenes = realloc(scenes, sizeof(Scene) * scenesCap);
+    }
+    scenes[0] = (Scene){.name = "main"};
+    scenesQ = 1;
+    currentScene = 0;
+}
+
+static void CleanProject(){
+    ClearTimeline();
+
+    //Delete every puppet
+    for (Puppet *p=puppetsCache.head; p!=NULL; p=p->next)
+        if (p->prev != NULL) RemovePuppetFromCache(p->prev);
+    if (puppetsCache.tail != NULL) RemovePuppetFromCache(puppetsCache.tail);
+    RegistryClear(&puppetsCache.registry);
+
+    ResetScenes();
+    projectPath[0] = '\0';
+}
+
+static void ScenePath(char *path, const char *dirName, Scene *scene){
+    sprintf(path, "%s/%s/%s.scene", dirName, "scenes", scene->name);
+}
+
+static void WriteFrames(int fd){
+    int framesQ = timeline.frameCount;
+    write(fd, &framesQ, sizeof(int));
+
+    for (Frame *f=timeline.head; f != NULL; f = f->next){ //write each frame
+        write(fd, &f->cameraPos, sizeof(VirtualCameraSnapshot));
+        write(fd, f->bgColor, sizeof(float)*3);
+        write(fd, &f->snapshotsQ, sizeof(int));
+
+        // write puppets Q
+        for (PuppetSnapshot *s=f->head; s != NULL; s=s->next){
+            write(fd, &s->puppet->id, sizeof(int)); //write each puppet
+            write(fd, &s->position, sizeof(Vector2));
+            write(fd, &s->scale, sizeof(float));
+            if (s->packed != NULL){
+                int n = s->packed->bonesQ;
+                Vector2 directions[n];
+                float lengths[n];
+                int skins[n];
+                UnpackBones(s->packed, directions, lengths, skins);
+                write(fd, &n, sizeof(int));
+                for (int i=0; i<n; i++){
+                    write(fd, &s->puppet->descendants[i]->index, sizeof(int));
+                    write(fd, &directions[i], sizeof(Vector2));
+                    write(fd, &lengths[i], sizeof(float));
+                    write(fd, &skins[i], sizeof(int));
+                }
+                continue;
+            }
 
-    frameToCopy = -1;
+            write(fd, &s->bonesSnapshots.snapshotsQ, sizeof(int)); //write each bone       
+            for (BoneSnapshot *b=s->bonesSnapshots.head; b != NULL; b=b->next){
+                write(fd, &b->bone->index, sizeof(int));
+                write(fd, &b->direction, sizeof(Vector2));
+                write(fd, &b->length, sizeof(float));
+                write(fd, &b->skin, sizeof(int));
+            }
+        }
+    }
 }
 
 static int SaveProject(PuppetLinkedList *puppets, char *filename){
@@ -665,46 +1133,80 @@ static int SaveProject(PuppetLinkedList *puppets, char *filename){
         }
     }
 
+    // scenes saved somewhere else are brought along
+    sprintf(path, "%s/%s", dirName, "scenes");
+    if (mkdir(path,0777) != 0 && errno != EEXIST){
+        PushLog("Project scenes dir could not be created");
+        return -6;
+    }
+
+    char oldDirName[PATH_MAX] = {0};
+    if (projectPath[0] != '\0') strcpy(oldDirName, GetDirectoryPath(projectPath));
+    for (int i=0; i<scenesQ && oldDirName[0] != '\0' && strcmp(oldDirName, dirName) != 0; i++){
+        if (i == currentScene || !scenes[i].stored) continue;
+        char oldPath[PATH_MAX];
+        ScenePath(oldPath, oldDirName, &scenes[i]);
+        ScenePath(path, dirName, &scenes[i]);
+        int size = 0;
+        unsigned char *data = LoadFileData(oldPath, &size);
+        if (data == NULL || !SaveFileData(path, data, size)){
+            PushLog("'%s' scene could not be copied", scenes[i].name);
+            UnloadFileData(data);
+            return -7;
+        }
+        UnloadFileData(data);
+    }
+
+    // the current scene
+    ScenePath(path, dirName, &scenes[currentScene]);
+    int sceneFd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+    if (sceneFd < 0){
+        PushLog("'%s' scene could not be saved", path);
+        return -8;
+    }
+    write(sceneFd, SCENE_HEADER, sizeof(char)*STAGE_HEADER_LEN);
+    WriteFrames(sceneFd);
+    close(sceneFd);
+    chmod(path, 0666);
+    scenes[currentScene].stored = true;
+
     int fd = open(filename,O_CREAT | O_WRONLY | O_TRUNC, 0666);
     if (fd < 0){
         return fd;
     }
     
     //save version
-    write(fd,"PUPPET_STUDIO_V",sizeof(char)*15);
+    write(fd,STAGE_HEADER,sizeof(char)*STAGE_HEADER_LEN);
 
     int version = PROJECT_VERSION;
     write(fd,&version,sizeof(int));
+    write(fd, &puppets->registry.nextId, sizeof(int));
     write(fd, &camera, sizeof(VirtualCamera));
     write(fd, &frameDelay, sizeof(float));
 
-    int framesQ = timeline.frameCount;
-    write(fd, &framesQ, sizeof(int));
-
-    for (Frame *f=timeline.head; f != NULL; f = f->next){ //write each frame
-        write(fd, &f->cameraPos, sizeof(VirtualCameraSnapshot));
-        write(fd, f->bgColor, sizeof(float)*3);
-        write(fd, &f->snapshotsQ, sizeof(int));
-
-        // write puppets Q
-        for (PuppetSnapshot *s=f->head; s != NULL; s=s->next){
-            int nameLen = strlen(s->puppet->name); //write each puppet
-            write(fd, &nameLen, sizeof(int));
-            write(fd, s->puppet->name, nameLen);
-            write(fd, &s->position, sizeof(Vector2));
-            write(fd, &s->scale, sizeof(float));
-            write(fd, &s->bonesSnapshots.snapshotsQ, sizeof(int)); //write each bone       
-            for (BoneSnapshot *b=s->bonesSnapshots.head; b != NULL; b=b->next){
-                write(fd, &b->bone->index, sizeof(int));
-                write(fd, &b->direction, sizeof(Vector2));
-                write(fd, &b->length, sizeof(float));
-                write(fd, &b->skin, sizeof(Skin));
-            }
-        }
+    // puppets table with their skin palettes, snapshots only store indices
+    write(fd, &puppets->puppetsQ, sizeof(int));
+    for (Puppet *p=puppets->head; p != NULL; p = p->next){
+        int nameLen = strlen(p->name);
+        write(fd, &p->id, sizeof(int));
+        write(fd, &nameLen, sizeof(int));
+        write(fd, p->name, nameLen);
+        write(fd, &p->skinsQ, sizeof(int));
+        write(fd, p->skins, sizeof(Skin)*p->skinsQ);
+    }
+
+    // scenes table, the frames are in the scene files
+    write(fd, &scenesQ, sizeof(int));
+    write(fd, &currentScene, sizeof(int));
+    for (int i=0; i<scenesQ; i++){
+        int nameLen = strlen(scenes[i].name);
+        write(fd, &nameLen, sizeof(int));
+        write(fd, scenes[i].name, nameLen);
     }
     
     close(fd);
     chmod(filename,0666);
+    if (projectPath != filename) strcpy(projectPath, filename);
     PushLog("Project '%s' succesfully saved!", filename);
 
     return 0;
@@ -716,57 +1218,33 @@ void GenerateAllOnionSkins(Frame *f){
     }
 }
 
-int LoadProject(char *filename){
-    if (!IsFileExtension(filename, ".stage")){
-        PushLog("filename should contain the '.stage' extension");
-        return -1;
-    }
-
-    int fd = open(filename, O_RDONLY);
-    if (fd < 0){
-        PushLog("Project filename is invalid!");
-        return -2;
+static void AppendScene(char *name, bool stored){
+    if (scenesQ >= scenesCap){
+        scenesCap = scenesCap > 0 ? scenesCap*2 : 8;
+        scenes = realloc(scenes, sizeof(Scene) * scenesCap);
     }
+    scenes[scenesQ] = (Scene){.stored = stored};
+    strncpy(scenes[scenesQ].name, name, SCENE_NAME_LEN-1);
+    scenesQ++;
+}
 
-    //I should add some corroboration here
-    char header[15] = {0};
-    read(fd, &header, sizeof(char)*15);
-    
-    //Because of future changes, maybe...
-    int version;
-    read(fd, &version, sizeof(int));
+// returns the descriptor right after the header, or -1
+static int OpenSceneFile(char *path){
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
 
-    // Load each puppet
-    char dirName[PATH_MAX];
-    strcpy(dirName, GetDirectoryPath(filename));
-    char path[PATH_MAX] = {0};
-    
-    sprintf(path, "%s/%s", dirName, "puppets");    
-    DIR *allPuppetsDir = opendir(path);
-    struct dirent *entry;
-
-    if (allPuppetsDir == NULL){
-        PushLog("Unable to open project's puppet directory");
+    char header[STAGE_HEADER_LEN] = {0};
+    read(fd, &header, sizeof(char)*STAGE_HEADER_LEN);
+    if (memcmp(header, SCENE_HEADER, STAGE_HEADER_LEN) != 0){
         close(fd);
-        return -3;
-    }
-
-    CleanProject();
-    while ((entry = readdir(allPuppetsDir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0)   continue;
-        if (strcmp(entry->d_name, "..") == 0)  continue;
-        
-        sprintf(path, "%s/%s/%s/%s.puppet", dirName, "puppets", entry->d_name, entry->d_name);
-        Puppet *newPuppet = LoadPuppet(path);
-        CopyPuppetToList(newPuppet, &puppetsCache,entry->d_name);
-        DeletePuppet(newPuppet);
+        return -1;
     }
+    return fd;
+}
 
-    closedir(allPuppetsDir);
-
-    read(fd, &camera, sizeof(VirtualCamera));
-    read(fd, &frameDelay, sizeof(float));
-
+// the timeline is filled from fd, that must be after the frames count.
+// byId is false for older projects, puppets by name and whole skins
+static void ReadFrames(int fd, bool byId){
     // For each frame
     int framesQ;
     read(fd, &framesQ, sizeof(int));
@@ -783,28 +1261,64 @@ int LoadProject(char *filename){
         for (int q=0; q<snapshotsQ; q++){
             PuppetSnapshot *newPuppetSnapshot = calloc(1, sizeof(PuppetSnapshot));
 
-            int nameLen = 0;
-            read(fd, &nameLen, sizeof(int));
-            char puppetName[nameLen+1];
-            read(fd, puppetName, nameLen);
-            puppetName[nameLen] = '\0';
-            newPuppetSnapshot->puppet = GetPuppetByName(puppetName, &puppetsCache);
+            if (byId){
+                int id;
+                read(fd, &id, sizeof(int));
+                newPuppetSnapshot->puppet = RegistryFindId(&puppetsCache.registry, id);
+            }
+            else {
+                int nameLen = 0;
+                read(fd, &nameLen, sizeof(int));
+                char puppetName[nameLen+1];
+                read(fd, puppetName, nameLen);
+                puppetName[nameLen] = '\0';
+                newPuppetSnapshot->puppet = GetPuppetByName(puppetName, &puppetsCache);
+            }
             read(fd, &newPuppetSnapshot->position, sizeof(Vector2));
             read(fd, &newPuppetSnapshot->scale,  sizeof(float));
 
             // For each boneSnapshot in the puppetSnapshot
             int boneSnapshotsQ;
             read(fd, &boneSnapshotsQ,  sizeof(int));
+
+            // the puppet was deleted while the scene was on disk
+            if (newPuppetSnapshot->puppet == NULL){
+                size_t skinSize = byId ? sizeof(int) : sizeof(Skin);
+                lseek(fd, boneSnapshotsQ * (sizeof(int) + sizeof(Vector2) + sizeof(float) + skinSize), SEEK_CUR);
+                timeline.currentFrame->snapshotsQ--;
+                free(newPuppetSnapshot);
+                continue;
+            }
             newPuppetSnapshot->bonesSnapshots.snapshotsQ = boneSnapshotsQ;
             for (int o=0; o<boneSnapshotsQ; o++){
-                BoneSnapshot *newBoneSnapshot = calloc(1, sizeof(BoneSnapshot));
                 int boneIndex;
                 read(fd, &boneIndex, sizeof(int));
-                boneIndex--;
-                newBoneSnapshot->bone = newPuppetSnapshot->puppet->descendants[boneIndex];
+
+                // the bone isn't in the puppet (edited or replaced while the scene was on disk)
+                if (boneIndex < 1 || boneIndex > newPuppetSnapshot->puppet->descendantsQ){
+                    size_t skinSize = byId ? sizeof(int) : sizeof(Skin);
+                    lseek(fd, sizeof(Vector2) + sizeof(float) + skinSize, SEEK_CUR);
+                    newPuppetSnapshot->bonesSnapshots.snapshotsQ--;
+                    continue;
+                }
+
+                BoneSnapshot *newBoneSnapshot = calloc(1, sizeof(BoneSnapshot));
+                newBoneSnapshot->bone = newPuppetSnapshot->puppet->descendants[boneIndex-1];
                 read(fd, &newBoneSnapshot->direction, sizeof(Vector2));
                 read(fd, &newBoneSnapshot->length, sizeof(float));
-                read(fd, &newBoneSnapshot->skin, sizeof(Skin));
+
+                // older projects store the whole skin, it goes into the palette
+                Puppet *p = newPuppetSnapshot->puppet;
+                if (byId){
+                    read(fd, &newBoneSnapshot->skin, sizeof(int));
+                    if (newBoneSnapshot->skin < 0 || newBoneSnapshot->skin >= p->skinsQ)
+                        newBoneSnapshot->skin = InternBoneSkin(newBoneSnapshot->bone);
+                }
+                else {
+                    Skin skin;
+                    read(fd, &skin, sizeof(Skin));
+                    newBoneSnapshot->skin = InternSkin(p, &skin);
+                }
 
                 //link the boneSnapshots list
                 if (newPuppetSnapshot->bonesSnapshots.tail != NULL){
@@ -828,32 +1342,310 @@ int LoadProject(char *filename){
             if (timeline.tail->head == NULL){
                 timeline.tail->head = timeline.tail->tail = newPuppetSnapshot;
             }
+            IndexSnapshot(newPuppetSnapshot, timeline.tail);
+            PackSnapshot(newPuppetSnapshot);
         }
     }
+}
 
-    // Generate all onion skins
-    for (int i=0; i<framesQ; i++){
-        SwitchFrame(i, &timeline);
-        for (PuppetSnapshot *s = timeline.currentFrame->head; s != NULL; s = s->next){
-            GenerateOnionSkin(s);
-        }
-    }
+// shows the first frame of a timeline that was just filled
+static void OpenTimeline(){
+    for (Frame *f = timeline.head; f != NULL; f = f->next)
+        GenerateAllOnionSkins(f);
 
-    close(fd);
     SwitchFrame(0, &timeline);
+    UpdateVirtualCameraCorners(&timeline.currentFrame->cameraPos, virtualCameraCorners);
     thisViewport->camera.target = (Vector2){timeline.currentFrame->cameraPos.x, timeline.currentFrame->cameraPos.y};
+    SetTimelineOffset(0);
+}
+
+int LoadProject(char *filename){
+    if (!IsFileExtension(filename, ".stage")){
+        PushLog("filename should contain the '.stage' extension");
+        return -1;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0){
+        PushLog("Project filename is invalid!");
+        return -2;
+    }
+
+    //I should add some corroboration here
+    char header[STAGE_HEADER_LEN] = {0};
+    read(fd, &header, sizeof(char)*STAGE_HEADER_LEN);
+    bool byId = memcmp(header, STAGE_HEADER, STAGE_HEADER_LEN) == 0;
+    
+    //Because of future changes, maybe...
+    int version;
+    read(fd, &version, sizeof(int));
+
+    // Load each puppet
+    char dirName[PATH_MAX];
+    strcpy(dirName, GetDirectoryPath(filename));
+    char path[PATH_MAX] = {0};
+    
+    if (byId){
+        CleanProject();
+        // scenes on disk may still reference deleted puppets, their ids must stay taken
+        read(fd, &puppetsCache.registry.nextId, sizeof(int));
+        read(fd, &camera, sizeof(VirtualCamera));
+        read(fd, &frameDelay, sizeof(float));
+
+        int puppetsQ;
+        read(fd, &puppetsQ, sizeof(int));
+        for (int i=0; i<puppetsQ; i++){
+            int id, nameLen;
+            read(fd, &id, sizeof(int));
+            read(fd, &nameLen, sizeof(int));
+            char puppetName[nameLen+1];
+            read(fd, puppetName, nameLen);
+            puppetName[nameLen] = '\0';
+
+            sprintf(path, "%s/%s/%s/%s.puppet", dirName, "puppets", puppetName, puppetName);
+            Puppet *newPuppet = LoadPuppet(path);
+            Puppet *p = NULL;
+            if (newPuppet == NULL) PushLog("'%s' puppet could not be loaded", path);
+            else {
+                p = CopyPuppetToList(newPuppet, &puppetsCache, puppetName, id);
+                DeletePuppet(newPuppet);
+            }
+
+            int skinsQ;
+            read(fd, &skinsQ, sizeof(int));
+            if (p == NULL){
+                lseek(fd, sizeof(Skin)*skinsQ, SEEK_CUR);
+                continue;
+            }
+            p->skins = realloc(p->skins, sizeof(Skin)*skinsQ);
+            p->skinsQ = p->skinsCap = skinsQ;
+            read(fd, p->skins, sizeof(Skin)*skinsQ);
+        }
+    }
+
+    // older projects, every puppet in the puppets directory
+    else {
+        sprintf(path, "%s/%s", dirName, "puppets");    
+        DIR *allPuppetsDir = opendir(path);
+        struct dirent *entry;
+
+        if (allPuppetsDir == NULL){
+            PushLog("Unable to open project's puppet directory");
+            close(fd);
+            return -3;
+        }
+
+        CleanProject();
+        while ((entry = readdir(allPuppetsDir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0)   continue;
+            if (strcmp(entry->d_name, "..") == 0)  continue;
+            
+            sprintf(path, "%s/%s/%s/%s.puppet", dirName, "puppets", entry->d_name, entry->d_name);
+            Puppet *newPuppet = LoadPuppet(path);
+            CopyPuppetToList(newPuppet, &puppetsCache,entry->d_name, 0);
+            DeletePuppet(newPuppet);
+        }
+
+        closedir(allPuppetsDir);
+
+        read(fd, &camera, sizeof(VirtualCamera));
+        read(fd, &frameDelay, sizeof(float));
+    }
+
+    // the frames of newer projects are in the current scene file
+    int framesFd = fd;
+    if (byId){
+        int loadedScenes;
+        read(fd, &loadedScenes, sizeof(int));
+        read(fd, &currentScene, sizeof(int));
+        scenesQ = 0;
+        for (int i=0; i<loadedScenes; i++){
+            int nameLen;
+            read(fd, &nameLen, sizeof(int));
+            char sceneName[nameLen+1];
+            read(fd, sceneName, nameLen);
+            sceneName[nameLen] = '\0';
+            AppendScene(sceneName, true);
+        }
+        if (currentScene < 0 || currentScene >= scenesQ) currentScene = 0;
+
+        close(fd);
+        ScenePath(path, dirName, &scenes[currentScene]);
+        framesFd = OpenSceneFile(path);
+    }
+
+    if (framesFd >= 0){
+        ReadFrames(framesFd, byId);
+        close(framesFd);
+    }
+    else PushLog("'%s' scene could not be loaded", scenes[currentScene].name);
+
+    strcpy(projectPath, filename);
+    OpenTimeline();
     return 0;
 }
 
-static void RenderProjectMjpegAvi(Image *frames, int framesQ, char *fiename){
-    struct mjpegw_context *ctx = mjpegw_open(fiename, camera.w, camera.h, 1000.0/frameDelay, NULL);
-    for (int i=0; i<framesQ; i++){
-        ImageFormat(&frames[i], PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
-        mjpegw_add_frame(ctx, frames[i].data, 3);
+// the current scene is saved with the project before its timeline is dropped
+static int SwitchScene(int index){
+    if (index < 0 || index >= scenesQ || index == currentScene) return 0;
+    if (projectPath[0] == '\0'){
+        PushLog("Save the project before switching scenes");
+        return -1;
     }
-    mjpegw_close(ctx);
+    if (SaveProject(&puppetsCache, projectPath) != 0) return -2;
+
+    ClearTimeline();
+    currentScene = index;
+    if (scenes[index].stored){
+        char path[PATH_MAX];
+        ScenePath(path, GetDirectoryPath(projectPath), &scenes[index]);
+        int fd = OpenSceneFile(path);
+        if (fd < 0) PushLog("'%s' scene could not be loaded", scenes[index].name);
+        else {
+            ReadFrames(fd, true);
+            close(fd);
+        }
+    }
+
+    OpenTimeline();
+    return 0;
+}
+
+static void NewScene(char *name){
+    if (name[0] == '\0' || strchr(name, '/') != NULL || strchr(name, '\\') != NULL){
+        PushLog("'%s' is not a valid scene name", name);
+        return;
+    }
+    for (int i=0; i<scenesQ; i++){
+        if (strcmp(scenes[i].name, name) != 0) continue;
+        PushLog("There is a scene called '%s' already", name);
+        return;
+    }
+
+    AppendScene(name, false);
+    if (SwitchScene(scenesQ-1) != 0) scenesQ--;
+}
+
+// the scene file is left on disk, saving the project just stops listing it
+static void DeleteScene(int index){
+    if (index < 0 || index >= scenesQ || index == currentScene) return;
+    for (int i=index; i<scenesQ-1; i++) scenes[i] = scenes[i+1];
+    scenesQ--;
+    if (currentScene > index) currentScene--;
+}
+
+// every cache built from the snapshots of f is stale after this
+void InvalidateFrame(Frame *f){
+    f->version++;
+    PlaybackInvalidateFrame(f);
+}
+
+// draws f through the virtual camera, scaled to fit the target (exports, thumbnails...)
+void RenderFrameTo(Frame *f, RenderTexture target){
+    float fit = camera.w > 0 ? target.texture.width / camera.w : 1;
+    Camera2D framebufferCamera = {
+        .offset = (Vector2){target.texture.width/2.0f, target.texture.height/2.0f},
+        .target = (Vector2){f->cameraPos.x, f->cameraPos.y},
+        .rotation = f->cameraPos.rotation,
+        .zoom = f->cameraPos.zoom * fit
+    };
+    DisplayList *dl = GetFrameDisplayList(f);
+    Vector2 view[4];
+    GetCamera2DQuad(framebufferCamera, target.texture.width, target.texture.height, view);
+
+    BeginTextureMode(target);
+    BeginMode2D(framebufferCamera);
+        ClearBackground((Color){
+            f->bgColor[0],
+            f->bgColor[1], 
+            f->bgColor[2],
+            255
+        });
+
+        DrawDisplayList(dl, Vector2Zero(), view);
+    EndMode2D();
+    EndTextureMode();
+}
+
+// export targets are R8G8B8A8, the format the encoder takes, unlike the R8G8B8 ones of the viewports
+static RenderTexture LoadExportRenderTexture(void){
+    return LoadRenderTexture(camera.w, camera.h);
+}
+
+// the read back rows are bottom-up, the encoder walks them with a negative stride
+static const unsigned char *TopRow(const unsigned char *pixels, int width, int height, int *stride){
+    *stride = -width*4;
+    return pixels + (size_t)(height-1)*width*4;
+}
+
+// reads framebuffer into pixels when it can, else raylib allocates image.
+// Returns the pixels read, image must be unloaded
+static const unsigned char *ReadExportFrame(RenderTexture framebuffer, unsigned char *pixels, Image *image){
+    *image = (Image){0};
+    if (ReadRenderTexturePixels(framebuffer, pixels)) return pixels;
+    *image = LoadImageFromTexture(framebuffer.texture);
+    return image->data;
+}
+
+// the index of an earlier frame drawing the same as f (the frame-th one), or -1 after
+// adding f to the table. Matching hashes are confirmed on the display lists.
+// size is a power of two, at least twice the frames added
+static int FindHeldFrame(HeldFrame *table, int size, Frame *f, int frame){
+    uint64_t hash = HashFrameState(f);
+    int i = hash & (size-1);
+    for (; table[i].frame != 0; i = (i+1) & (size-1))
+        if (table[i].hash == hash && SameFrameState(table[i].timelineFrame, f)) return table[i].frame-1;
+    table[i] = (HeldFrame){ .hash = hash, .timelineFrame = f, .frame = frame+1 };
+    return -1;
+}
+
+// a rendered frame leaves the queue: read back into the export buffer and
+// encoded, nothing is allocated past the first frame
+static void EncodeQueuedFrame(struct mjpegw_context *ctx, RenderTexture framebuffer, unsigned char *readback,
+    double *timings){
+    double t = GetTime();
+    Image image;
+    const unsigned char *pixels = ReadExportFrame(framebuffer, readback, &image);
+    timings[EXPORT_READBACK] += GetTime() - t;
+
+    t = GetTime();
+    int stride;
+    const unsigned char *top = TopRow(pixels, camera.w, camera.h, &stride);
+    mjpegw_add_frame(ctx, top, stride, (int)outputQuality);
+    timings[EXPORT_ENCODE] += GetTime() - t;
+    UnloadImage(image);
+}
+
+// a still of the current frame, the encoder splits it in slices encoded in parallel
+static void RenderCurrentFrame(char *filename){
+    if (timeline.currentFrame == NULL){
+        PushLog("there is no frame to export");
+        return;
+    }
+
+    double start = GetTime();
+    RenderTexture framebuffer = LoadExportRenderTexture();
+    RenderFrameTo(timeline.currentFrame, framebuffer);
+    unsigned char *readback = malloc((size_t)camera.w*camera.h*4);
+    Image image;
+    const unsigned char *pixels = ReadExportFrame(framebuffer, readback, &image);
+
+    int stride;
+    const unsigned char *top = TopRow(pixels, camera.w, camera.h, &stride);
+    if (mjpegw_write_jpeg(filename, camera.w, camera.h, top, stride, (int)outputQuality, outputSubsampling, 0, NULL))
+        PushLog("Frame succesfully exported to: '%s' in %.1fms", filename, (GetTime() - start)*1000);
+    else
+        PushLog("'%s' could not be created", filename);
+
+    UnloadImage(image);
+    free(readback);
+    UnloadRenderTexture(framebuffer);
 }
 
+// Frames are streamed through the stages: up to EXPORT_QUEUE_FRAMES rendered
+// frames wait on the GPU while the oldest one is read back and encoded, so the
+// memory needed doesn't depend on the length of the animation. Held poses
+// aren't rendered again, the video indexes the frame they were first seen in
 static void RenderProject(VideoFormats format, char *filename){
     switch (format){
         case MJPEG_AVI: 
@@ -861,73 +1653,97 @@ static void RenderProject(VideoFormats format, char *filename){
             PushLog("filename should contain the '.avi' extension");
             return;
         }
-    }
+        break;
 
-    RenderTexture framebuffer = LoadCustomRenderTexture(camera.w, camera.h);
-    RenderTexture framebuffer2 = LoadCustomRenderTexture(camera.w, camera.h);
-    Camera2D framebufferCamera;
-    
-    // CAMERA INIIALIZATION
-    framebufferCamera.target = (Vector2){0,0};
-    framebufferCamera.offset = (Vector2){camera.w/2, camera.h/2};
-    framebufferCamera.target = (Vector2){0,0};
-    framebufferCamera.rotation = 0;
-    framebufferCamera.zoom = 1;
-    
-    Image *outputImages = calloc(timeline.frameCount, sizeof(Image));
-    for (int i=0; i<timeline.frameCount; i++){
-        SwitchFrame(i, &timeline);
-
-        framebufferCamera.target = (Vector2){
-            timeline.currentFrame->cameraPos.x,
-            timeline.currentFrame->cameraPos.y
-        };
+        case JPEG_FRAME:
+        if (!IsFileExtension(filename, ".jpg;.jpeg")){
+            PushLog("filename should contain the '.jpg' extension");
+            return;
+        }
+        RenderCurrentFrame(filename);
+        return;
+    }
 
-        framebufferCamera.zoom = timeline.currentFrame->cameraPos.zoom;
-        framebufferCamera.rotation = timeline.currentFrame->cameraPos.rotation;
-
-        // DRAW SECCTION
-        BeginTextureMode(framebuffer);
-        BeginMode2D(framebufferCamera);
-            ClearBackground((Color){
-                timeline.currentFrame->bgColor[0],
-                timeline.currentFrame->bgColor[1], 
-                timeline.currentFrame->bgColor[2],
-                255
-            });
-
-            for (PuppetSnapshot *s = timeline.currentFrame->head; s != NULL; s = s->next){
-                DrawPuppetSkin(s->puppet);
-            }
-        EndMode2D();
-        EndTextureMode();
-        
-        //framebuffer here is y-flipped, so...
-        BeginTextureMode(framebuffer2);
-            DrawTexturePro(
-                framebuffer.texture, 
-                (Rectangle){0,0,camera.w, camera.h}, 
-                (Rectangle){0,0,camera.w, camera.h*-1}, 
-                (Vector2){0,0}, 
-                0, 
-                WHITE
-            );
-        EndTextureMode();
-        outputImages[i] = LoadImageFromTexture(framebuffer2.texture);
+    // the whole encoder lives in one arena sized for this export: context,
+    // index, frames and buffers of the workers. stdlib if it can't be allocated.
+    // Workers are dropped until it fits the budget
+    uint32_t threads = mjpegw_count_threads();
+    if (threads > EXPORT_MAX_WORKERS) threads = EXPORT_MAX_WORKERS;
+    size_t arenaSize = mjpegw_memory_bound(camera.w, camera.h, outputSubsampling, threads, timeline.frameCount);
+    while (threads > 1 && arenaSize > EXPORT_MEMORY_BUDGET){
+        threads--;
+        arenaSize = mjpegw_memory_bound(camera.w, camera.h, outputSubsampling, threads, timeline.frameCount);
+    }
+    void *arenaBuffer = malloc(arenaSize);
+    mjpegw_arena arena;
+    mjpegw_mem_interface mem = mjpegw_arena_interface(&arena, arenaBuffer, arenaSize);
+
+    struct mjpegw_context *ctx = mjpegw_open(filename, camera.w, camera.h, 1000.0/frameDelay, outputSubsampling,
+        arenaBuffer != NULL ? &mem : NULL);
+    if (ctx == NULL){
+        free(arenaBuffer);
+        PushLog("'%s' could not be created", filename);
+        return;
     }
+    // exact frame duration, so the video timing is the same as the playback one
+    mjpegw_set_frame_duration(ctx, frameDelay*1000);
+    mjpegw_set_huffman(ctx, outputHuffman, EXPORT_HUFFMAN_SAMPLES);
+    mjpegw_set_rate_control(ctx, outputBitrate*1000, outputMaxFrameSize*1024);
+    // the encoder buffers are allocated once, the index too
+    mjpegw_reserve_frames(ctx, timeline.frameCount);
+    // encoding overlaps the rendering of the following frames
+    int workers = mjpegw_set_threads(ctx, threads);
+
+    int queued = timeline.frameCount < EXPORT_QUEUE_FRAMES ? timeline.frameCount : EXPORT_QUEUE_FRAMES;
+    RenderTexture queue[EXPORT_QUEUE_FRAMES];
+    for (int i=0; i<queued; i++)
+        queue[i] = LoadExportRenderTexture();
+
+    int heldSize = 1;
+    while (heldSize < timeline.frameCount*2) heldSize *= 2;
+    HeldFrame *held = calloc(heldSize, sizeof(HeldFrame));
+    // every frame is read back here, the encoder is done with it before the next one
+    unsigned char *readback = malloc((size_t)camera.w*camera.h*4);
+    int repeatOf[EXPORT_QUEUE_FRAMES];
+    int heldQ = 0;
+
+    double timings[EXPORT_STAGES] = {0};
+    double start = GetTime();
+    Frame *f = timeline.head;
+    for (int i=0; i<timeline.frameCount + queued-1; i++){
+        if (f != NULL){
+            double t = GetTime();
+            int slot = i % queued;
+            repeatOf[slot] = FindHeldFrame(held, heldSize, f, i);
+            if (repeatOf[slot] < 0) RenderFrameTo(f, queue[slot]);
+            else heldQ++;
+            timings[EXPORT_RENDER] += GetTime() - t;
+            f = f->next;
+        }
 
-    // ENCODING PHASE
-    switch (format){
-        case  MJPEG_AVI: RenderProjectMjpegAvi(outputImages, timeline.frameCount, filename); break;
+        int oldest = i - (queued-1);
+        if (oldest < 0) continue;
+        if (repeatOf[oldest % queued] >= 0) mjpegw_repeat_frame(ctx, repeatOf[oldest % queued]);
+        else EncodeQueuedFrame(ctx, queue[oldest % queued], readback, timings);
     }
+    free(held);
+    free(readback);
+    double t = GetTime();
+    mjpegw_close(ctx);
+    free(arenaBuffer);
+    timings[EXPORT_ENCODE] += GetTime() - t;
     
     // CLEAN RESOURCES
-    for (int i=0; i<timeline.frameCount; i++)
-        UnloadImage(outputImages[i]);
-    free(outputImages);
-    UnloadRenderTexture(framebuffer);
-    UnloadRenderTexture(framebuffer2);
-    PushLog("Project succesfully exported to: '%s'", filename);
+    for (int i=0; i<queued; i++)
+        UnloadRenderTexture(queue[i]);
+
+    float perFrame = 1000.0f / (timeline.frameCount > 0 ? timeline.frameCount : 1);
+    PushLog("Project succesfully exported to: '%s' in %.1fs", filename, GetTime() - start);
+    PushLog("ms per frame: render %.2f, readback %.2f, encode %.2f (%d workers, %d held frames reused)",
+        timings[EXPORT_RENDER]*perFrame,
+        timings[EXPORT_READBACK]*perFrame,
+        timings[EXPORT_ENCODE]*perFrame,
+        workers, heldQ);
 }
 
 static void CalcScrollBar(int *thumbSize, int *offset){
@@ -1105,20 +1921,12 @@ void ResizingCameraState(Viewport *v){
 }
 
 void PlayingAnimationState(Viewport *v){
-    frameTimer += GetFrameTime();
-    if (frameTimer >= frameTimerTarget){
-        frameTimer = 0;
-        if (timeline.currentFrameIndex == timeline.frameCount-1){
-            if (animationLoop){
-                SwitchFrame(0, &timeline);
-                return;
-            }
-            
-            v->updateAlways = false;
-            state = IDLE;
-            return;
-        }
-        SwitchFrame(timeline.currentFrameIndex+1, &timeline);
+    // cached frames are rendered through the virtual camera, so only the preview can use them
+    PlaybackSetCacheEnabled(cacheFrames && cameraMode == CAMERA_PREVIEW_MODE);
+    if (!PlaybackUpdate(frameDelay, animationLoop)){
+        PlaybackStop();
+        v->updateAlways = false;
+        state = IDLE;
     }
 }
 
@@ -1200,11 +2008,34 @@ void TheatreInit(Viewport *v){
     v->leftPanel.resizable = true;
     v->rightPanel.resizable = true;
     camera = (VirtualCamera){640,360};
+    ResetScenes();
     NewFrame(&timeline, false);
     UpdateVirtualCameraCorners(&timeline.currentFrame->cameraPos, virtualCameraCorners);
     OpenViewportByName("Theater");
 }
 
+// while bones, puppets or the view are being moved the render scale follows
+// the frame time, it goes back to full resolution as soon as input stops
+static void UpdateRenderScale(Viewport *v){
+    bool interacting = 
+        state == MOVING_PUPPET ||
+        state == MOVING_BONE ||
+        state == MOVING_CAMERA ||
+        state == ROTATING_CAMERA ||
+        state == RESIZING_CAMERA ||
+        IsMouseButtonDown(MOUSE_BUTTON_MIDDLE) ||
+        GetMouseWheelMove() != 0;
+
+    float scale = 1;
+    if (dynamicResolution && interacting){
+        float frameTime = GetFrameTime()*1000;
+        scale = v->renderScale;
+        if (frameTime > frameTimeTarget) scale -= RENDER_SCALE_STEP;
+        else if (frameTime < frameTimeTarget*0.6f) scale += RENDER_SCALE_STEP;
+    }
+    if (scale != v->renderScale) SetViewportRenderScale(v, scale);
+}
+
 void TheatreUpdate(Viewport *v){
     // [DELETE_BUTTON_WORKAROUND]
     // Deleting puppets changes the UI layout, but microui keeps the previous frame's input state.
@@ -1222,12 +2053,16 @@ void TheatreUpdate(Viewport *v){
 
     mousePosition = GetMouseViewportPosition(v);
     mousePositionOverlay = GetMouseOverlayPosition(v);
+    UpdateRenderScale(v);
+    if (state != PLAYING_ANIMATION) RefreshOnionSkins();
 
     if (cameraMode == CAMERA_EDITOR_MODE && state != ON_TIMELINE){
         ViewportUpdateZoom(v);
         ViewportUpdatePan(v);
     }
 
+    if (state != PLAYING_ANIMATION) JournalShortcuts();
+
     switch (state){
         case IDLE:              IdleState(v);             break;
         case MOVING_PUPPET:     MovingPuppetState(v);     break;
@@ -1282,6 +2117,36 @@ void TheatreLeftPanel(Viewport *v, mu_Context *ctx){
 
         mu_vertical_space(ctx, 5);
 
+        mu_layout_row(ctx, 2, (int[]) { 20,-1 }, 0);
+        mu_space(ctx); mu_label(ctx, "Scenes:", ctx->style->control_font_size);
+        mu_layout_row(ctx, 4, (int[]) { 20, -120, -60, -1 }, 0);
+        for (int i=0; i<scenesQ; i++){
+            mu_space(ctx);
+            mu_label(ctx, TextFormat(i == currentScene ? "> %s" : "%s", scenes[i].name), ctx->style->control_font_size);
+            mu_push_id(ctx, &i, sizeof(int));
+            if (i == currentScene){
+                mu_space(ctx);
+                mu_space(ctx);
+            }
+            else {
+                if (mu_button(ctx, "Open")){
+                    SwitchScene(i);
+                    mu_pop_id(ctx);
+                    break;
+                }
+                if (mu_button(ctx, "Delete")) DeleteScene(i);
+            }
+            mu_pop_id(ctx);
+        }
+        
+        mu_layout_row(ctx, 3, (int[]) { 20, -120, -1 }, 0);
+        mu_space(ctx);
+        static char sceneName[SCENE_NAME_LEN];
+        mu_textbox(ctx, sceneName, SCENE_NAME_LEN);
+        if (mu_button(ctx, "New Scene")) NewScene(sceneName);
+
+        mu_vertical_space(ctx, 5);
+
         mu_layout_row(ctx, 2, (int[]) { 20,-1 }, 0);
         mu_space(ctx); mu_label(ctx, "Export video:", ctx->style->control_font_size);
         mu_layout_row(ctx, 5, (int[]) { 20,-150, -120, -1 }, 0);
@@ -1299,6 +2164,38 @@ void TheatreLeftPanel(Viewport *v, mu_Context *ctx){
         mu_label(ctx, "Output format:", ctx->style->control_font_size);
         mu_layout_row(ctx, 3, (int[]) { 20, 20, -1 }, 0);
         mu_space(ctx); mu_space(ctx); mu_radiobutton(ctx, "MJPEG-AVI", ctx->style->control_font_size, (int*) &outputFormat, MJPEG_AVI);
+        mu_space(ctx); mu_space(ctx); mu_radiobutton(ctx, "JPEG (current frame)", ctx->style->control_font_size, (int*) &outputFormat, JPEG_FRAME);
+
+        mu_layout_row(ctx, 2, (int[]) { 20,  -1 }, 0);
+        mu_space(ctx);
+        mu_label(ctx, "Chroma:", ctx->style->control_font_size);
+        mu_layout_row(ctx, 5, (int[]) { 20, 20, 60, 60, -1 }, 0);
+        mu_space(ctx); mu_space(ctx);
+        mu_radiobutton(ctx, "4:4:4", ctx->style->control_font_size, (int*) &outputSubsampling, MJPEGW_444);
+        mu_radiobutton(ctx, "4:2:2", ctx->style->control_font_size, (int*) &outputSubsampling, MJPEGW_422);
+        mu_radiobutton(ctx, "4:2:0", ctx->style->control_font_size, (int*) &outputSubsampling, MJPEGW_420);
+
+        mu_layout_row(ctx, 2, (int[]) { 20,  -1 }, 0);
+        mu_space(ctx);
+        mu_label(ctx, "Huffman tables:", ctx->style->control_font_size);
+        mu_layout_row(ctx, 5, (int[]) { 20, 20, 80, 80, -1 }, 0);
+        mu_space(ctx); mu_space(ctx);
+        mu_radiobutton(ctx, "Standard", ctx->style->control_font_size, (int*) &outputHuffman, MJPEGW_HUFFMAN_STANDARD);
+        mu_radiobutton(ctx, "Sampled", ctx->style->control_font_size, (int*) &outputHuffman, MJPEGW_HUFFMAN_SAMPLED);
+        mu_radiobutton(ctx, "Per frame", ctx->style->control_font_size, (int*) &outputHuffman, MJPEGW_HUFFMAN_PER_FRAME);
+
+        mu_layout_row(ctx, 3, (int[]) { 20, 120, -1 }, 0);
+        mu_space(ctx);
+        mu_label(ctx, "Quality:", ctx->style->control_font_size);
+        mu_slider_ex(ctx, &outputQuality, 1, 100, 1, "%.0f", ctx->style->control_font_size, MU_OPT_ALIGNCENTER);
+        mu_space(ctx);
+        mu_label(ctx, "Bitrate (kbit/s):", ctx->style->control_font_size);
+        mu_number_ex(ctx, &outputBitrate, 100, "%.0f", ctx->style->control_font_size, 1, MU_OPT_ALIGNCENTER);
+        if (outputBitrate < 0) outputBitrate = 0;
+        mu_space(ctx);
+        mu_label(ctx, "Max frame (KB):", ctx->style->control_font_size);
+        mu_number_ex(ctx, &outputMaxFrameSize, 1, "%.0f", ctx->style->control_font_size, 1, MU_OPT_ALIGNCENTER);
+        if (outputMaxFrameSize < 0) outputMaxFrameSize = 0;
         
         
     }
@@ -1321,7 +2218,7 @@ void TheatreLeftPanel(Viewport *v, mu_Context *ctx){
         mu_layout_row(ctx, 4, (int[]) { 20,-100,-75, -1 }, 0);
         for (Puppet *p=puppetsCache.head; p != NULL; p = p->next){
             mu_space(ctx);
-            mu_label(ctx, p->name, ctx->style->control_font_size);
+            mu_label(ctx, TextFormat("%s (%i)", p->name, p->occurrencesQ), ctx->style->control_font_size);
             
             if (timeline.currentFrame != NULL){
                 mu_push_id(ctx, p->name, sizeof(char)*strlen(p->name));
@@ -1330,7 +2227,10 @@ void TheatreLeftPanel(Viewport *v, mu_Context *ctx){
                 PuppetSnapshot *s = PuppetIsOnFrame(p, timeline.currentFrame);
                 int showState = s != NULL;
                 if (mu_showbox(ctx, "", ctx->style->control_font_size, &showState)){
-                    if (!showState) DeletePuppetSnapshot(s, timeline.currentFrame);
+                    if (!showState){
+                        JournalRecordSnapshot(timeline.currentFrame, s, NULL);
+                        DeletePuppetSnapshot(s, timeline.currentFrame);
+                    }
                     else NewPuppetSnapshot(p, timeline.currentFrame);
                 }
                 mu_pop_id(ctx);
@@ -1395,6 +2295,21 @@ void TheatreRightPanel(Viewport *v, mu_Context *ctx){
             if (mu_button(ctx, "+")){
                 if(onionSkinsTrace < 5) onionSkinsTrace++;
             }
+
+        // UNDO HISTORY
+        mu_layout_row(ctx, 3, (int[]) {20, 122,122 }, 0);
+            mu_space(ctx);
+            if (mu_button(ctx, "Undo")) JournalUndo();
+            if (mu_button(ctx, "Redo")) JournalRedo();
+
+        mu_layout_row(ctx, 3, (int[]) {20, 80,80 }, 0);
+            float budgetMB = JournalGetBudget() / (1024.0f*1024.0f);
+            if (MuNumberORNa(ctx, "HistoryMB:", &budgetMB, true, true) && budgetMB >= 0)
+                JournalSetBudget(budgetMB * 1024 * 1024);
+
+        mu_layout_row(ctx, 2, (int[]) {20,-1 }, 0);
+            mu_space(ctx);
+            mu_label(ctx, TextFormat("History: %i steps, %.2f MB", JournalGetDepth(), JournalGetUsage() / (1024.0f*1024.0f)), ctx->style->control_font_size);
     }
 
     if (mu_header_ex(ctx, "Background Color", ctx->style->control_font_size, MU_OPT_EXPANDED | FORCE_CLOSE_IF_PLAYING)){
@@ -1558,15 +2473,14 @@ void TheatreRightPanel(Viewport *v, mu_Context *ctx){
         mu_layout_row(ctx, 3, (int[]) {20, 125, 125}, 0);
             mu_space(ctx);
             if (mu_button(ctx, "Play")){
-                frameTimer = 0;
-                frameTimerTarget = frameDelay/1000;
+                PlaybackStart(dropFrames ? PLAYBACK_DROP_FRAMES : PLAYBACK_HOLD_FRAMES);
                 v->updateAlways = true;
                 theatreTargetBone = theatreTargetPuppet = NULL;
                 state = PLAYING_ANIMATION;
             }
             
             if (mu_button(ctx, "Stop")){ 
-                frameTimer = 0;
+                PlaybackStop();
                 v->updateAlways = false;
                 state = IDLE;
             }
@@ -1576,6 +2490,41 @@ void TheatreRightPanel(Viewport *v, mu_Context *ctx){
 
         mu_layout_row(ctx, 2, (int[]) {20,-1 }, 0);
             mu_space(ctx); mu_checkbox(ctx, "Loop:", ctx->style->control_font_size, &animationLoop);
+            mu_space(ctx); mu_checkbox(ctx, "Drop Late Frames", ctx->style->control_font_size, &dropFrames);
+            if (dropFrames){
+                mu_space(ctx);
+                mu_label(ctx, TextFormat("Dropped: %i", PlaybackGetDroppedFrames()), ctx->style->control_font_size);
+            }
+            mu_space(ctx); mu_checkbox(ctx, "Cache Frames (VirtualCam)", ctx->style->control_font_size, &cacheFrames);
+            mu_space(ctx);
+            if (mu_checkbox(ctx, "Compact Frames", ctx->style->control_font_size, &compactFrames))
+                SetCompactFrames(compactFrames);
+            mu_space(ctx); mu_checkbox(ctx, "Dynamic Resolution", ctx->style->control_font_size, &dynamicResolution);
+
+        if (dynamicResolution){
+            mu_layout_row(ctx, 3, (int[]) {20, 80, 55}, 0);
+                if (MuNumberORNa(ctx, "TargetMS:", &frameTimeTarget, true, true) && frameTimeTarget < 1)
+                    frameTimeTarget = 1;
+            mu_layout_row(ctx, 2, (int[]) {20,-1 }, 0);
+                mu_space(ctx);
+                mu_label(ctx, TextFormat("Render scale: %.0f%%", v->renderScale*100), ctx->style->control_font_size);
+        }
+
+        if (cacheFrames){
+            mu_layout_row(ctx, 3, (int[]) {20, 80,80 }, 0);
+                float cacheMB = PlaybackGetCacheBudget() / (1024.0f*1024.0f);
+                if (MuNumberORNa(ctx, "CacheMB:", &cacheMB, true, true) && cacheMB >= 0)
+                    PlaybackSetCacheBudget(cacheMB * 1024 * 1024);
+
+            mu_layout_row(ctx, 2, (int[]) {20,-1 }, 0);
+                mu_space(ctx);
+                mu_label(ctx, TextFormat(
+                    "Cache: %.1f MB, %.0f%% hits", 
+                    PlaybackGetCacheUsage() / (1024.0f*1024.0f), 
+                    PlaybackGetCacheHitRate()*100), 
+                    ctx->style->control_font_size
+                );
+        }
     }
     
 }
@@ -1585,12 +2534,18 @@ void TheatreBottomPanel(Viewport *v, mu_Context *ctx){
         if (mu_button(ctx, "NewFrame")){
             timelineHoverFrame = -1;
             NewFrame(&timeline, true);
+            JournalRecordFrameInsert(timeline.currentFrame, timeline.currentFrameIndex);
             SetTimelineOffset(timeline.currentFrameIndex);
             CalcScrollBar(&scrollbarThumbWidth, &scrollbarThumboOffset);
         }
         if (mu_button(ctx, "DelFrame")){
             timelineHoverFrame = -1;
-            RemoveFrame(timeline.currentFrame, &timeline);
+            Frame *f = timeline.currentFrame;
+            Frame *prev = f->prev;
+            int index = timeline.currentFrameIndex;
+            // the journal keeps the frame alive so it can be restored
+            if (UnlinkFrame(f, index, &timeline) != NULL)
+                JournalRecordFrameRemove(f, prev, index);
             SetTimelineOffset(timeline.currentFrameIndex);
             CalcScrollBar(&scrollbarThumbWidth, &scrollbarThumboOffset);
         }
@@ -1603,6 +2558,8 @@ void TheatreBottomPanel(Viewport *v, mu_Context *ctx){
                 int i=0;
                 for (Frame *f=timeline.head; f!=NULL; f=f->next){
                     if (i==frameToCopy){
+                        if (f == timeline.currentFrame) break;
+                        JournalRecordFramePaste(timeline.currentFrame, timeline.currentFrameIndex);
                         CopyFrame(f, timeline.currentFrame);
                         SwitchFrame(timeline.currentFrameIndex, &timeline); //to apply every snapshot
                         break;
@@ -1615,6 +2572,101 @@ void TheatreBottomPanel(Viewport *v, mu_Context *ctx){
                 frameToCopy = -1;
             }
         }
+
+    mu_layout_row(ctx, 7, (int[]) {90, 80, 80, 80, 30, 55, 80}, 28);
+        if (mu_button(ctx, rangeAnchor > -1 ? "UnmarkRange" : "MarkRange"))
+            rangeAnchor = rangeAnchor > -1 ? -1 : timeline.currentFrameIndex;
+
+        if (rangeAnchor > -1){
+            int index = rangeAnchor < timeline.currentFrameIndex ? rangeAnchor : timeline.currentFrameIndex;
+            int count = abs(timeline.currentFrameIndex - rangeAnchor) + 1;
+            Frame *first = FrameAt(index, &timeline);
+            Frame *last = FrameAt(index+count-1, &timeline);
+            Frame *prev = first->prev;
+            bool changed = true;
+
+            if (mu_button(ctx, "DupRange")){
+                Frame *copy = DuplicateFrames(first, index, count, &timeline);
+                JournalRecordFramesInsert(copy, FrameAt(index+count*2-1, &timeline), count, index+count);
+            }
+            if (mu_button(ctx, "RevRange")){
+                ReverseFrames(first, last, index, count, &timeline);
+                JournalRecordFramesReverse(first, last, count, index);
+            }
+            if (mu_button(ctx, "DelRange")){
+                timelineHoverFrame = -1;
+                // the journal keeps the frames alive so they can be restored
+                if (UnlinkFrames(first, last, index, count, &timeline) != NULL)
+                    JournalRecordFramesRemove(first, last, prev, count, index);
+                else PushLog("The timeline can't be left without frames");
+            }
+
+            if (rangeAnchor > -1){
+                MuNumberORNa(ctx, "To:", &rangeTarget, true, false);
+                if (mu_button(ctx, "MoveRange")){
+                    int to = rangeTarget;
+                    if (to < 0 || to > timeline.frameCount-count) PushLog("The range doesn't fit at F%i", to);
+                    else {
+                        MoveFrames(first, last, index, count, to, &timeline);
+                        JournalRecordFramesMove(first, last, prev, count, index, to);
+                    }
+                }
+                else changed = false;
+            }
+
+            // every range operation drops the mark
+            if (changed){
+                SetTimelineOffset(timeline.currentFrameIndex);
+                CalcScrollBar(&scrollbarThumbWidth, &scrollbarThumboOffset);
+            }
+        }
+
+    // edits of the selected puppet on every frame of the range
+    if (rangeAnchor > -1 && theatreTargetPuppet != NULL){
+        int index = rangeAnchor < timeline.currentFrameIndex ? rangeAnchor : timeline.currentFrameIndex;
+        int count = abs(timeline.currentFrameIndex - rangeAnchor) + 1;
+        BatchEdit edit = {
+            .type = -1,
+            .bone = theatreTargetBone,
+            .propagate = propagateRotation
+        };
+
+        mu_layout_row(ctx, 9, (int[]) {90, 20, 55, 20, 55, 70, 45, 55, 70}, 28);
+            mu_label(ctx, "Batch:", ctx->style->control_font_size);
+            MuNumberORNa(ctx, "X:", &batchOffset.x, true, false);
+            MuNumberORNa(ctx, "Y:", &batchOffset.y, true, false);
+            if (mu_button(ctx, "Offset")){
+                edit.type = BATCH_OFFSET;
+                edit.offset = batchOffset;
+            }
+            MuNumberORNa(ctx, "Scale:", &batchScale, true, false);
+            if (mu_button(ctx, "Scale") && batchScale > 0){
+                edit.type = BATCH_SCALE;
+                edit.scale = batchScale;
+            }
+
+        mu_layout_row(ctx, 5, (int[]) {90, 45, 55, 70, 80}, 28);
+            mu_space(ctx);
+            MuNumberORNa(ctx, "Deg:", &batchDegrees, true, false);
+            if (mu_button(ctx, "Rotate") && theatreTargetBone != NULL){
+                edit.type = BATCH_ROTATE;
+                edit.degrees = batchDegrees;
+            }
+            if (mu_button(ctx, "SwapSkin")){
+                if (theatreTargetBone == NULL || theatreTargetBone == theatreTargetPuppet)
+                    PushLog("Select a bone to swap its skin");
+                else {
+                    edit.type = BATCH_SKIN;
+                    edit.skin = theatreTargetBone->skin;
+                }
+            }
+
+        if ((int) edit.type >= 0){
+            Frame *first = FrameAt(index, &timeline);
+            int edited = BatchEditFrames(theatreTargetPuppet, first, index, count, &edit);
+            PushLog("'%s' edited on %i frames", theatreTargetPuppet->name, edited);
+        }
+    }
 }
 
 void TheatreRenderUnderlay(Viewport *v){   
@@ -1636,6 +2688,10 @@ void TheatreRender(Viewport *v){
             255 - timeline.currentFrame->bgColor[2],
             255
         };
+
+        // what the viewport shows, puppets whose bounds miss it are not drawn
+        Vector2 view[4];
+        GetCamera2DQuad(v->camera, v->size.width, v->size.height*-1, view);
         
         // RENDER ONION SKINS
         if (state != PLAYING_ANIMATION){
@@ -1645,7 +2701,7 @@ void TheatreRender(Viewport *v){
                 if (i++ >= onionSkinsTrace) break;
                 float opacity = baseOpacity * (onionSkinsTrace - i + 1);
                 for (PuppetSnapshot *s = f->head; s != NULL; s = s->next){
-                    DrawOnionSkin(s, opacity);
+                    if (IsRectOnQuad(s->boundaries, view)) DrawOnionSkin(s, opacity);
                 }
 
                 // DRAW ONION FRAME
@@ -1659,14 +2715,20 @@ void TheatreRender(Viewport *v){
             }
         }
 
-        // RENDER PUPPETS
-        for (PuppetSnapshot *s = timeline.currentFrame->head; s != NULL; s = s->next){
+        // RENDER PUPPETS (a cached frame is drawn on the overlay instead).
+        // while playing the puppets only hold the frame pose, so its display list is replayed
+        bool playing = state == PLAYING_ANIMATION;
+        if (playing && PlaybackGetCachedFrame(timeline.currentFrame) == NULL)
+            DrawDisplayList(GetFrameDisplayList(timeline.currentFrame), Vector2Zero(), view);
+
+        // the bounds of the selected puppet lag behind while it is dragged
+        for (PuppetSnapshot *s = timeline.currentFrame->head; s != NULL && !playing; s = s->next){
+            if (s->puppet != theatreTargetPuppet && !IsRectOnQuad(s->boundaries, view)) continue;
             DrawPuppetSkin(s->puppet);
             if (theatreTargetBone != NULL){
                 DrawCircle(theatreTargetBone->position.x, theatreTargetBone->position.y, (HINGE_RADIUS+2)/v->camera.zoom, PINK);
             }
-            if (state != PLAYING_ANIMATION)
-                DrawPuppetSkeleton(s->puppet, v->camera.zoom, renderBones);
+            DrawPuppetSkeleton(s->puppet, v->camera.zoom, renderBones);
         }
     
         // RENDER CAMERA PREVIEW
@@ -1681,6 +2743,19 @@ void TheatreRender(Viewport *v){
 }
 
 void TheatreRenderOverlay(Viewport *v){
+    RenderTexture *cached = state == PLAYING_ANIMATION ? PlaybackGetCachedFrame(timeline.currentFrame) : NULL;
+    if (cached != NULL){
+        DrawTextureRec(
+            cached->texture,
+            (Rectangle){0, 0, camera.w, camera.h*-1},
+            (Vector2){
+                v->size.width/2 - camera.w/2,
+                (v->size.height*-1-TIMELINE_HEIGHT-TIMELINE_SCROLLBAR_HEIGHT)/2 - camera.h/2
+            },
+            WHITE
+        );
+    }
+
     if (cameraMode == CAMERA_PREVIEW_MODE){
         VirtualCameraSnapshot *camPos = &timeline.currentFrame->cameraPos;
         float heightDelta = (v->size.height*-1-camera.h)/2;
@@ -1699,14 +2774,35 @@ void TheatreRenderOverlay(Viewport *v){
 
     int frameMargin = TIMELINE_FRAME_DISTANCE;
     int frameDimension = TIMELINE_HEIGHT - TIMELINE_FRAME_DISTANCE*2;
-    for (int i=0; i<timeline.frameCount; i++){
+
+    // frames featuring the selected puppet get a mark
+    int featured = -1;
+    if (theatreTargetBone != NULL)
+        featured = MarkPuppetFrames(theatreTargetBone->root != NULL ? theatreTargetBone->root : theatreTargetBone);
+
+    Frame *f = timeline.head;
+    for (int i=0; i<timeline.frameCount; i++, f = f->next){
+        if (f->stamp == featured){
+            DrawRectangle(
+                frameMargin + timelineOffset,
+                timelineY+TIMELINE_FRAME_DISTANCE+frameDimension+2,
+                frameDimension,
+                3,
+                PINK
+            );
+        }
+
         Color linesColor = VIEWPORT_OUTLINE_C;
+        bool inRange = rangeAnchor > -1 &&
+            (i - rangeAnchor) * (i - timeline.currentFrameIndex) <= 0;
         if (i == frameToCopy)
             linesColor = GREEN;
         else if (i == timeline.currentFrameIndex)
             linesColor = VIEWPORT_TITLE_C;
         else if (i == timelineHoverFrame)
             linesColor = WHITE;
+        else if (inRange)
+            linesColor = ORANGE;
 
         DrawRectangleLines(
             frameMargin + timelineOffset, 
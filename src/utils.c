@@ -226,6 +226,45 @@ void GetRectCorners(Rectangle rect, Vector2 center, float zoom, float rotation,
     }
 }
 
+// world space corners of what camera shows on a width x height target
+void GetCamera2DQuad(Camera2D camera, float width, float height, Vector2 *quad){
+    quad[0] = GetScreenToWorld2D((Vector2){0, 0}, camera);
+    quad[1] = GetScreenToWorld2D((Vector2){width, 0}, camera);
+    quad[2] = GetScreenToWorld2D((Vector2){width, height}, camera);
+    quad[3] = GetScreenToWorld2D((Vector2){0, height}, camera);
+}
+
+static bool ProjectionsOverlap(Vector2 axis, Vector2 *a, Vector2 *b){
+    float minA = INFINITY, maxA = -INFINITY, minB = INFINITY, maxB = -INFINITY;
+    for (int i=0; i<4; i++){
+        float pa = Vector2DotProduct(a[i], axis);
+        float pb = Vector2DotProduct(b[i], axis);
+        if (pa < minA) minA = pa;
+        if (pa > maxA) maxA = pa;
+        if (pb < minB) minB = pb;
+        if (pb > maxB) maxB = pb;
+    }
+    return maxA >= minB && maxB >= minA;
+}
+
+// separating axis test between r and a rectangle rotated any angle (quad in winding order)
+bool IsRectOnQuad(Rectangle r, Vector2 *quad){
+    Vector2 corners[4] = {
+        {r.x, r.y},
+        {r.x + r.width, r.y},
+        {r.x + r.width, r.y + r.height},
+        {r.x, r.y + r.height}
+    };
+
+    if (!ProjectionsOverlap((Vector2){1, 0}, corners, quad)) return false;
+    if (!ProjectionsOverlap((Vector2){0, 1}, corners, quad)) return false;
+    for (int i=0; i<2; i++){
+        Vector2 edge = Vector2Subtract(quad[i+1], quad[i]);
+        if (!ProjectionsOverlap((Vector2){edge.y*-1, edge.x}, corners, quad)) return false;
+    }
+    return true;
+}
+
 float AngleBetweenVectors(Vector2 a, Vector2 b) {
     float dot = a.x*b.x + a.y*b.y;
     float det = a.x*b.y - a.y*b.x;
@@ -274,6 +313,26 @@ RenderTexture2D LoadCustomRenderTexture(int width, int height){
     return target;
 }
 
+// rlgl only reads back into memory it allocates, glReadPixels comes from the
+// loader of the GLFW raylib is built with (desktop and web)
+typedef void (*GLFWglproc)(void);
+GLFWglproc glfwGetProcAddress(const char *procname);
+typedef void (*ReadPixelsProc)(int x, int y, int width, int height, unsigned int format, unsigned int type, void *pixels);
+
+// RGBA pixels of an R8G8B8A8 render texture into pixels (width*height*4
+// bytes), rows bottom-up as OpenGL keeps them. false if it can't be read
+bool ReadRenderTexturePixels(RenderTexture2D target, unsigned char *pixels){
+    static ReadPixelsProc readPixels = NULL;
+    if (readPixels == NULL) readPixels = (ReadPixelsProc)glfwGetProcAddress("glReadPixels");
+    if (readPixels == NULL || pixels == NULL) return false;
+
+    rlDrawRenderBatchActive();
+    rlEnableFramebuffer(target.id);
+    readPixels(0, 0, target.texture.width, target.texture.height, 0x1908, 0x1401, pixels); // GL_RGBA, GL_UNSIGNED_BYTE
+    rlDisableFramebuffer();
+    return true;
+}
+
 int RemoveDir(char *path){
     DIR *dir = opendir(path);
     struct dirent *entry;
@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdio.h>
 #include "config.h"
 #include "microui.h"
@@ -58,6 +59,7 @@ void InitViewport(  char* title,
     v->camera.rotation = 0.0f;
     v->camera.zoom = 1.0f;
     v->renderTexture = LoadCustomRenderTexture(w,h);
+    v->renderScale = 1;
     
     // LINK THE LIST
     if (viewports.tail == NULL){
@@ -96,16 +98,63 @@ void RenderViewportToScreen(Viewport *v){
 }
 
 void RenderViewport(Viewport *v){
+    // a reduced render scale only affects the Render pass, it is drawn
+    // smaller and stretched over the underlay. The overlay stays sharp
+    bool scaled = v->renderScale < 1 && v->sceneTexture.id != 0;
+    if (scaled){
+        Camera2D camera = v->camera;
+        camera.zoom *= v->renderScale;
+        camera.offset = Vector2Scale(camera.offset, v->renderScale);
+        BeginTextureMode(v->sceneTexture);
+        ClearBackground(BLANK);
+        BeginMode2D(camera);
+        if (v->Render != NULL) v->Render(v);
+        EndMode2D();
+        EndTextureMode();
+    }
+
     BeginTextureMode(v->renderTexture);
     ClearBackground(VIEWPORT_BG_C);
     if (v->RenderUnderlay != NULL) v->RenderUnderlay(v);
-    BeginMode2D(v->camera);
-    if (v->Render != NULL) v->Render(v);
-    EndMode2D();
+    if (scaled){
+        DrawTexturePro(
+            v->sceneTexture.texture,
+            (Rectangle){0, 0, v->sceneTexture.texture.width, v->sceneTexture.texture.height*-1},
+            (Rectangle){0, 0, v->size.width, v->size.height*-1},
+            Vector2Zero(),
+            0,
+            WHITE
+        );
+    }
+    else {
+        BeginMode2D(v->camera);
+        if (v->Render != NULL) v->Render(v);
+        EndMode2D();
+    }
     if (v->RenderOverlay != NULL) v->RenderOverlay(v);
     EndTextureMode();
 }
 
+// scale (MIN_RENDER_SCALE to 1) is rounded to RENDER_SCALE_STEP, so the
+// scene texture is only reloaded on actual steps
+void SetViewportRenderScale(Viewport *v, float scale){
+    scale = roundf(scale / RENDER_SCALE_STEP) * RENDER_SCALE_STEP;
+    if (scale < MIN_RENDER_SCALE) scale = MIN_RENDER_SCALE;
+    if (scale > 1) scale = 1;
+
+    int w = v->size.width * scale;
+    int h = v->size.height*-1 * scale;
+    if (scale < 1 && v->sceneTexture.id != 0 && v->sceneTexture.texture.width == w && v->sceneTexture.texture.height == h){
+        v->renderScale = scale;
+        return;
+    }
+
+    if (v->sceneTexture.id != 0) UnloadRenderTexture(v->sceneTexture);
+    v->sceneTexture = (RenderTexture){0};
+    if (scale < 1) v->sceneTexture = LoadCustomRenderTexture(w, h);
+    v->renderScale = scale;
+}
+
 void UpdateViewportUIInput(Viewport *v){
     Vector2 mousePosition = GetMousePosition();
     mu_input_mousemove(&v->ctx, mousePosition.x, mousePosition.y);
@@ -217,6 +266,7 @@ void ResizeViewport(Viewport *v, int w, int h){
 
     UnloadRenderTexture(v->renderTexture);
     v->renderTexture = LoadCustomRenderTexture(v->size.width, v->size.height*-1);
+    if (v->renderScale < 1) SetViewportRenderScale(v, v->renderScale);
 
     ProcessViewportUI(v);
 }
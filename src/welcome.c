@@ -69,7 +69,7 @@ void WelcomeLeftPanel(Viewport *v, mu_Context *ctx){
 
     mu_space(ctx); if (mu_button(ctx, "Load Sample Puppet")){
         Puppet *samplePuppet = LoadPuppet("/PuppetStudio/puppets/samplePuppet0/sample.puppet");
-        CopyPuppetToList(samplePuppet, &puppetsCache, "SamplePuppet");
+        CopyPuppetToList(samplePuppet, &puppetsCache, "SamplePuppet", 0);
         DeletePuppet(samplePuppet);
         NewPuppetSnapshot(puppetsCache.head, timeline.currentFrame);
         ToggleViewport(v);
@@ -5,6 +5,7 @@
 #include <string.h>
 #include "microui.h"
 #include "theater.h"
+#include "journal.h"
 #include "viewports.h"
 #include "puppets.h"
 #include "utils.h"
@@ -37,6 +38,7 @@ void DeleteSelectedBone(){
     if (onEditSelectedBone == NULL) return;
     if (onEditSelectedBone == onEditPuppet) return;
     Bone *b = onEditSelectedBone->parent;
+    JournalDropPuppet(onEditPuppet);
     DeleteBone(onEditSelectedBone);
     RebuildDescendants(onEditPuppet);
     lastZIndex = RebuildZIndex(onEditPuppet);
@@ -45,6 +47,7 @@ void DeleteSelectedBone(){
 
 void DeleteEditPuppet(){
     if (onEditPuppet == NULL) return;
+    JournalDropPuppet(onEditPuppet);
     DeletePuppet(onEditPuppet);
     onEditSelectedBone = NULL;
 }
@@ -255,7 +258,7 @@ void WorkShopRightPanel(Viewport *v, mu_Context *ctx){
                 if (strcmp(puppetName,"") == 0) PushLog("Can't add a noname puppet to project!");
                 else if (PuppetNameIsOnList(puppetName,&puppetsCache)) PushLog("A puppet with that name already exists!");
                 else{
-                    CopyPuppetToList(onEditPuppet, &puppetsCache, puppetName);
+                    CopyPuppetToList(onEditPuppet, &puppetsCache, puppetName, 0);
                     PushLog("'%s' succesfully added to project!", puppetName);
                     memset(puppetName, '\0', 256);
                 }
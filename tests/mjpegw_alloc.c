@@ -0,0 +1,233 @@
+// Calls through mjpegw_mem_interface while a video is written. Everything is allocated up to the first
+// mjpegw_add_frame, after it no frame and no repeat calls the allocator, on the calling thread or encoded
+// by the workers, in every huffman mode, frames too big for their buffers included. An arena of
+// mjpegw_memory_bound bytes must never run out
+#include "../src/mjpegw.c"
+#include "tests.h"
+
+#define WIDTH       97
+#define HEIGHT      61
+#define FRAMES      40
+#define SAMPLES     4
+#define VIDEO_FILE  "build/tests/mjpegw_alloc.avi"
+#define ARENA_FILE  "build/tests/mjpegw_alloc_arena.avi"
+
+// counts the calls and the failed ones, then forwards them to [inner]
+typedef struct counting_allocator
+{
+    mjpegw_mem_interface inner;
+    uint32_t calls;
+    uint32_t failed;
+} counting_allocator;
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void* counting_malloc(size_t size, void* user)
+{
+    counting_allocator* counter = (counting_allocator*) user;
+    void* ptr = counter->inner.malloc_fn(size, counter->inner.user);
+    counter->calls++;
+    counter->failed += ptr == NULL;
+    return ptr;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void* counting_realloc(void* old_ptr, size_t old_size, size_t new_size, void* user)
+{
+    counting_allocator* counter = (counting_allocator*) user;
+    void* ptr = counter->inner.realloc_fn(old_ptr, old_size, new_size, counter->inner.user);
+    counter->calls++;
+    counter->failed += ptr == NULL;
+    return ptr;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void counting_free(void* ptr, void* user)
+{
+    counting_allocator* counter = (counting_allocator*) user;
+    counter->inner.free_fn(ptr, counter->inner.user);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static mjpegw_mem_interface counting_interface(counting_allocator* counter, mjpegw_mem_interface inner)
+{
+    *counter = (counting_allocator) { .inner = inner };
+
+    return (mjpegw_mem_interface)
+    {
+        .malloc_fn  = counting_malloc,
+        .realloc_fn = counting_realloc,
+        .free_fn    = counting_free,
+        .user       = counter
+    };
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// noise, the frames don't compress the same and the sampled tables miss symbols of the later ones
+static void fill(uint8_t* rgba, int frame)
+{
+    uint32_t seed = 2654435761u * (uint32_t)(frame + 1);
+    for (int i = 0; i < WIDTH * HEIGHT * 4; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        rgba[i] = (uint8_t)(seed >> 24);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Writes [filename] through [mem], returns the calls after the first frame. Rate control keeps most
+// frames small, without it noise at [quality] 100 is bigger than the frame buffers
+static uint32_t write_video(const char* filename, mjpegw_mem_interface* mem, counting_allocator* counter,
+                            uint32_t threads, mjpegw_huffman huffman, int quality, int rate_control)
+{
+    uint8_t* pixels = malloc(WIDTH * HEIGHT * 4);
+    struct mjpegw_context* ctx = mjpegw_open(filename, WIDTH, HEIGHT, 24, MJPEGW_420, mem);
+    if (!ctx)
+    {
+        free(pixels);
+        return UINT32_MAX;
+    }
+
+    mjpegw_set_huffman(ctx, huffman, SAMPLES);
+    if (rate_control)
+        mjpegw_set_rate_control(ctx, 400000, 4096);
+    mjpegw_reserve_frames(ctx, FRAMES + 1);
+    if (threads > 0)
+        mjpegw_set_threads(ctx, threads);
+
+    uint32_t first = 0;
+    for (int f = 0; f < FRAMES; f++)
+    {
+        fill(pixels, f);
+        mjpegw_add_frame(ctx, pixels, 0, quality);
+        if (f == 0)
+            first = counter->calls;
+    }
+    mjpegw_repeat_frame(ctx, FRAMES / 2);
+    uint32_t calls = counter->calls - first;
+
+    mjpegw_close(ctx);
+    free(pixels);
+    return calls;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static int same_files(const char* a, const char* b)
+{
+    FILE* fa = fopen(a, "rb");
+    FILE* fb = fopen(b, "rb");
+    int same = fa && fb;
+    while (same)
+    {
+        int ca = fgetc(fa), cb = fgetc(fb);
+        same = ca == cb;
+        if (ca == EOF)
+            break;
+    }
+    if (fa)
+        fclose(fa);
+    if (fb)
+        fclose(fb);
+    return same;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void check_video(uint32_t threads, mjpegw_huffman huffman)
+{
+    const char* modes[] = { "standard", "per frame", "sampled" };
+    const char* mode = modes[huffman];
+
+    // stdlib
+    counting_allocator counter;
+    mjpegw_mem_interface mem = counting_interface(&counter, default_allocator());
+    uint32_t calls = write_video(VIDEO_FILE, &mem, &counter, threads, huffman, 80, 1);
+    CHECK(calls == 0, "threads %u huffman %s: %u allocations after the first frame", threads, mode, calls);
+
+    // an arena of the bound, one byte off any alignment
+    size_t size = mjpegw_memory_bound(WIDTH, HEIGHT, MJPEGW_420, threads, FRAMES + 1);
+    uint8_t* buffer = malloc(size + 1);
+    mjpegw_arena arena;
+    mjpegw_mem_interface arena_mem = mjpegw_arena_interface(&arena, buffer + 1, size);
+    mem = counting_interface(&counter, arena_mem);
+    calls = write_video(ARENA_FILE, &mem, &counter, threads, huffman, 80, 1);
+    CHECK(calls == 0, "threads %u huffman %s: %u arena allocations after the first frame", threads, mode, calls);
+    CHECK(counter.failed == 0, "threads %u huffman %s: arena of %zu bytes ran out %u times", threads, mode, size,
+          counter.failed);
+    CHECK(same_files(VIDEO_FILE, ARENA_FILE), "threads %u huffman %s: arena video differs", threads, mode);
+
+    free(buffer);
+    remove(VIDEO_FILE);
+    remove(ARENA_FILE);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// Frames past their buffer are encoded again straight into the file, the chunks must hold the same JPEG
+// a growing buffer gets
+static void check_streamed(uint32_t threads)
+{
+    counting_allocator counter;
+    mjpegw_mem_interface mem = counting_interface(&counter, default_allocator());
+    uint32_t calls = write_video(VIDEO_FILE, &mem, &counter, threads, MJPEGW_HUFFMAN_STANDARD, 100, 0);
+    CHECK(calls == 0, "threads %u streamed: %u allocations after the first frame", threads, calls);
+
+    FILE* f = fopen(VIDEO_FILE, "rb");
+    long size = 0;
+    uint8_t* file = NULL;
+    if (f && fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) > 0)
+    {
+        file = malloc(size);
+        fseek(f, 0, SEEK_SET);
+        size = (long)fread(file, 1, size, f);
+    }
+    if (f)
+        fclose(f);
+
+    // the chunks of the movi list, the repeat points to an earlier one
+    long pos = 0;
+    while (file && pos + 4 <= size && memcmp(file + pos, "movi", 4) != 0)
+        pos++;
+    pos += 4;
+
+    uint8_t* pixels = malloc(WIDTH * HEIGHT * 4);
+    int frames = 0, streamed = 0;
+    for (; file && pos + 8 <= size && memcmp(file + pos, "00dc", 4) == 0; frames++)
+    {
+        uint32_t chunk_size;
+        memcpy(&chunk_size, file + pos + 4, 4);
+
+        jpeg_buffer expected = { .mem = &mem };
+        fill(pixels, frames);
+        tje_encode_with_func(jpeg_write_func, &expected, 100, MJPEGW_420, NULL, WIDTH, HEIGHT, 4, WIDTH * 4, pixels);
+        CHECK(chunk_size == expected.size + (expected.size & 1) && pos + 8 + expected.size <= size
+              && memcmp(file + pos + 8, expected.data, expected.size) == 0,
+              "threads %u streamed: frame %d differs", threads, frames);
+        streamed += expected.size > frame_size_estimate(WIDTH, HEIGHT, MJPEGW_420);
+        free_jpeg_buffer(&expected);
+
+        pos += 8 + chunk_size;
+    }
+    CHECK(frames == FRAMES, "threads %u streamed: %d frames in the movi list", threads, frames);
+    CHECK(streamed == frames, "threads %u streamed: only %d frames past their buffer", threads, streamed);
+
+    free(pixels);
+    free(file);
+    remove(VIDEO_FILE);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+int main(void)
+{
+    // encoded on the calling thread, then by a pool of workers
+    const uint32_t threads[] = { 0, 2 };
+    const mjpegw_huffman modes[] = { MJPEGW_HUFFMAN_STANDARD, MJPEGW_HUFFMAN_PER_FRAME, MJPEGW_HUFFMAN_SAMPLED };
+    int videos = 0;
+
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++, videos++)
+            check_video(threads[t], modes[m]);
+
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++, videos++)
+        check_streamed(threads[t]);
+
+    printf("mjpegw_alloc: %d videos of %d frames, %d failures\n", videos, FRAMES + 1, failures);
+    return failures != 0;
+}
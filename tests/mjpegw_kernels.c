@@ -0,0 +1,144 @@
+// Every kernel table the CPU runs against tjei_kernels_scalar on random blocks. On x86 the vector code
+// must give the scalar output bit for bit, -march=native builds too. NEON builds only keep colors and
+// filters within TOLERANCE and coefficients within one quantization step (see the block kernels comment)
+#include "../src/mjpegw.c"
+#include "tests.h"
+
+#define BLOCKS      200000
+#define TOLERANCE   1e-3f
+
+typedef struct kernels_case
+{
+    const char* name;
+    const TJEKernels* kernels;
+} kernels_case;
+
+static uint32_t seed = 12345;
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static uint32_t next_random(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// a float in [-range, range) with random low bits, not only whole numbers
+static float random_float(float range)
+{
+    return ((float)(next_random() & 0xffffff) / 0x800000 - 1) * range;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static int same_floats(const float* a, const float* b, int count)
+{
+#if defined(TJEI_SIMD_NEON)
+    for (int i = 0; i < count; i++)
+        if (fabsf(a[i] - b[i]) > TOLERANCE)
+            return 0;
+    return 1;
+#else
+    return memcmp(a, b, sizeof(float) * count) == 0;
+#endif
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static int same_coefficients(const int* a, const int* b)
+{
+    for (int i = 0; i < 64; i++)
+    {
+#if defined(TJEI_SIMD_NEON)
+        if (abs(a[i] - b[i]) > 1)
+            return 0;
+#else
+        if (a[i] != b[i])
+            return 0;
+#endif
+    }
+    return 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void check_kernels(const kernels_case* k, const struct TJEProcessedQT* tables, int tables_count)
+{
+    const TJEKernels* scalar = &tjei_kernels_scalar;
+    int colors = 0, coefficients = 0, filters = 0;
+
+    for (int n = 0; n < BLOCKS; n++)
+    {
+        uint8_t rgba[64 * 4];
+        for (int i = 0; i < 64 * 4; i++)
+            rgba[i] = (uint8_t)next_random();
+
+        float y[3][64], cb[3][64], cr[3][64];
+        scalar->rgba_to_ycbcr(rgba, y[0], cb[0], cr[0]);
+        k->kernels->rgba_to_ycbcr(rgba, y[1], cb[1], cr[1]);
+        colors += same_floats(y[0], y[1], 64) && same_floats(cb[0], cb[1], 64) && same_floats(cr[0], cr[1], 64);
+
+        // converted pixels and values spread over the whole range of a block
+        float* block = y[0];
+        if (n & 1)
+        {
+            for (int i = 0; i < 64; i++)
+                y[2][i] = random_float(128);
+            block = y[2];
+        }
+
+        const struct TJEProcessedQT* pqt = &tables[n % tables_count];
+        int out[2][64];
+        scalar->fdct_quantize(block, (n & 2) ? pqt->chroma : pqt->luma, out[0]);
+        k->kernels->fdct_quantize(block, (n & 2) ? pqt->chroma : pqt->luma, out[1]);
+        coefficients += same_coefficients(out[0], out[1]);
+
+        float mcu[4 * 64], down[2][64];
+        for (int i = 0; i < 4 * 64; i++)
+            mcu[i] = random_float(128);
+        int v_factor = 1 + (n & 1);
+        scalar->downsample(mcu, v_factor, down[0]);
+        k->kernels->downsample(mcu, v_factor, down[1]);
+        filters += same_floats(down[0], down[1], 64);
+    }
+
+    CHECK(colors == BLOCKS, "%s rgba_to_ycbcr: %d of %d blocks differ", k->name, BLOCKS - colors, BLOCKS);
+    CHECK(coefficients == BLOCKS, "%s fdct_quantize: %d of %d blocks differ", k->name, BLOCKS - coefficients, BLOCKS);
+    CHECK(filters == BLOCKS, "%s downsample: %d of %d blocks differ", k->name, BLOCKS - filters, BLOCKS);
+    printf("mjpegw_kernels: %s checked on %d blocks\n", k->name, BLOCKS);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+int main(void)
+{
+    kernels_case cases[2];
+    int count = 0;
+
+#if defined(TJEI_SIMD_X86)
+    if (__builtin_cpu_supports("sse2"))
+        cases[count++] = (kernels_case) { "sse2", &tjei_kernels_v4 };
+    if (__builtin_cpu_supports("avx2"))
+        cases[count++] = (kernels_case) { "avx2", &tjei_kernels_avx2 };
+#elif defined(TJEI_SIMD_NEON)
+    cases[count++] = (kernels_case) { "neon", &tjei_kernels_v4 };
+#endif
+
+    // the quantization tables of the whole quality range
+    const int qualities[] = { 1, 10, 25, 50, 75, 90, 100 };
+    const int tables_count = sizeof(qualities) / sizeof(qualities[0]);
+    struct TJEProcessedQT tables[sizeof(qualities) / sizeof(qualities[0])];
+    for (int i = 0; i < tables_count; i++)
+    {
+        TJEState state;
+        tjei_init_state(&state, NULL, NULL, qualities[i], MJPEGW_444, NULL);
+        tjei_build_processed_qt(&state, &tables[i]);
+    }
+
+    for (int i = 0; i < count; i++)
+        check_kernels(&cases[i], tables, tables_count);
+
+    if (count == 0)
+        printf("mjpegw_kernels: no vector kernels in this build, the scalar ones are used\n");
+
+    printf("mjpegw_kernels: %d kernel tables, %d failures\n", count, failures);
+    return failures != 0;
+}
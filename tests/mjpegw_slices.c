@@ -0,0 +1,130 @@
+// Stills split in restart intervals (encode_sliced) against the single scan of tje_encode_with_func,
+// both decoded with libjpeg. The intervals only restart the DC prediction, so the pixels must match
+#include "../src/mjpegw.c"
+#include "tests.h"
+
+#include <jpeglib.h>
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// RGB of the whole image, NULL if libjpeg doesn't get the same size back or had to recover from corrupt data
+static uint8_t* decode(const jpeg_buffer* jpeg, uint32_t width, uint32_t height)
+{
+    struct jpeg_decompress_struct info;
+    struct jpeg_error_mgr err;
+    info.err = jpeg_std_error(&err);
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, jpeg->data, jpeg->size);
+    jpeg_read_header(&info, TRUE);
+    info.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&info);
+
+    uint8_t* rgb = NULL;
+    if (info.output_width == width && info.output_height == height && info.output_components == 3)
+    {
+        rgb = malloc((size_t)width * height * 3);
+        while (info.output_scanline < info.output_height)
+        {
+            JSAMPROW row = rgb + (size_t)info.output_scanline * width * 3;
+            jpeg_read_scanlines(&info, &row, 1);
+        }
+    }
+    else
+        jpeg_abort_decompress(&info);
+
+    if (rgb)
+        jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+
+    if (err.num_warnings != 0)
+    {
+        free(rgb);
+        return NULL;
+    }
+    return rgb;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+// gradients with noise, every block has some detail
+static void fill(uint8_t* rgba, uint32_t width, uint32_t height)
+{
+    uint32_t seed = width * 7919 + height;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint8_t* px = rgba + ((size_t)y * width + x) * 4;
+            px[0] = (uint8_t)(x * 255 / width + (seed >> 28));
+            px[1] = (uint8_t)(y * 255 / height);
+            px[2] = (uint8_t)((x + y) * 2 + (seed >> 26));
+            px[3] = 255;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+static void check_still(const uint8_t* pixels, uint32_t width, uint32_t height, int bottom_up, int quality,
+                        mjpegw_subsampling subsampling, uint32_t threads)
+{
+    mjpegw_mem_interface mem = default_allocator();
+    const uint8_t* top = pixels;
+    int stride = (int)width * 4;
+    if (bottom_up)
+    {
+        top = pixels + (size_t)(height - 1) * width * 4;
+        stride = -stride;
+    }
+
+    jpeg_buffer single = { .mem = &mem };
+    jpeg_buffer sliced = { .mem = &mem };
+    int encoded = tje_encode_with_func(jpeg_write_func, &single, quality, subsampling, NULL, width, height, 4, stride, top);
+    encoded &= encode_sliced(&sliced, &mem, top, stride, width, height, quality, subsampling, threads);
+    CHECK(encoded, "%ux%u q%d s%d t%u: not encoded", width, height, quality, subsampling, threads);
+
+    uint8_t* expected = encoded ? decode(&single, width, height) : NULL;
+    uint8_t* actual = encoded ? decode(&sliced, width, height) : NULL;
+    CHECK(expected && actual, "%ux%u q%d s%d t%u: not decoded", width, height, quality, subsampling, threads);
+
+    if (expected && actual)
+    {
+        size_t size = (size_t)width * height * 3;
+        size_t first = 0;
+        while (first < size && expected[first] == actual[first])
+            first++;
+        CHECK(first == size, "%ux%u q%d s%d t%u bottom_up %d: differs at pixel %zu", width, height, quality,
+              subsampling, threads, bottom_up, first / 3);
+    }
+
+    free(expected);
+    free(actual);
+    free_jpeg_buffer(&single);
+    free_jpeg_buffer(&sliced);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------
+int main(void)
+{
+    // odd sizes: partial MCUs on both edges, a single MCU, more slices than MCU rows
+    const uint32_t sizes[][2] = { { 1, 1 }, { 17, 9 }, { 33, 31 }, { 127, 65 }, { 255, 129 } };
+    const int qualities[] = { 1, 25, 50, 90, 100 };
+    const mjpegw_subsampling modes[] = { MJPEGW_444, MJPEGW_422, MJPEGW_420 };
+    const uint32_t threads[] = { 1, 2, 3, 8 };
+    int cases = 0;
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        uint32_t width = sizes[s][0], height = sizes[s][1];
+        uint8_t* pixels = malloc((size_t)width * height * 4);
+        fill(pixels, width, height);
+
+        for (size_t q = 0; q < sizeof(qualities) / sizeof(qualities[0]); q++)
+            for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+                for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++, cases++)
+                    check_still(pixels, width, height, cases & 1, qualities[q], modes[m], threads[t]);
+
+        free(pixels);
+    }
+
+    printf("mjpegw_slices: %d stills, %d failures\n", cases, failures);
+    return failures != 0;
+}
@@ -0,0 +1,12 @@
+#ifndef __TESTS_H__
+#define __TESTS_H__
+
+#include <stdio.h>
+
+// Each test is a single file built on its own: CHECK counts the failed conditions and prints them, main
+// returns failures != 0
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+#endif